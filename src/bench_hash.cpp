@@ -0,0 +1,170 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Throughput of the pieces of the Hash7 proof of work: each of the seven sph
+// functions over a long message and over a block header, the product of the
+// seven digests, and the whole hash along each path the node and miner use.
+
+#include "core.h"
+#include "hashblock.h"
+#include "util.h"
+
+#include <stdio.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+static const int nRuns = 5;
+static const size_t nLongBytes = 1 << 16;
+static const size_t nHeaderBytes = 122;
+
+static uint64_t GetTicks()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Best of several runs of a timed loop, in ticks and microseconds
+struct CBenchTime
+{
+    bool fSet;
+    uint64_t nTicks;
+    int64_t nMicros;
+
+    CBenchTime() : fSet(false), nTicks(0), nMicros(0) {}
+
+    void Update(uint64_t nTicksRun, int64_t nMicrosRun)
+    {
+        // Without a tick counter the wall clock decides which run was best
+        if (!fSet || (nTicksRun ? nTicksRun < nTicks : nMicrosRun < nMicros)) {
+            fSet = true;
+            nTicks = nTicksRun;
+            nMicros = nMicrosRun;
+        }
+    }
+};
+
+#define BENCH(time, n, x) do { \
+        for (int run = 0; run < nRuns; run++) { \
+            int64_t nStartMicros = GetTimeMicros(); \
+            uint64_t nStartTicks = GetTicks(); \
+            for (int i = 0; i < (n); i++) { x; } \
+            (time).Update(GetTicks() - nStartTicks, GetTimeMicros() - nStartMicros); \
+        } \
+    } while (0)
+
+// Per byte when nBytes is given, per call otherwise
+static void Report(const std::string& strName, const CBenchTime& time, int nCount, size_t nBytes)
+{
+    const char* name = strName.c_str();
+    double nSeconds = std::max<int64_t>(time.nMicros, 1) * 0.000001;
+    if (nBytes) {
+        if (time.nTicks)
+            printf("%-28s %10.2f cycles/byte %10.1f MB/s\n", name,
+                   (double)time.nTicks / ((double)nCount * nBytes), nCount * nBytes / nSeconds / 1000000);
+        else
+            printf("%-28s %10s cycles/byte %10.1f MB/s\n", name, "-", nCount * nBytes / nSeconds / 1000000);
+    } else {
+        if (time.nTicks)
+            printf("%-28s %10.0f cycles/hash %10.0f hashes/s\n", name,
+                   (double)time.nTicks / nCount, nCount / nSeconds);
+        else
+            printf("%-28s %10s cycles/hash %10.0f hashes/s\n", name, "-", nCount / nSeconds);
+    }
+}
+
+template<typename Context>
+static void BenchSph(const char* name, void (*init)(void*), void (*update)(void*, const void*, size_t),
+                     void (*close)(void*, void*), const unsigned char* data)
+{
+    Context ctx;
+    unsigned char digest[64];
+    CBenchTime timeLong, timeHeader;
+    BENCH(timeLong, 16, init(&ctx); update(&ctx, data, nLongBytes); close(&ctx, digest));
+    Report(strprintf("%s (64KB)", name), timeLong, 16, nLongBytes);
+    BENCH(timeHeader, 20000, init(&ctx); update(&ctx, data, nHeaderBytes); close(&ctx, digest));
+    Report(strprintf("%s (header)", name), timeHeader, 20000, 0);
+}
+
+#define BENCH_SPH(name) BenchSph<name##_context>(#name, name##_init, name, name##_close, data)
+
+// The product step as Hash7 computed it before the limb multiply
+static int Hash7MultiplyGMP(const uint512 hash[7], unsigned char* data)
+{
+    mpz_t bn, product;
+    mpz_init(bn);
+    mpz_init_set_ui(product, 1);
+    for (int i = 0; i < 7; i++) {
+        uint512 n = (hash[i] == 0 ? uint512(1) : hash[i]);
+        mpz_set_uint512(bn, n);
+        mpz_mul(product, product, bn);
+    }
+    int bytes = mpz_sizeinbase(product, 256);
+    mpz_export(data, NULL, -1, 1, 0, 0, product);
+    mpz_clear(bn);
+    mpz_clear(product);
+    return bytes;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<unsigned char> vData(nLongBytes);
+    for (size_t i = 0; i < vData.size(); i++)
+        vData[i] = (unsigned char)(i * 7 + 1);
+    const unsigned char* data = &vData[0];
+
+    printf("Timing the best of %d runs; cycles are rdtsc ticks\n\n", nRuns);
+
+    BENCH_SPH(sph_sha256);
+    BENCH_SPH(sph_sha512);
+    BENCH_SPH(sph_keccak512);
+    BENCH_SPH(sph_whirlpool);
+    BENCH_SPH(sph_haval256_5);
+    BENCH_SPH(sph_tiger);
+    BENCH_SPH(sph_ripemd160);
+    printf("\n");
+
+    uint512 hash[7];
+    for (int i = 0; i < 7; i++)
+        memcpy(hash[i].begin(), data + 64 * i, 64);
+    unsigned char product[HASH7_PRODUCT_LIMBS * 8];
+    unsigned int nCheck = 0;
+    CBenchTime timeLimbs, timeGMP;
+    BENCH(timeLimbs, 100000, hash[0].begin()[0] = i; nCheck += Hash7Multiply(hash, product));
+    Report("product (limbs)", timeLimbs, 100000, 0);
+    BENCH(timeGMP, 100000, hash[0].begin()[0] = i; nCheck += Hash7MultiplyGMP(hash, product));
+    Report("product (GMP)", timeGMP, 100000, 0);
+    printf("\n");
+
+    CBlockHeader header;
+    memcpy(header.hashPrevBlock.begin(), data, 32);
+    memcpy(header.hashMerkleRoot.begin(), data + 32, 32);
+    memcpy(header.hashAccountRoot.begin(), data + 64, 32);
+    header.nTime = 1400000000;
+    header.nHeight = 100000;
+    header.nNonce = 0;
+    uint256 hashBest = ~uint256(0);
+
+    CBenchTime timeFull, timeMidstate, timeLanes;
+    BENCH(timeFull, 4000, header.nNonce++; hashBest = std::min(hashBest, header.GetHash()));
+    Report("Hash7", timeFull, 4000, 0);
+
+    CHash7Midstate midstate;
+    header.GetHashMidstate(midstate);
+    BENCH(timeMidstate, 4000, header.nNonce++; hashBest = std::min(hashBest, header.GetHash(midstate)));
+    Report("Hash7 from midstate", timeMidstate, 4000, 0);
+
+    uint256 hashes[8];
+    BENCH(timeLanes, 500, header.GetNonceHashes(midstate, hashes); header.nNonce += 8;
+          for (int l = 0; l < 8; l++) hashBest = std::min(hashBest, hashes[l]));
+    Report(strprintf("Hash7x8 (%s)", Hash7LanesImplementation()), timeLanes, 500 * 8, 0);
+
+    // Keep the compiler from dropping any of the loops
+    printf("\n%u %s\n", nCheck, hashBest.GetHex().c_str());
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include "main.h"
 #include "txdb.h"
 #include "init.h"
+#include "ui_interface.h"
 
 #define CACHE_SIZE MIN_HISTORY
 
@@ -25,6 +26,67 @@ static map<uint256,list<CBlockCrud>::iterator> mapUndo;
 static list<CBlock> listBlock;
 static map<uint256,list<CBlock>::iterator> mapBlock;
 
+//Group commit state. Block and undo files written since the last sync and the
+//index writes waiting for them, protected by csPending. updateSyncing holds what a
+//running Sync() took until it is in the database, reads look at both.
+static CWaitableCriticalSection csPending;
+static CConditionVariable cvPending;
+static set<int> setDirtyBlockFiles;
+static set<int> setDirtyUndoFiles;
+static CBlockTreeUpdate updatePending;
+static CBlockTreeUpdate updateSyncing;
+static bool fFlushThreadRunning = false;
+
+//Only one sync at a time, so a batch is never written ahead of an earlier one
+static CCriticalSection cs_sync;
+
+//Read-ahead state. Blocks (fUndo false) and undo data queued for the prefetch threads,
+//keyed by block hash. setPrefetching holds both queued and in flight requests.
+//Blocks queued with fCheck also have their signatures checked once read.
+class CPrefetchRequest {
+public:
+    CPrefetchRequest(const CDiskBlockPos &p, const uint256 &h, bool f, bool fCheckIn=false){
+	pos = p; hash = h; fUndo = f; fCheck = fCheckIn;
+    }
+    CDiskBlockPos pos;
+    uint256 hash;
+    bool fUndo;
+    bool fCheck;
+};
+
+static CWaitableCriticalSection csPrefetch;
+static CConditionVariable cvPrefetchQueued;
+static CConditionVariable cvPrefetchDone;
+static deque<CPrefetchRequest> queuePrefetch;
+static set<pair<uint256,bool> > setPrefetching;
+static int nPrefetchThreads = 0;
+
+//Don't read something a prefetch thread is already reading. Requests nobody picked up yet
+//are taken back, reading them here is quicker than waiting for the queue to get there.
+static void WaitForPrefetch(const uint256 &hash, bool fUndo){
+    boost::unique_lock<boost::mutex> lock(csPrefetch);
+    pair<uint256,bool> key = make_pair(hash, fUndo);
+    if(!setPrefetching.count(key))
+	return;
+
+    for(deque<CPrefetchRequest>::iterator it = queuePrefetch.begin(); it != queuePrefetch.end(); it++){
+	if(it->hash == hash && it->fUndo == fUndo){
+	    queuePrefetch.erase(it);
+	    setPrefetching.erase(key);
+	    return;
+	}
+    }
+    while(setPrefetching.count(key))
+	cvPrefetchDone.wait(lock);
+}
+
+static void CommitDiskFile(FILE *file){
+    if(file){
+	FileCommit(file);
+	fclose(file);
+    }
+}
+
 bool CBlockCache::WriteUndoToDisk(CDiskBlockPos &pos, const uint256 &hashBlock, CBlockUndo &undo){
     LOCK(cs_block);
 
@@ -33,8 +95,12 @@ bool CBlockCache::WriteUndoToDisk(CDiskBlockPos &pos, const uint256 &hashBlock,
     if (!fileout)
         return error("CBlockUndo::WriteToDisk : OpenUndoFile failed");
 
+    // Encode once, the same bytes are written and checksummed
+    CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+    ssUndo << undo;
+
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(undo);
+    unsigned int nSize = ssUndo.size();
     fileout << FLATDATA(Params().MessageStart()) << nSize;
 
     // Write undo data
@@ -43,18 +109,20 @@ bool CBlockCache::WriteUndoToDisk(CDiskBlockPos &pos, const uint256 &hashBlock,
     if (fileOutPos < 0)
         return error("CBlockUndo::WriteToDisk : ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << undo;
+    fileout.write(&ssUndo[0], nSize);
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
-    hasher << undo;
+    hasher.write(&ssUndo[0], nSize);
     fileout << hasher.GetHash();
 
-    // Flush stdio buffers and commit to disk before returning
+    // Flush stdio buffers, the data is committed to disk by the next Sync()
     fflush(fileout);
-    if (!IsInitialBlockDownload())
-        FileCommit(fileout);
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	setDirtyUndoFiles.insert(pos.nFile);
+    }
 
     //Update the cached copy if present
     map<uint256,list<CBlockCrud>::iterator>::iterator it = mapUndo.find(hashBlock);
@@ -66,36 +134,46 @@ bool CBlockCache::WriteUndoToDisk(CDiskBlockPos &pos, const uint256 &hashBlock,
     return true;
 }
 
-bool CBlockCache::ReadUndoFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock, CBlockUndo &undo){
-    LOCK(cs_block);
-
+//Requires cs_block
+static bool FindCachedUndo(const uint256 &hashBlock, CBlockUndo &undo){
     map<uint256,list<CBlockCrud>::iterator>::iterator it = mapUndo.find(hashBlock);
-    if(it != mapUndo.end()){
-	CBlockCrud crud = *(it->second);
-	undo = crud.undo;
-	//Move list element to front
-	listUndo.erase(it->second);
-	listUndo.push_front(crud);
-	mapUndo[hashBlock] = listUndo.begin();
-
-	return true;
-    }
-
-    if(!ReadUndoFromDiskI(pos,hashBlock,undo))
+    if(it == mapUndo.end())
 	return false;
+    undo = it->second->undo;
+    //Move list element to front
+    listUndo.splice(listUndo.begin(), listUndo, it->second);
+    return true;
+}
+
+//Requires cs_block
+static void CacheUndo(const uint256 &hashBlock, const CBlockUndo &undo){
+    if(mapUndo.count(hashBlock))
+	return;
 
     //Gotta trim it up. This is rough
     if(listUndo.size() >= CACHE_SIZE){
-	CBlockCrud back = listUndo.back();
-	uint256 hashBack = back.hash;
+	mapUndo.erase(listUndo.back().hash);
 	listUndo.pop_back();
-	mapUndo.erase(hashBack);
     }
 
     //Insert into front
     listUndo.push_front(CBlockCrud(undo,hashBlock));
     mapUndo[hashBlock] = listUndo.begin();
+}
+
+bool CBlockCache::ReadUndoFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock, CBlockUndo &undo){
+    WaitForPrefetch(hashBlock, true);
+    {
+	LOCK(cs_block);
+	if(FindCachedUndo(hashBlock, undo))
+	    return true;
+    }
 
+    if(!ReadUndoFromDiskI(pos,hashBlock,undo))
+	return false;
+
+    LOCK(cs_block);
+    CacheUndo(hashBlock, undo);
     return true;
 }
 
@@ -127,8 +205,6 @@ bool CBlockCache::ReadUndoFromDiskI(const CDiskBlockPos &pos, const uint256 &has
 
 bool CBlockCache::ReadBlockFromDiskI(CBlock& block, const CDiskBlockPos& pos)
 {
-    LOCK(cs_block);
-
     block.SetNull();
 
     // Open history file to read
@@ -147,8 +223,6 @@ bool CBlockCache::ReadBlockFromDiskI(CBlock& block, const CDiskBlockPos& pos)
 }
 
 bool CBlockCache::ReadTxFromDisk(CTransaction& tx, const CDiskTxPos &disktx){
-    LOCK(cs_block);
-
     //Need blockindex to be able to find tx ?
     CBlockIndex *pindex= mapBlockIndex[disktx.hashBlock];
     CBlock block;
@@ -158,47 +232,53 @@ bool CBlockCache::ReadTxFromDisk(CTransaction& tx, const CDiskTxPos &disktx){
     return true;
 }
 
+//Requires cs_block
+static bool FindCachedBlock(const uint256 &hash, CBlock &block){
+    map<uint256,list<CBlock>::iterator>::iterator it = mapBlock.find(hash);
+    if(it == mapBlock.end())
+	return false;
+    block = *(it->second);
+    //Move list element to front
+    listBlock.splice(listBlock.begin(), listBlock, it->second);
+    return true;
+}
+
+//Requires cs_block
+static void CacheBlock(const uint256 &hash, const CBlock &block){
+    if(mapBlock.count(hash))
+	return;
+
+    //Gotta trim it up. This is rough
+    if(listBlock.size() >= CACHE_SIZE){
+	mapBlock.erase(listBlock.back().GetHash());
+	listBlock.pop_back();
+    }
+
+    //Insert into front
+    listBlock.push_front(block);
+    mapBlock[hash] = listBlock.begin();
+}
 
 bool CBlockCache::ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    LOCK(cs_block);
-    static int cnt=0;
-
-    map<uint256,list<CBlock>::iterator>::iterator it = mapBlock.find(pindex->GetBlockHash());
-    if(it != mapBlock.end()){
-	block = *(it->second);
-	//Move list element to front
-	listBlock.erase(it->second);
-	listBlock.push_front(block);
-	mapBlock[pindex->GetBlockHash()] = listBlock.begin();
-	//printf("Hit\n");
-	//if(cnt++ == 200)
-	//    assert(0);
-	return true;
+    uint256 hashBlock = pindex->GetBlockHash();
+    WaitForPrefetch(hashBlock, false);
+    {
+	LOCK(cs_block);
+	if(FindCachedBlock(hashBlock, block))
+	    return true;
     }
 
     if (!ReadBlockFromDiskI(block, pindex->GetBlockPos())){
-	LogPrintf("ReadBlockFromDisk: Could not find block %s\n", pindex->GetBlockHash().GetHex().c_str());
-	//assert(0);
+	LogPrintf("ReadBlockFromDisk: Could not find block %s\n", hashBlock.GetHex().c_str());
         return false;
     }
     uint256 hash = block.GetHash();
-    if (hash != pindex->GetBlockHash())
+    if (hash != hashBlock)
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
 
-    //Gotta trim it up. This is rough
-    if(listBlock.size() >= CACHE_SIZE){
-	CBlock back = listBlock.back();
-	uint256 hashBack = back.GetHash();
-	listBlock.pop_back();
-	mapBlock.erase(hashBack);
-	//printf("Evict\n");
-    }
-
-    //Insert into front
-    listBlock.push_front(block);
-    mapBlock[hash] = listBlock.begin();
-    //printf("Add to cache\n");
+    LOCK(cs_block);
+    CacheBlock(hash, block);
     return true;
 }
 
@@ -221,10 +301,12 @@ bool CBlockCache::WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     pos.nPos = (unsigned int)fileOutPos;
     fileout << block;
 
-    // Flush stdio buffers and commit to disk before returning
+    // Flush stdio buffers, the data is committed to disk by the next Sync()
     fflush(fileout);
-    if (!IsInitialBlockDownload())
-        FileCommit(fileout);
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	setDirtyBlockFiles.insert(pos.nFile);
+    }
 
     //Update the cached copy if present
     map<uint256,list<CBlock>::iterator>::iterator it = mapBlock.find(block.GetHash());
@@ -235,4 +317,269 @@ bool CBlockCache::WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
+bool CBlockCache::WriteBlockIndex(CBlockIndex* pindex){
+    CDiskBlockIndex blockindex(pindex);
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	//Later writes of the same block replace the earlier ones
+	updatePending.mapBlocks[blockindex.GetBlockHash()] = blockindex;
+	if(fFlushThreadRunning){
+	    if(updatePending.mapBlocks.size() >= BLOCK_FLUSH_BATCH)
+		cvPending.notify_one();
+	    return true;
+	}
+    }
+    //Nobody else is going to write it
+    return Sync();
+}
+
+bool CBlockCache::WriteTxIndex(const vector<pair<uint256, CDiskTxPos> > &vPos){
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	for(vector<pair<uint256, CDiskTxPos> >::const_iterator it = vPos.begin(); it != vPos.end(); it++)
+	    updatePending.mapTxs[it->first] = it->second;
+	if(fFlushThreadRunning)
+	    return true;
+    }
+    return Sync();
+}
+
+bool CBlockCache::EraseTxIndex(const vector<uint256> &vTxid){
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	//Queued as well, so an erase can't be overtaken by an earlier write still waiting
+	BOOST_FOREACH(const uint256 &txid, vTxid)
+	    updatePending.mapTxs[txid] = CDiskTxPos();
+	if(fFlushThreadRunning)
+	    return true;
+    }
+    return Sync();
+}
+
+//Requires csPending
+template<typename K, typename V>
+static bool FindQueued(const map<K,V> CBlockTreeUpdate::*pmap, const K &key, V &value){
+    typename map<K,V>::const_iterator it = (updatePending.*pmap).find(key);
+    if(it == (updatePending.*pmap).end()){
+	it = (updateSyncing.*pmap).find(key);
+	if(it == (updateSyncing.*pmap).end())
+	    return false;
+    }
+    value = it->second;
+    return true;
+}
+
+bool CBlockCache::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos){
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	if(FindQueued(&CBlockTreeUpdate::mapTxs, txid, pos))
+	    return !pos.IsNull();
+    }
+    //Anything written after this point is newer than what was asked for
+    return pblocktree->ReadTxIndex(txid, pos);
+}
+
+bool CBlockCache::WriteBlockFileInfo(int nFile, const CBlockFileInfo &info){
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	updatePending.mapFiles[nFile] = info;
+	if(fFlushThreadRunning)
+	    return true;
+    }
+    return Sync();
+}
+
+bool CBlockCache::ReadBlockFileInfo(int nFile, CBlockFileInfo &info){
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	if(FindQueued(&CBlockTreeUpdate::mapFiles, nFile, info))
+	    return true;
+    }
+    return pblocktree->ReadBlockFileInfo(nFile, info);
+}
+
+bool CBlockCache::WriteLastBlockFile(int nFile){
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	updatePending.nLastFile = nFile;
+	if(fFlushThreadRunning)
+	    return true;
+    }
+    return Sync();
+}
+
+bool CBlockCache::WriteSyncPoint(const uint256 &hash){
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	updatePending.hashSyncPoint = hash;
+	if(fFlushThreadRunning)
+	    return true;
+    }
+    return Sync();
+}
+
+bool CBlockCache::Sync(){
+    LOCK(cs_sync);
+
+    set<int> setBlockFiles, setUndoFiles;
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	setBlockFiles.swap(setDirtyBlockFiles);
+	setUndoFiles.swap(setDirtyUndoFiles);
+	if(updateSyncing.IsEmpty()){
+	    std::swap(updateSyncing, updatePending);
+	}else{
+	    //A failed write left its entries behind, the newer ones go over them
+	    updateSyncing.Merge(updatePending);
+	    updatePending = CBlockTreeUpdate();
+	}
+    }
 
+    //Everything the taken index writes point at was written before they were queued,
+    //so once these files are committed the writes are safe to make
+    BOOST_FOREACH(int nFile, setBlockFiles)
+	CommitDiskFile(OpenBlockFile(CDiskBlockPos(nFile, 0), true));
+    BOOST_FOREACH(int nFile, setUndoFiles)
+	CommitDiskFile(OpenUndoFile(CDiskBlockPos(nFile, 0), true));
+
+    if(updateSyncing.IsEmpty())
+	return true;
+
+    //Writes queued meanwhile are newer and stay in updatePending
+    bool fOk = pblocktree->WriteUpdate(updateSyncing);
+    LogPrint("bench", "CBlockCache::Sync() : %u block files, %u undo files, %u index entries, %u txindex entries\n",
+	setBlockFiles.size(), setUndoFiles.size(), updateSyncing.mapBlocks.size(), updateSyncing.mapTxs.size());
+    if(!fOk)
+	return error("CBlockCache::Sync() : failed to write block index");
+
+    boost::unique_lock<boost::mutex> lock(csPending);
+    updateSyncing = CBlockTreeUpdate();
+    return true;
+}
+
+bool CBlockCache::IsFlushThreadRunning(){
+    boost::unique_lock<boost::mutex> lock(csPending);
+    return fFlushThreadRunning;
+}
+
+void ThreadFlushBlockFiles(){
+    RenameThread("feedbackcoin-blkflush");
+    int64_t nInterval = std::max(GetArg("-blockflushinterval", DEFAULT_BLOCK_FLUSH_INTERVAL), (int64_t)1);
+
+    {
+	boost::unique_lock<boost::mutex> lock(csPending);
+	fFlushThreadRunning = true;
+    }
+
+    try {
+	while(true){
+	    {
+		boost::unique_lock<boost::mutex> lock(csPending);
+		if(updatePending.mapBlocks.size() < BLOCK_FLUSH_BATCH)
+		    cvPending.timed_wait(lock, boost::posix_time::milliseconds(nInterval));
+	    }
+	    boost::this_thread::interruption_point();
+	    if(!blockCache.Sync())
+		AbortNode(_("Failed to sync block files"));
+	}
+    }
+    catch (boost::thread_interrupted){
+	//Whatever is still queued is written by Shutdown()
+	boost::unique_lock<boost::mutex> lock(csPending);
+	fFlushThreadRunning = false;
+	throw;
+    }
+}
+
+void CBlockCache::Prefetch(const CBlockIndex* pindex, bool fUndo, bool fCheck){
+    if(!(pindex->nStatus & (fUndo ? BLOCK_HAVE_UNDO : BLOCK_HAVE_DATA)))
+	return;
+    fCheck &= !fUndo;
+
+    //A cached block still has its signatures to check
+    uint256 hash = pindex->GetBlockHash();
+    if(!fCheck){
+	LOCK(cs_block);
+	if(fUndo ? mapUndo.count(hash) : mapBlock.count(hash))
+	    return;
+    }
+
+    boost::unique_lock<boost::mutex> lock(csPrefetch);
+    if(!nPrefetchThreads || !setPrefetching.insert(make_pair(hash, fUndo)).second)
+	return;
+    queuePrefetch.push_back(CPrefetchRequest(fUndo ? pindex->GetUndoPos() : pindex->GetBlockPos(), hash, fUndo, fCheck));
+    cvPrefetchQueued.notify_one();
+}
+
+int CBlockCache::PrefetchWindow(){
+    {
+	boost::unique_lock<boost::mutex> lock(csPrefetch);
+	if(!nPrefetchThreads)
+	    return 0;
+    }
+    //Anything further ahead would be pushed out of the cache before it gets used
+    return std::min((int)GetArg("-prefetchblocks", DEFAULT_PREFETCH_BLOCKS), (int)CACHE_SIZE / 2);
+}
+
+void ThreadPrefetchBlocks(){
+    RenameThread("feedbackcoin-prefetch");
+
+    {
+	boost::unique_lock<boost::mutex> lock(csPrefetch);
+	nPrefetchThreads++;
+    }
+
+    try {
+	while(true){
+	    CPrefetchRequest req(CDiskBlockPos(), 0, false);
+	    {
+		boost::unique_lock<boost::mutex> lock(csPrefetch);
+		while(queuePrefetch.empty())
+		    cvPrefetchQueued.wait(lock);
+		req = queuePrefetch.front();
+		queuePrefetch.pop_front();
+	    }
+
+	    //Read and deserialize outside of any lock, only the cache insert takes cs_block
+	    CBlock block;
+	    bool fHaveBlock = false;
+	    if(req.fUndo){
+		CBlockUndo undo;
+		if(blockCache.ReadUndoFromDiskI(req.pos, req.hash, undo)){
+		    LOCK(cs_block);
+		    CacheUndo(req.hash, undo);
+		}
+	    }else{
+		{
+		    LOCK(cs_block);
+		    fHaveBlock = FindCachedBlock(req.hash, block);
+		}
+		if(!fHaveBlock && blockCache.ReadBlockFromDiskI(block, req.pos) && block.GetHash() == req.hash){
+		    LOCK(cs_block);
+		    CacheBlock(req.hash, block);
+		    fHaveBlock = true;
+		}
+	    }
+
+	    {
+		boost::unique_lock<boost::mutex> lock(csPrefetch);
+		setPrefetching.erase(make_pair(req.hash, req.fUndo));
+		cvPrefetchDone.notify_all();
+	    }
+
+	    //The block is available to ConnectBlock already, this only warms the signature cache
+	    //so its script checks are hits. Nothing is checked while loading.
+	    if(fHaveBlock && req.fCheck && !fLoading)
+		PrecheckBlockSignatures(block);
+	}
+    }
+    catch (boost::thread_interrupted){
+	boost::unique_lock<boost::mutex> lock(csPrefetch);
+	if(--nPrefetchThreads == 0){
+	    queuePrefetch.clear();
+	    setPrefetching.clear();
+	    cvPrefetchDone.notify_all();
+	}
+	throw;
+    }
+}
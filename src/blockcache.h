@@ -8,6 +8,17 @@
 class CDiskBlockPos;
 class CDiskTxPos;
 class CBlockUndo;
+class CBlockIndex;
+class CBlockFileInfo;
+
+/** Default -blockflushinterval (milliseconds) */
+static const int64_t DEFAULT_BLOCK_FLUSH_INTERVAL = 1000;
+/** Number of queued block index entries that triggers a sync before the interval is up */
+static const unsigned int BLOCK_FLUSH_BATCH = 500;
+/** Default -prefetchblocks, how far chain activation reads ahead */
+static const int DEFAULT_PREFETCH_BLOCKS = 16;
+/** Default -prefetchthreads */
+static const int DEFAULT_PREFETCH_THREADS = 2;
 
 class CBlockCache {
 public:
@@ -20,6 +31,33 @@ public:
     bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
     bool ReadBlockFromDiskI(CBlock& block, const CDiskBlockPos& pos);
 
+    //Block and undo writes only flush stdio buffers, the fsync is left to Sync().
+    //Index entries are held back until the data they point at has been synced.
+    //The txindex, block file info and sync point go through the same queue, their reads
+    //see queued writes first.
+    bool WriteBlockIndex(CBlockIndex* pindex);
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vPos);
+    bool EraseTxIndex(const std::vector<uint256> &vTxid);
+    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
+    bool WriteBlockFileInfo(int nFile, const CBlockFileInfo &info);
+    bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
+    bool WriteLastBlockFile(int nFile);
+    bool WriteSyncPoint(const uint256 &hash);
+    bool Sync();
+    //Whether ThreadFlushBlockFiles is there to do the syncing, otherwise every write syncs
+    bool IsFlushThreadRunning();
+
+    //Queue a block (or its undo data) to be read into the cache by the prefetch threads.
+    //Callers that know which blocks they are about to read stay PrefetchWindow() ahead.
+    //With fCheck the block's signatures are also verified into the signature cache,
+    //for blocks about to go through ConnectBlock.
+    void Prefetch(const CBlockIndex* pindex, bool fUndo=false, bool fCheck=false);
+    int PrefetchWindow();
 };
 
+/** Run the group commit writer for block, undo and index writes */
+void ThreadFlushBlockFiles();
+/** Run a block and undo read-ahead thread */
+void ThreadPrefetchBlocks();
+
 #endif //BLOCKCACHE_H
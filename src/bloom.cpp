@@ -7,6 +7,7 @@
 
 #include "core.h"
 #include "script.h"
+#include "util.h"
 
 #include <math.h>
 #include <stdlib.h>
@@ -139,3 +140,75 @@ void CBloomFilter::UpdateEmptyFull()
     isFull = full;
     isEmpty = empty;
 }
+
+// 64 bit finalizer of MurmurHash3
+static inline uint64_t BloomMix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Every block holds 512 bits, 16 bits per element gives 32 elements per block
+// and with 8 bits per key a false positive rate of about 0.1%
+static const unsigned int BLOCKED_BLOOM_PER_BLOCK = 32;
+static const unsigned int BLOCKED_BLOOM_BITS = 8;
+
+CBlockedBloomFilter::CBlockedBloomFilter(unsigned int nCapacity) : nSalt(GetRandHash().GetLow64())
+{
+    reset(nCapacity);
+}
+
+void CBlockedBloomFilter::reset(unsigned int nCapacity)
+{
+    uint64_t nBlocks = 1;
+    while (nBlocks * BLOCKED_BLOOM_PER_BLOCK < nCapacity)
+        nBlocks <<= 1;
+    vData.assign(nBlocks * 8, 0);
+    nBlockMask = nBlocks - 1;
+    nElements = 0;
+}
+
+// The block is picked by the low bits of h1, the bit positions inside it
+// are 9 bit slices of h2 and the top of h1
+static inline unsigned int BlockedBloomBit(uint64_t h1, uint64_t h2, unsigned int i)
+{
+    return i < 7 ? (h2 >> (9 * i)) & 511 : h1 >> 55;
+}
+
+void CBlockedBloomFilter::insert(const uint256& hash)
+{
+    uint64_t a, b;
+    memcpy(&a, hash.begin(), 8);
+    memcpy(&b, hash.begin() + 8, 8);
+    uint64_t h1 = BloomMix64(a ^ nSalt), h2 = BloomMix64(b ^ h1);
+    uint64_t *pblock = &vData[(h1 & nBlockMask) * 8];
+    for (unsigned int i = 0; i < BLOCKED_BLOOM_BITS; i++) {
+        unsigned int nBit = BlockedBloomBit(h1, h2, i);
+        pblock[nBit >> 6] |= (uint64_t)1 << (nBit & 63);
+    }
+    nElements++;
+}
+
+bool CBlockedBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t a, b;
+    memcpy(&a, hash.begin(), 8);
+    memcpy(&b, hash.begin() + 8, 8);
+    uint64_t h1 = BloomMix64(a ^ nSalt), h2 = BloomMix64(b ^ h1);
+    const uint64_t *pblock = &vData[(h1 & nBlockMask) * 8];
+    for (unsigned int i = 0; i < BLOCKED_BLOOM_BITS; i++) {
+        unsigned int nBit = BlockedBloomBit(h1, h2, i);
+        if (!(pblock[nBit >> 6] & ((uint64_t)1 << (nBit & 63))))
+            return false;
+    }
+    return true;
+}
+
+unsigned int CBlockedBloomFilter::capacity() const
+{
+    return vData.size() / 8 * BLOCKED_BLOOM_PER_BLOCK;
+}
@@ -8,6 +8,7 @@
 
 #include "serialize.h"
 
+#include <stdint.h>
 #include <vector>
 
 class CTransaction;
@@ -89,4 +90,34 @@ public:
     void UpdateEmptyFull();
 };
 
+/**
+ * Blocked bloom filter over 256 bit hashes, used locally to skip database
+ * lookups for keys which are definitely not there.
+ *
+ * All bits of a key are set in one 64 byte block, so a lookup touches a
+ * single cache line. Keys are expected to be hashes already and are only
+ * mixed with a random salt. Entries can't be removed: the owner rebuilds
+ * the filter once enough of them are stale.
+ */
+class CBlockedBloomFilter
+{
+private:
+    std::vector<uint64_t> vData;
+    uint64_t nBlockMask;
+    uint64_t nSalt;
+    unsigned int nElements;
+
+public:
+    CBlockedBloomFilter(unsigned int nCapacity = 0);
+
+    // Empty the filter and size it for nCapacity elements (~0.1% fp rate)
+    void reset(unsigned int nCapacity);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    unsigned int size() const { return nElements; }
+    unsigned int capacity() const;
+};
+
 #endif /* BITCOIN_BLOOM_H */
@@ -74,7 +74,7 @@ public:
         //     CTxIn(COutPoint(000000, -1), coinbase 04ffff001d0104455468652054696d65732030332f4a616e2f32303039204368616e63656c6c6f72206f6e206272696e6b206f66207365636f6e64206261696c6f757420666f722062616e6b73)
         //     CTxOut(nValue=50.00000000, scriptPubKey=0x5F1DF16B2B704C8A578D0B)
         //   vMerkleTree: 4a5e1e
-        CTransaction txNew;
+        CMutableTransaction txNew;
         txNew.vin.resize(0);
         txNew.vout.resize(1);
         txNew.vout[0].nValue = MAX_MONEY; //All coins created in genesis
@@ -184,11 +184,13 @@ public:
 	string url = "";
 	string token = "";
 	string tvalue = "";
-	genesis.vtx[0].txType = txType;
-	genesis.vtx[0].feedback = vector<char>(feedback.begin(),feedback.end());
-	genesis.vtx[0].url = vector<char>(url.begin(),url.end());
-	genesis.vtx[0].token = vector<char>(token.begin(),token.end());
-	genesis.vtx[0].tvalue = vector<char>(tvalue.begin(),tvalue.end());
+	CMutableTransaction txNew(genesis.vtx[0]);
+	txNew.txType = txType;
+	txNew.feedback = vector<char>(feedback.begin(),feedback.end());
+	txNew.url = vector<char>(url.begin(),url.end());
+	txNew.token = vector<char>(token.begin(),token.end());
+	txNew.tvalue = vector<char>(tvalue.begin(),tvalue.end());
+	genesis.vtx[0] = txNew;
 	
 	genesis.hashMerkleRoot = genesis.BuildMerkleTree();
         hashGenesisBlock = genesis.GetHash();
@@ -60,14 +60,38 @@ void CTxOut::print() const
     LogPrintf("%s\n", ToString());
 }
 
-uint256 CTransaction::GetHash() const
+CMutableTransaction::CMutableTransaction() : nVersion(CTransaction::CURRENT_VERSION), txType(0), nLockHeight(0), nLimitValue(0), fSetLimit(false) {}
+CMutableTransaction::CMutableTransaction(const CTransaction& tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), feedback(tx.feedback), url(tx.url), token(tx.token), tvalue(tx.tvalue), txType(tx.txType), nLockHeight(tx.nLockHeight), nLimitValue(tx.nLimitValue), fSetLimit(tx.fSetLimit) {}
+
+void CTransaction::UpdateHash() const
 {
-    return SerializeHash(*this);
+    *const_cast<uint256*>(&hash) = SerializeHash(*this);
+    *const_cast<uint256*>(&txid) = SignatureHash(*this);
 }
 
-uint256 CTransaction::GetTxID() const
-{
-    return SignatureHash(*this);
+CTransaction::CTransaction() : hash(0), txid(0), nVersion(CTransaction::CURRENT_VERSION), vin(), vout(), feedback(), url(), token(), tvalue(), txType(0), nLockHeight(0), nLimitValue(0), fSetLimit(false) { }
+
+CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), feedback(tx.feedback), url(tx.url), token(tx.token), tvalue(tx.tvalue), txType(tx.txType), nLockHeight(tx.nLockHeight), nLimitValue(tx.nLimitValue), fSetLimit(tx.fSetLimit) {
+    UpdateHash();
+}
+
+CTransaction::CTransaction(const CTransaction &tx) : hash(tx.hash), txid(tx.txid), nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), feedback(tx.feedback), url(tx.url), token(tx.token), tvalue(tx.tvalue), txType(tx.txType), nLockHeight(tx.nLockHeight), nLimitValue(tx.nLimitValue), fSetLimit(tx.fSetLimit) { }
+
+CTransaction& CTransaction::operator=(const CTransaction &tx) {
+    *const_cast<int*>(&nVersion) = tx.nVersion;
+    *const_cast<std::vector<CTxIn>*>(&vin) = tx.vin;
+    *const_cast<std::vector<CTxOut>*>(&vout) = tx.vout;
+    *const_cast<std::vector<char>*>(&feedback) = tx.feedback;
+    *const_cast<std::vector<char>*>(&url) = tx.url;
+    *const_cast<std::vector<char>*>(&token) = tx.token;
+    *const_cast<std::vector<char>*>(&tvalue) = tx.tvalue;
+    *const_cast<uint64_t*>(&txType) = tx.txType;
+    *const_cast<uint64_t*>(&nLockHeight) = tx.nLockHeight;
+    *const_cast<uint64_t*>(&nLimitValue) = tx.nLimitValue;
+    *const_cast<bool*>(&fSetLimit) = tx.fSetLimit;
+    *const_cast<uint256*>(&hash) = tx.hash;
+    *const_cast<uint256*>(&txid) = tx.txid;
+    return *this;
 }
 
 bool CTransaction::IsNewerThan(const CTransaction& old) const
@@ -211,6 +235,38 @@ uint256 CBlockHeader::GetHash() const
     return Hash7(BEGIN(hashPrevBlock), END(nVersion));
 }
 
+void CBlockHeader::GetHashMidstate(CHash7Midstate& midstate) const
+{
+    midstate.Init(BEGIN(hashPrevBlock), BEGIN(nNonce) - BEGIN(hashPrevBlock));
+}
+
+uint256 CBlockHeader::GetHash(const CHash7Midstate& midstate) const
+{
+    return midstate.Hash(BEGIN(nNonce), END(nVersion) - BEGIN(nNonce));
+}
+
+void CBlockHeader::GetNonceHashes(const CHash7Midstate& midstate, uint256 hashes[8]) const
+{
+    unsigned char tails[8][sizeof(nNonce) + sizeof(nVersion)];
+    const unsigned char* ptails[8];
+    for (int i = 0; i < 8; i++) {
+        uint64_t nNonceLane = nNonce + i;
+        memcpy(tails[i], &nNonceLane, sizeof(nNonce));
+        memcpy(tails[i] + sizeof(nNonce), &nVersion, sizeof(nVersion));
+        ptails[i] = tails[i];
+    }
+    Hash7x8(midstate, ptails, END(nVersion) - BEGIN(nNonce), hashes);
+}
+
+void CBlockHeader::GetHashes(const CBlockHeader* const pheaders[8], uint256 hashes[8])
+{
+    static const CHash7Midstate midstate;
+    const unsigned char* ptails[8];
+    for (int i = 0; i < 8; i++)
+        ptails[i] = (const unsigned char*)BEGIN(pheaders[i]->hashPrevBlock);
+    Hash7x8(midstate, ptails, END(pheaders[0]->nVersion) - BEGIN(pheaders[0]->hashPrevBlock), hashes);
+}
+
 uint256 CBlock::BuildMerkleTree() const
 {
     vMerkleTree.clear();
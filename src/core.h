@@ -16,6 +16,7 @@
 using namespace std;
 
 class CTransaction;
+class CHash7Midstate;
 
 /** No amount larger than this (in satoshi) is valid */
 extern uint64_t MIN_HISTORY;
@@ -160,86 +161,130 @@ public:
 };
 
 
+struct CMutableTransaction;
+
+/** Wrapper that serializes the inputs or outputs of a transaction with nLimit
+ * added to the value of the first one, the on-wire form of a set withdrawal
+ * limit. The value is a fixed width field so the size does not change, and
+ * reading leaves the vector as it was sent for CTransaction to decode.
+ */
+template<typename T>
+class CTxLimitEncoder
+{
+protected:
+    std::vector<T> &v;
+    uint64_t nLimit;
+public:
+    CTxLimitEncoder(std::vector<T> &vIn, uint64_t nLimitIn) : v(vIn), nLimit(nLimitIn) { }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return ::GetSerializeSize(v, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        if (nLimit == 0 || v.empty()) {
+            ::Serialize(s, v, nType, nVersion);
+            return;
+        }
+        WriteCompactSize(s, v.size());
+        T first = v[0];
+        first.nValue += nLimit;
+        ::Serialize(s, first, nType, nVersion);
+        for (typename std::vector<T>::const_iterator it = v.begin() + 1; it != v.end(); ++it)
+            ::Serialize(s, *it, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        ::Unserialize(s, v, nType, nVersion);
+    }
+};
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
+ *
+ * Transactions are immutable once built, which lets them carry their hash
+ * and txid. Build or change one through CMutableTransaction.
  */
 class CTransaction
 {
+private:
+    /** Memory only. */
+    const uint256 hash;
+    const uint256 txid;
+    void UpdateHash() const;
+
 public:
     static int64_t nMinTxFee;
     static int64_t nMinRelayTxFee;
     static const int CURRENT_VERSION=1;
-    int nVersion;
-    mutable std::vector<CTxIn> vin;
-    mutable std::vector<CTxOut> vout;
-	std::vector<char> feedback;
-    std::vector<char> url;
-	std::vector<char> token;
-	std::vector<char> tvalue;
-	uint64_t txType;
-    uint64_t nLockHeight;
-    mutable uint64_t nLimitValue;
-    mutable bool fSetLimit;
-
-    CTransaction()
-    {
-        SetNull();
-    }
+    const int nVersion;
+    const std::vector<CTxIn> vin;
+    const std::vector<CTxOut> vout;
+    const std::vector<char> feedback;
+    const std::vector<char> url;
+    const std::vector<char> token;
+    const std::vector<char> tvalue;
+    const uint64_t txType;
+    const uint64_t nLockHeight;
+    const uint64_t nLimitValue;
+    const bool fSetLimit;
+
+    /** Construct a CTransaction that qualifies as IsNull() */
+    CTransaction();
+
+    /** Convert a CMutableTransaction into a CTransaction. */
+    CTransaction(const CMutableTransaction &tx);
+
+    CTransaction(const CTransaction& tx);
+    CTransaction& operator=(const CTransaction& tx);
 
     IMPLEMENT_SERIALIZE
     (
-	//Do some weird serialization magic here to encode/decode the set withdrawal limit transaction
-        std::vector<CTxIn> vint=vin;
-        std::vector<CTxOut> voutt=vout;
-
-	if (!fRead) {
-	    //Going to write
-	    if(fSetLimit){
-		vint[0].nValue+=nLimitValue;
-	    	voutt[0].nValue+=nLimitValue;
-	    }
-	}
-        READWRITE(this->nVersion);
+        READWRITE(*const_cast<int*>(&this->nVersion));
         nVersion = this->nVersion;
-        READWRITE(vint);
-        READWRITE(voutt);
-	READWRITE(feedback);
-	READWRITE(url);
-	READWRITE(token);
-	READWRITE(tvalue);
-	READWRITE(txType);
-        READWRITE(nLockHeight);
+	//A set withdrawal limit transaction is encoded by adding the limit to the value
+	//of its single input and output, the vectors themselves are never copied
+	uint64_t nLimit = fSetLimit ? nLimitValue : 0;
+        READWRITE(REF(CTxLimitEncoder<CTxIn>(*const_cast<std::vector<CTxIn>*>(&vin), nLimit)));
+        READWRITE(REF(CTxLimitEncoder<CTxOut>(*const_cast<std::vector<CTxOut>*>(&vout), nLimit)));
+	READWRITE(*const_cast<std::vector<char>*>(&feedback));
+	READWRITE(*const_cast<std::vector<char>*>(&url));
+	READWRITE(*const_cast<std::vector<char>*>(&token));
+	READWRITE(*const_cast<std::vector<char>*>(&tvalue));
+	READWRITE(*const_cast<uint64_t*>(&txType));
+        READWRITE(*const_cast<uint64_t*>(&nLockHeight));
 
 	if(fRead){
-	    if(vint.size()==1 && voutt.size()==1 && vint[0].pubKey == voutt[0].pubKey && voutt[0].nValue < vint[0].nValue){
-		nLimitValue = voutt[0].nValue;
-		fSetLimit=true;
-		voutt[0].nValue=0;
-		vint[0].nValue-=nLimitValue;
+	    std::vector<CTxIn> &vinRead = *const_cast<std::vector<CTxIn>*>(&vin);
+	    std::vector<CTxOut> &voutRead = *const_cast<std::vector<CTxOut>*>(&vout);
+	    nLimit = 0;
+	    bool fLimit = false;
+	    if(vinRead.size()==1 && voutRead.size()==1 && vinRead[0].pubKey == voutRead[0].pubKey && voutRead[0].nValue < vinRead[0].nValue){
+		nLimit = voutRead[0].nValue;
+		fLimit=true;
+		voutRead[0].nValue=0;
+		vinRead[0].nValue-=nLimit;
 	    }
-	    vin = vint;
-	    vout = voutt;
+	    *const_cast<uint64_t*>(&nLimitValue) = nLimit;
+	    *const_cast<bool*>(&fSetLimit) = fLimit;
+	    UpdateHash();
 	}
     )
 
-    void SetNull()
-    {
-        nVersion = CTransaction::CURRENT_VERSION;
-        vin.clear();
-        vout.clear();
-        nLockHeight = 0;
-	nLimitValue = 0;
-	txType = 0;
-	fSetLimit=false;
-    }
-
     bool IsNull() const
     {
         return (vin.empty() && vout.empty());
     }
 
-    uint256 GetHash() const;
-    uint256 GetTxID() const;
+    const uint256& GetHash() const {
+        return hash;
+    }
+
+    const uint256& GetTxID() const {
+        return txid;
+    }
 
     bool IsNewerThan(const CTransaction& old) const;
 
@@ -277,6 +322,26 @@ public:
     void print() const;
 };
 
+/** A mutable version of CTransaction, to build transactions with. Converting
+ * it to a CTransaction computes the hashes, serialize that one. */
+struct CMutableTransaction
+{
+    int nVersion;
+    std::vector<CTxIn> vin;
+    std::vector<CTxOut> vout;
+    std::vector<char> feedback;
+    std::vector<char> url;
+    std::vector<char> token;
+    std::vector<char> tvalue;
+    uint64_t txType;
+    uint64_t nLockHeight;
+    uint64_t nLimitValue;
+    bool fSetLimit;
+
+    CMutableTransaction();
+    CMutableTransaction(const CTransaction& tx);
+};
+
 /** wrapper for CTxOut that provides a more compact serialization */
 class CTxOutCompressor
 {
@@ -358,6 +423,14 @@ public:
 
     uint256 GetHash() const;
 
+    // Absorb everything in front of nNonce, then hash with only the nonce-bearing tail
+    void GetHashMidstate(CHash7Midstate& midstate) const;
+    uint256 GetHash(const CHash7Midstate& midstate) const;
+    // Hashes with nNonce, nNonce + 1, ... nNonce + 7, computed side by side
+    void GetNonceHashes(const CHash7Midstate& midstate, uint256 hashes[8]) const;
+    // Hashes of eight headers computed side by side
+    static void GetHashes(const CBlockHeader* const pheaders[8], uint256 hashes[8]);
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -411,9 +484,9 @@ public:
         return block;
     }
 
-    uint64_t GetFees(){
+    uint64_t GetFees() const {
 	uint64_t ret=0;
-	BOOST_FOREACH(CTransaction tx, vtx){
+	BOOST_FOREACH(const CTransaction& tx, vtx){
 	   ret+=tx.GetFee();
 	}
 	return ret;
@@ -0,0 +1,753 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "bitcoin-config.h"
+#endif
+
+#include "ecrecover.h"
+
+#ifdef USE_NATIVE_ECRECOVER
+
+#include <stdint.h>
+#include <string.h>
+
+// Field elements and scalars are 256 bit integers stored as 4 64 bit limbs,
+// least significant first, and kept fully reduced. Points are kept in
+// Jacobian coordinates (x = X/Z^2, y = Y/Z^3) during multiplication.
+// Only public data (signatures, hashes and keys) goes through this code, so
+// nothing here tries to be constant time.
+
+namespace {
+
+typedef unsigned __int128 uint128_t;
+
+// p = 2^256 - 2^32 - 977
+static const uint64_t P[4] = { 0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL };
+// 2^256 - p
+static const uint64_t PC = 0x1000003D1ULL;
+
+// n, the order of the group
+static const uint64_t N[4] = { 0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL };
+// 2^256 - n
+static const uint64_t NC[3] = { 0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 1 };
+
+static const unsigned char G_X[32] = {
+    0x79,0xBE,0x66,0x7E,0xF9,0xDC,0xBB,0xAC,0x55,0xA0,0x62,0x95,0xCE,0x87,0x0B,0x07,
+    0x02,0x9B,0xFC,0xDB,0x2D,0xCE,0x28,0xD9,0x59,0xF2,0x81,0x5B,0x16,0xF8,0x17,0x98 };
+static const unsigned char G_Y[32] = {
+    0x48,0x3A,0xDA,0x77,0x26,0xA3,0xC4,0x65,0x5D,0xA4,0xFB,0xFC,0x0E,0x11,0x08,0xA8,
+    0xFD,0x17,0xB4,0x48,0xA6,0x85,0x54,0x19,0x9C,0x47,0xD0,0x8F,0xFB,0x10,0xD4,0xB8 };
+
+// wNAF window sizes. The generator table is computed once, the table for R per call.
+static const int WINDOW_G = 8;
+static const int WINDOW_R = 5;
+static const int TABLE_SIZE_G = 1 << (WINDOW_G - 2);
+static const int TABLE_SIZE_R = 1 << (WINDOW_R - 2);
+static const int WNAF_SIZE = 258;
+
+// Number of recoveries sharing one inversion in ECRecoverBatch
+static const size_t BATCH_CHUNK = 64;
+
+//
+// 256 bit integers
+//
+
+void u256_from_bytes(uint64_t *r, const unsigned char *b)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t v = 0;
+        for (int j = 0; j < 8; j++)
+            v = (v << 8) | b[8 * i + j];
+        r[3 - i] = v;
+    }
+}
+
+void u256_to_bytes(unsigned char *b, const uint64_t *a)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t v = a[3 - i];
+        for (int j = 7; j >= 0; j--) {
+            b[8 * i + j] = (unsigned char)v;
+            v >>= 8;
+        }
+    }
+}
+
+bool u256_is_zero(const uint64_t *a)
+{
+    return (a[0] | a[1] | a[2] | a[3]) == 0;
+}
+
+bool u256_geq(const uint64_t *a, const uint64_t *b)
+{
+    for (int i = 3; i >= 0; i--) {
+        if (a[i] != b[i])
+            return a[i] > b[i];
+    }
+    return true;
+}
+
+// r = a + b, returns the carry
+uint64_t u256_add(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    uint128_t c = 0;
+    for (int i = 0; i < 4; i++) {
+        c += (uint128_t)a[i] + b[i];
+        r[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    return (uint64_t)c;
+}
+
+// r = a - b, returns the borrow
+uint64_t u256_sub(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++) {
+        uint128_t d = (uint128_t)a[i] - b[i] - borrow;
+        r[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) ? 1 : 0;
+    }
+    return borrow;
+}
+
+// r = a + c, with c small enough for the result to fit in nLimbs
+void u256_add_word(uint64_t *r, int nLimbs, uint64_t c)
+{
+    for (int i = 0; i < nLimbs && c; i++) {
+        uint128_t v = (uint128_t)r[i] + c;
+        r[i] = (uint64_t)v;
+        c = (uint64_t)(v >> 64);
+    }
+}
+
+// t = a * b
+void u256_mul(uint64_t *t, const uint64_t *a, const uint64_t *b)
+{
+    memset(t, 0, 8 * sizeof(uint64_t));
+    for (int i = 0; i < 4; i++) {
+        uint128_t c = 0;
+        for (int j = 0; j < 4; j++) {
+            c += (uint128_t)a[i] * b[j] + t[i + j];
+            t[i + j] = (uint64_t)c;
+            c >>= 64;
+        }
+        t[i + 4] = (uint64_t)c;
+    }
+}
+
+//
+// Field arithmetic modulo p
+//
+
+struct fe
+{
+    uint64_t n[4];
+};
+
+void fe_set_int(fe &r, uint64_t v)
+{
+    r.n[0] = v;
+    r.n[1] = r.n[2] = r.n[3] = 0;
+}
+
+bool fe_is_zero(const fe &a)
+{
+    return u256_is_zero(a.n);
+}
+
+bool fe_equal(const fe &a, const fe &b)
+{
+    return memcmp(a.n, b.n, sizeof(a.n)) == 0;
+}
+
+bool fe_is_odd(const fe &a)
+{
+    return a.n[0] & 1;
+}
+
+void fe_add(fe &r, const fe &a, const fe &b)
+{
+    if (u256_add(r.n, a.n, b.n)) {
+        // a + b - p = (a + b - 2^256) + (2^256 - p), which is below p
+        u256_add_word(r.n, 4, PC);
+    } else if (u256_geq(r.n, P)) {
+        u256_sub(r.n, r.n, P);
+    }
+}
+
+void fe_sub(fe &r, const fe &a, const fe &b)
+{
+    static const uint64_t pc[4] = { PC, 0, 0, 0 };
+    // a - b + p = (a - b + 2^256) - (2^256 - p)
+    if (u256_sub(r.n, a.n, b.n))
+        u256_sub(r.n, r.n, pc);
+}
+
+void fe_neg(fe &r, const fe &a)
+{
+    if (fe_is_zero(a))
+        r = a;
+    else
+        u256_sub(r.n, P, a.n);
+}
+
+void fe_mul(fe &r, const fe &a, const fe &b)
+{
+    uint64_t t[8];
+    u256_mul(t, a.n, b.n);
+
+    // Fold the upper half in using 2^256 = PC (mod p)
+    uint64_t u[4];
+    uint128_t c = 0;
+    for (int i = 0; i < 4; i++) {
+        c += (uint128_t)t[i + 4] * PC + t[i];
+        u[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    c = (uint128_t)(uint64_t)c * PC + u[0];
+    u[0] = (uint64_t)c;
+    c >>= 64;
+    for (int i = 1; i < 4; i++) {
+        c += u[i];
+        u[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    if (c)
+        u256_add_word(u, 4, PC);
+    if (u256_geq(u, P))
+        u256_sub(u, u, P);
+    memcpy(r.n, u, sizeof(u));
+}
+
+void fe_sqr(fe &r, const fe &a)
+{
+    fe_mul(r, a, a);
+}
+
+void fe_sqr_n(fe &r, const fe &a, int n)
+{
+    r = a;
+    for (int i = 0; i < n; i++)
+        fe_sqr(r, r);
+}
+
+// x223 = a^(2^223 - 1), the common prefix of the inversion and square root
+// addition chains. Also returns a^(2^2 - 1) and a^(2^22 - 1).
+void fe_pow_x223(fe &x223, fe &x2, fe &x22, const fe &a)
+{
+    fe x3, x6, x9, x11, x44, x88, x176, t;
+    fe_sqr(x2, a);
+    fe_mul(x2, x2, a);
+    fe_sqr(x3, x2);
+    fe_mul(x3, x3, a);
+    fe_sqr_n(t, x3, 3);
+    fe_mul(x6, t, x3);
+    fe_sqr_n(t, x6, 3);
+    fe_mul(x9, t, x3);
+    fe_sqr_n(t, x9, 2);
+    fe_mul(x11, t, x2);
+    fe_sqr_n(t, x11, 11);
+    fe_mul(x22, t, x11);
+    fe_sqr_n(t, x22, 22);
+    fe_mul(x44, t, x22);
+    fe_sqr_n(t, x44, 44);
+    fe_mul(x88, t, x44);
+    fe_sqr_n(t, x88, 88);
+    fe_mul(x176, t, x88);
+    fe_sqr_n(t, x176, 44);
+    fe_mul(t, t, x44);
+    fe_sqr_n(t, t, 3);
+    fe_mul(x223, t, x3);
+}
+
+void fe_inv(fe &r, const fe &a)
+{
+    // a^(p-2)
+    fe x223, x2, x22, t;
+    fe_pow_x223(x223, x2, x22, a);
+    fe_sqr_n(t, x223, 23);
+    fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 5);
+    fe_mul(t, t, a);
+    fe_sqr_n(t, t, 3);
+    fe_mul(t, t, x2);
+    fe_sqr_n(t, t, 2);
+    fe_mul(r, t, a);
+}
+
+// Returns false if a is not a square
+bool fe_sqrt(fe &r, const fe &a)
+{
+    // p = 3 mod 4, so a^((p+1)/4) is a square root if one exists
+    fe x223, x2, x22, t, t2;
+    fe_pow_x223(x223, x2, x22, a);
+    fe_sqr_n(t, x223, 23);
+    fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 6);
+    fe_mul(t, t, x2);
+    fe_sqr_n(t, t, 2);
+    fe_sqr(t2, t);
+    if (!fe_equal(t2, a))
+        return false;
+    r = t;
+    return true;
+}
+
+//
+// Scalar arithmetic modulo n
+//
+
+// Reduce an integer below 2^256 that may be at or above n
+void sc_reduce(uint64_t *a)
+{
+    if (u256_geq(a, N))
+        u256_sub(a, a, N);
+}
+
+// out = lo + hi * (2^256 - n), out has nOut limbs
+void sc_fold(uint64_t *out, int nOut, const uint64_t *lo, const uint64_t *hi, int nHi)
+{
+    memset(out, 0, nOut * sizeof(uint64_t));
+    memcpy(out, lo, 4 * sizeof(uint64_t));
+    for (int i = 0; i < nHi; i++) {
+        uint128_t c = 0;
+        for (int j = 0; j < 3; j++) {
+            c += (uint128_t)hi[i] * NC[j] + out[i + j];
+            out[i + j] = (uint64_t)c;
+            c >>= 64;
+        }
+        u256_add_word(out + i + 3, nOut - i - 3, (uint64_t)c);
+    }
+}
+
+void sc_mul(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    uint64_t t[8], m[7], q[5], s[5];
+    u256_mul(t, a, b);
+    // 2^256 = 2^256 - n (mod n), which is 129 bits, so each fold shrinks the value
+    sc_fold(m, 7, t, t + 4, 4); // < 2^386
+    sc_fold(q, 5, m, m + 4, 3); // < 2^260
+    sc_fold(s, 5, q, q + 4, 1); // < 2^256 + 2^133
+    if (s[4]) {
+        uint64_t hi = s[4];
+        memcpy(q, s, sizeof(q));
+        sc_fold(s, 5, q, &hi, 1);
+    }
+    while (u256_geq(s, N))
+        u256_sub(s, s, N);
+    memcpy(r, s, 4 * sizeof(uint64_t));
+}
+
+// x = x / 2 (mod n)
+void sc_half(uint64_t *x)
+{
+    uint64_t carry = 0;
+    if (x[0] & 1)
+        carry = u256_add(x, x, N);
+    for (int i = 0; i < 3; i++)
+        x[i] = (x[i] >> 1) | (x[i + 1] << 63);
+    x[3] = (x[3] >> 1) | (carry << 63);
+}
+
+// r = a - b (mod n)
+void sc_sub(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    if (u256_sub(r, a, b))
+        u256_add(r, r, N);
+}
+
+// Binary extended Euclid, a must be non-zero and below n
+void sc_inv(uint64_t *r, const uint64_t *a)
+{
+    uint64_t u[4], v[4], x1[4] = { 1, 0, 0, 0 }, x2[4] = { 0, 0, 0, 0 };
+    static const uint64_t one[4] = { 1, 0, 0, 0 };
+    memcpy(u, a, sizeof(u));
+    memcpy(v, N, sizeof(v));
+    while (memcmp(u, one, sizeof(u)) != 0 && memcmp(v, one, sizeof(v)) != 0) {
+        while (!(u[0] & 1)) {
+            for (int i = 0; i < 3; i++)
+                u[i] = (u[i] >> 1) | (u[i + 1] << 63);
+            u[3] >>= 1;
+            sc_half(x1);
+        }
+        while (!(v[0] & 1)) {
+            for (int i = 0; i < 3; i++)
+                v[i] = (v[i] >> 1) | (v[i + 1] << 63);
+            v[3] >>= 1;
+            sc_half(x2);
+        }
+        if (u256_geq(u, v)) {
+            u256_sub(u, u, v);
+            sc_sub(x1, x1, x2);
+        } else {
+            u256_sub(v, v, u);
+            sc_sub(x2, x2, x1);
+        }
+    }
+    memcpy(r, memcmp(u, one, sizeof(u)) == 0 ? x1 : x2, 4 * sizeof(uint64_t));
+}
+
+void sc_neg(uint64_t *r, const uint64_t *a)
+{
+    if (u256_is_zero(a))
+        memcpy(r, a, 4 * sizeof(uint64_t));
+    else
+        u256_sub(r, N, a);
+}
+
+// Width-w non-adjacent form of a scalar, returns the number of digits used
+int sc_wnaf(int *wnaf, const uint64_t *a, int w)
+{
+    uint64_t k[5] = { a[0], a[1], a[2], a[3], 0 };
+    int nLen = 0;
+    for (int i = 0; i < WNAF_SIZE; i++) {
+        int d = 0;
+        if (k[0] & 1) {
+            d = (int)(k[0] & ((1U << w) - 1));
+            if (d >= (1 << (w - 1))) {
+                d -= (1 << w);
+                u256_add_word(k, 5, (uint64_t)(-d));
+            } else {
+                k[0] -= d;
+            }
+            nLen = i + 1;
+        }
+        wnaf[i] = d;
+        for (int j = 0; j < 4; j++)
+            k[j] = (k[j] >> 1) | (k[j + 1] << 63);
+        k[4] >>= 1;
+    }
+    return nLen;
+}
+
+//
+// Group arithmetic
+//
+
+struct ge
+{
+    fe x, y;
+};
+
+struct gej
+{
+    fe x, y, z;
+    bool fInfinity;
+};
+
+void gej_set_ge(gej &r, const ge &a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    fe_set_int(r.z, 1);
+    r.fInfinity = false;
+}
+
+void gej_double(gej &r, const gej &a)
+{
+    if (a.fInfinity) {
+        r.fInfinity = true;
+        return;
+    }
+    // dbl-2009-l, secp256k1 has no points with y = 0
+    fe A, B, C, D, E, F, t, x3, y3, z3;
+    fe_sqr(A, a.x);
+    fe_sqr(B, a.y);
+    fe_sqr(C, B);
+    fe_add(t, a.x, B);
+    fe_sqr(t, t);
+    fe_sub(t, t, A);
+    fe_sub(t, t, C);
+    fe_add(D, t, t);
+    fe_add(E, A, A);
+    fe_add(E, E, A);
+    fe_sqr(F, E);
+    fe_mul(z3, a.y, a.z);
+    fe_add(z3, z3, z3);
+    fe_sub(x3, F, D);
+    fe_sub(x3, x3, D);
+    fe_sub(t, D, x3);
+    fe_mul(y3, E, t);
+    fe_add(C, C, C);
+    fe_add(C, C, C);
+    fe_add(C, C, C);
+    fe_sub(y3, y3, C);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+// Shared tail of the additions: given u1, s1 of the first point and h = u2 - u1, rr = s2 - s1
+void gej_add_finish(gej &r, const fe &u1, const fe &s1, const fe &h, const fe &rr, const fe &z3)
+{
+    fe h2, h3, u1h2, t, x3, y3;
+    fe_sqr(h2, h);
+    fe_mul(h3, h2, h);
+    fe_mul(u1h2, u1, h2);
+    fe_sqr(x3, rr);
+    fe_sub(x3, x3, h3);
+    fe_sub(x3, x3, u1h2);
+    fe_sub(x3, x3, u1h2);
+    fe_sub(t, u1h2, x3);
+    fe_mul(y3, rr, t);
+    fe_mul(t, s1, h3);
+    fe_sub(y3, y3, t);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+void gej_add(gej &r, const gej &a, const gej &b)
+{
+    if (a.fInfinity) {
+        r = b;
+        return;
+    }
+    if (b.fInfinity) {
+        r = a;
+        return;
+    }
+    fe z1z1, z2z2, u1, u2, s1, s2, h, rr, z3;
+    fe_sqr(z1z1, a.z);
+    fe_sqr(z2z2, b.z);
+    fe_mul(u1, a.x, z2z2);
+    fe_mul(u2, b.x, z1z1);
+    fe_mul(s1, a.y, b.z);
+    fe_mul(s1, s1, z2z2);
+    fe_mul(s2, b.y, a.z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, u1);
+    fe_sub(rr, s2, s1);
+    if (fe_is_zero(h)) {
+        if (fe_is_zero(rr))
+            gej_double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    fe_mul(z3, a.z, b.z);
+    fe_mul(z3, z3, h);
+    gej_add_finish(r, u1, s1, h, rr, z3);
+}
+
+void gej_add_ge(gej &r, const gej &a, const ge &b)
+{
+    if (a.fInfinity) {
+        gej_set_ge(r, b);
+        return;
+    }
+    fe z1z1, u2, s2, h, rr, z3;
+    fe_sqr(z1z1, a.z);
+    fe_mul(u2, b.x, z1z1);
+    fe_mul(s2, b.y, a.z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, a.x);
+    fe_sub(rr, s2, a.y);
+    if (fe_is_zero(h)) {
+        if (fe_is_zero(rr))
+            gej_double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    fe_mul(z3, a.z, h);
+    gej_add_finish(r, a.x, a.y, h, rr, z3);
+}
+
+void ge_set_gej_zinv(ge &r, const gej &a, const fe &zi)
+{
+    fe zi2, zi3;
+    fe_sqr(zi2, zi);
+    fe_mul(zi3, zi2, zi);
+    fe_mul(r.x, a.x, zi2);
+    fe_mul(r.y, a.y, zi3);
+}
+
+// Odd multiples G, 3G, 5G, ... of the generator in affine coordinates
+struct CGeneratorTable
+{
+    ge pts[TABLE_SIZE_G];
+
+    CGeneratorTable()
+    {
+        ge g;
+        u256_from_bytes(g.x.n, G_X);
+        u256_from_bytes(g.y.n, G_Y);
+        gej cur, g2;
+        gej_set_ge(cur, g);
+        gej_double(g2, cur);
+        for (int i = 0; i < TABLE_SIZE_G; i++) {
+            fe zi;
+            fe_inv(zi, cur.z);
+            ge_set_gej_zinv(pts[i], cur, zi);
+            gej_add(cur, cur, g2);
+        }
+    }
+};
+
+const CGeneratorTable &GeneratorTable()
+{
+    static const CGeneratorTable table;
+    return table;
+}
+
+// r = na * a + ng * G
+void ecmult(gej &r, const ge &a, const uint64_t *na, const uint64_t *ng)
+{
+    const CGeneratorTable &tableG = GeneratorTable();
+
+    // Odd multiples of a
+    gej tableA[TABLE_SIZE_R], a2;
+    gej_set_ge(tableA[0], a);
+    gej_double(a2, tableA[0]);
+    for (int i = 1; i < TABLE_SIZE_R; i++)
+        gej_add(tableA[i], tableA[i - 1], a2);
+
+    int wnafA[WNAF_SIZE], wnafG[WNAF_SIZE];
+    int nLenA = sc_wnaf(wnafA, na, WINDOW_R);
+    int nLenG = sc_wnaf(wnafG, ng, WINDOW_G);
+
+    r.fInfinity = true;
+    for (int i = (nLenA > nLenG ? nLenA : nLenG) - 1; i >= 0; i--) {
+        gej_double(r, r);
+        int d = wnafA[i];
+        if (d) {
+            gej p = tableA[(d < 0 ? -d : d) / 2];
+            if (d < 0)
+                fe_neg(p.y, p.y);
+            gej_add(r, r, p);
+        }
+        d = wnafG[i];
+        if (d) {
+            ge p = tableG.pts[(d < 0 ? -d : d) / 2];
+            if (d < 0)
+                fe_neg(p.y, p.y);
+            gej_add_ge(r, r, p);
+        }
+    }
+}
+
+// Q = (-e/r) * G + (s/r) * R, following ECDSA_SIG_recover_key_GFp in key.cpp
+bool RecoverPoint(gej &q, const unsigned char *hash, const unsigned char *p64, int rec)
+{
+    if (rec < 0 || rec >= 3)
+        return false;
+
+    uint64_t r[4], s[4], e[4];
+    u256_from_bytes(r, p64);
+    u256_from_bytes(s, p64 + 32);
+    u256_from_bytes(e, hash);
+
+    // x = r + (rec / 2) * n has to be a field element
+    ge R;
+    memcpy(R.x.n, r, sizeof(r));
+    if (rec / 2 && u256_add(R.x.n, R.x.n, N))
+        return false;
+    if (u256_geq(R.x.n, P))
+        return false;
+
+    // y^2 = x^3 + 7, with the parity given by the recovery id
+    fe t, seven;
+    fe_set_int(seven, 7);
+    fe_sqr(t, R.x);
+    fe_mul(t, t, R.x);
+    fe_add(t, t, seven);
+    if (!fe_sqrt(R.y, t))
+        return false;
+    if (fe_is_odd(R.y) != (bool)(rec & 1))
+        fe_neg(R.y, R.y);
+
+    sc_reduce(r);
+    sc_reduce(s);
+    sc_reduce(e);
+    if (u256_is_zero(r))
+        return false;
+
+    uint64_t rinv[4], sor[4], eor[4];
+    sc_inv(rinv, r);
+    sc_mul(sor, s, rinv);
+    sc_neg(e, e);
+    sc_mul(eor, e, rinv);
+
+    ecmult(q, R, sor, eor);
+    return true;
+}
+
+void SerializePoint(const gej &q, const fe &zi, bool fCompressed, unsigned char *pubkey, unsigned int &nSize)
+{
+    if (q.fInfinity) {
+        pubkey[0] = 0;
+        nSize = 1;
+        return;
+    }
+    ge a;
+    ge_set_gej_zinv(a, q, zi);
+    u256_to_bytes(pubkey + 1, a.x.n);
+    if (fCompressed) {
+        pubkey[0] = fe_is_odd(a.y) ? 0x03 : 0x02;
+        nSize = 33;
+    } else {
+        pubkey[0] = 0x04;
+        u256_to_bytes(pubkey + 33, a.y.n);
+        nSize = 65;
+    }
+}
+
+} // anon namespace
+
+bool ECRecover(const unsigned char *hash, const unsigned char *p64, int rec, bool fCompressed, unsigned char *pubkey, unsigned int &nSize)
+{
+    gej q;
+    if (!RecoverPoint(q, hash, p64, rec))
+        return false;
+    fe zi;
+    if (!q.fInfinity)
+        fe_inv(zi, q.z);
+    SerializePoint(q, zi, fCompressed, pubkey, nSize);
+    return true;
+}
+
+void ECRecoverBatch(CECRecoverJob *jobs, size_t nJobs)
+{
+    gej q[BATCH_CHUNK];
+    fe prod[BATCH_CHUNK];
+
+    for (size_t nStart = 0; nStart < nJobs; nStart += BATCH_CHUNK) {
+        size_t nCount = nJobs - nStart < BATCH_CHUNK ? nJobs - nStart : BATCH_CHUNK;
+        CECRecoverJob *chunk = jobs + nStart;
+
+        // Recover the points, keeping running products of their z coordinates
+        fe acc;
+        fe_set_int(acc, 1);
+        for (size_t i = 0; i < nCount; i++) {
+            chunk[i].fOk = RecoverPoint(q[i], chunk[i].hash, chunk[i].p64, chunk[i].rec);
+            if (chunk[i].fOk && !q[i].fInfinity)
+                fe_mul(acc, acc, q[i].z);
+            prod[i] = acc;
+        }
+
+        // One inversion for the whole chunk, then walk back to each point's inverse
+        fe inv;
+        fe_inv(inv, acc);
+        for (size_t i = nCount; i-- > 0;) {
+            if (!chunk[i].fOk)
+                continue;
+            fe zi;
+            if (!q[i].fInfinity) {
+                if (i > 0)
+                    fe_mul(zi, inv, prod[i - 1]);
+                else
+                    zi = inv;
+                fe_mul(inv, inv, q[i].z);
+            }
+            SerializePoint(q[i], zi, chunk[i].fCompressed, chunk[i].pubkey, chunk[i].nSize);
+        }
+    }
+}
+
+#endif // USE_NATIVE_ECRECOVER
@@ -0,0 +1,44 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ECRECOVER_H
+#define BITCOIN_ECRECOVER_H
+
+#include <stddef.h>
+
+/** Native secp256k1 public key recovery for compact signatures, built when
+ * USE_NATIVE_ECRECOVER is defined (see --enable-native-ecrecover).
+ *
+ * This is a drop-in replacement for the OpenSSL based CECKey::Recover. It
+ * gives the same answer for every input, including out of range r and s
+ * values, and does not allocate: the generator multiples are precomputed once
+ * and everything else lives on the stack.
+ *
+ * hash is the 32 byte message hash as stored in memory, p64 the 64 byte r||s
+ * part of the compact signature and rec the recovery id (0-2). On success the
+ * serialized key (33 bytes if fCompressed, 65 otherwise) is written to
+ * pubkey and its length to nSize. A signature recovering to the point at
+ * infinity yields the single byte encoding OpenSSL uses for it.
+ */
+bool ECRecover(const unsigned char *hash, const unsigned char *p64, int rec, bool fCompressed, unsigned char *pubkey, unsigned int &nSize);
+
+/** One recovery of a batch */
+struct CECRecoverJob
+{
+    // in
+    const unsigned char *hash;
+    const unsigned char *p64;
+    int rec;
+    bool fCompressed;
+
+    // out
+    bool fOk;
+    unsigned int nSize;
+    unsigned char pubkey[65];
+};
+
+/** Recover a batch of keys, sharing the final field inversion between them */
+void ECRecoverBatch(CECRecoverJob *jobs, size_t nJobs);
+
+#endif
@@ -0,0 +1,467 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hashblock.h"
+
+#include <string.h>
+
+// Multi-lane Hash7. Lane l of every vector holds the state of tail l, so one
+// compression runs 4 or 8 messages. The kernels are templates over GCC vector
+// types and are instantiated once per instruction set with a target attribute;
+// the widest one the CPU supports is picked on first use, the same way the
+// bundled scrypt-jane adapts to the CPU. SHA256 and RIPEMD work on 32 bit words,
+// SHA512 and Keccak on 64 bit words. Whirlpool, HAVAL and Tiger are table driven
+// and gain nothing from this, they stay scalar per lane.
+
+#if defined(__x86_64__) && defined(__GNUC__) && SPH_64
+#define HASH7_LANES 1
+#endif
+
+#ifdef HASH7_LANES
+
+namespace {
+
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+typedef uint64_t v8u64 __attribute__((vector_size(64)));
+
+#define LANES_INLINE inline __attribute__((always_inline))
+
+// Longest tail the lane kernels take, a whole header fits
+static const size_t MAX_TAIL = 128;
+// Padded bytes left after the midstate: the buffered prefix, the tail and the padding
+static const size_t MAX_MESSAGE = 128 + MAX_TAIL + 128;
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+static const uint64_t K512[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL };
+
+static const uint64_t KECCAK_RC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL, 0x8000000080008000ULL,
+    0x000000000000808bULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008aULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800aULL, 0x800000008000000aULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL };
+static const int KECCAK_ROTC[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44 };
+static const int KECCAK_PILN[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1 };
+// Lanes sph keeps complemented between calls
+static const int KECCAK_COMPLEMENTED[6] = { 1, 2, 8, 12, 17, 20 };
+static const size_t KECCAK512_RATE = 72;
+
+static const int RIPEMD_R[80] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8,
+    3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12,
+    1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2,
+    4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13 };
+static const int RIPEMD_RP[80] = {
+    5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12,
+    6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2,
+    15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13,
+    8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14,
+    12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11 };
+static const int RIPEMD_S[80] = {
+    11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8,
+    7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12,
+    11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5,
+    11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12,
+    9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6 };
+static const int RIPEMD_SP[80] = {
+    8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6,
+    9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11,
+    9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5,
+    15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8,
+    8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11 };
+static const uint32_t RIPEMD_K[5] = { 0x00000000, 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xa953fd4e };
+static const uint32_t RIPEMD_KP[5] = { 0x50a28be6, 0x5c4dd124, 0x6d703ef3, 0x7a6d76e9, 0x00000000 };
+
+// Copy the bytes a context buffers plus the tail into msg and append Merkle-Damgard
+// padding with a length field of nLengthBytes. Returns the number of blocks.
+size_t PadMessage(unsigned char* msg, const unsigned char* buf, size_t nBuffered, const unsigned char* tail, size_t len,
+                  size_t nBlock, size_t nLengthBytes, uint64_t nTotal, bool fBigEndian)
+{
+    memcpy(msg, buf, nBuffered);
+    memcpy(msg + nBuffered, tail, len);
+    size_t n = nBuffered + len;
+    size_t nBlocks = (n + 1 + nLengthBytes + nBlock - 1) / nBlock;
+    size_t end = nBlocks * nBlock;
+    msg[n] = 0x80;
+    memset(msg + n + 1, 0, end - n - 1);
+    uint64_t nBits = nTotal << 3;
+    for (int i = 0; i < 8; i++) {
+        if (fBigEndian)
+            msg[end - 1 - i] = (unsigned char)(nBits >> (8 * i));
+        else
+            msg[end - nLengthBytes + i] = (unsigned char)(nBits >> (8 * i));
+    }
+    return nBlocks;
+}
+
+// Rotates are macros, vector values never cross a call so the ABI never matters
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+template<typename V>
+LANES_INLINE void Sha256Compress(V s[8], V w[16])
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16) {
+            V w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            w[i & 15] += (ROTR32(w2, 17) ^ ROTR32(w2, 19) ^ (w2 >> 10)) + w[(i - 7) & 15] +
+                         (ROTR32(w15, 7) ^ ROTR32(w15, 18) ^ (w15 >> 3));
+        }
+        V t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + (g ^ (e & (f ^ g))) + K256[i] + w[i & 15];
+        V t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) | (c & (a | b)));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+template<typename V>
+LANES_INLINE void Sha512Compress(V s[8], V w[16])
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 80; i++) {
+        if (i >= 16) {
+            V w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            w[i & 15] += (ROTR64(w2, 19) ^ ROTR64(w2, 61) ^ (w2 >> 6)) + w[(i - 7) & 15] +
+                         (ROTR64(w15, 1) ^ ROTR64(w15, 8) ^ (w15 >> 7));
+        }
+        V t1 = h + (ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41)) + (g ^ (e & (f ^ g))) + K512[i] + w[i & 15];
+        V t2 = (ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39)) + ((a & b) | (c & (a | b)));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+template<typename V>
+LANES_INLINE void RipemdF(int j, const V& x, const V& y, const V& z, V& r)
+{
+    switch (j >> 4) {
+    case 0: r = x ^ y ^ z; break;
+    case 1: r = (x & y) | (~x & z); break;
+    case 2: r = (x | ~y) ^ z; break;
+    case 3: r = (x & z) | (y & ~z); break;
+    default: r = x ^ (y | ~z); break;
+    }
+}
+
+template<typename V>
+LANES_INLINE void RipemdCompress(V s[5], const V x[16])
+{
+    V al = s[0], bl = s[1], cl = s[2], dl = s[3], el = s[4];
+    V ar = s[0], br = s[1], cr = s[2], dr = s[3], er = s[4];
+    for (int j = 0; j < 80; j++) {
+        V f, t;
+        RipemdF(j, bl, cl, dl, f);
+        t = al + f + x[RIPEMD_R[j]] + RIPEMD_K[j >> 4];
+        t = ROTL32(t, RIPEMD_S[j]) + el;
+        al = el; el = dl; dl = ROTL32(cl, 10); cl = bl; bl = t;
+        RipemdF(79 - j, br, cr, dr, f);
+        t = ar + f + x[RIPEMD_RP[j]] + RIPEMD_KP[j >> 4];
+        t = ROTL32(t, RIPEMD_SP[j]) + er;
+        ar = er; er = dr; dr = ROTL32(cr, 10); cr = br; br = t;
+    }
+    V t = s[1] + cl + dr;
+    s[1] = s[2] + dl + er;
+    s[2] = s[3] + el + ar;
+    s[3] = s[4] + al + br;
+    s[4] = s[0] + bl + cr;
+    s[0] = t;
+}
+
+template<typename V>
+LANES_INLINE void KeccakF(V a[25])
+{
+    for (int round = 0; round < 24; round++) {
+        V c[5];
+        for (int i = 0; i < 5; i++)
+            c[i] = a[i] ^ a[i + 5] ^ a[i + 10] ^ a[i + 15] ^ a[i + 20];
+        for (int i = 0; i < 5; i++) {
+            V t = c[(i + 4) % 5] ^ ROTL64(c[(i + 1) % 5], 1);
+            for (int j = 0; j < 25; j += 5)
+                a[j + i] ^= t;
+        }
+        V t = a[1];
+        for (int i = 0; i < 24; i++) {
+            int j = KECCAK_PILN[i];
+            V u = a[j];
+            a[j] = ROTL64(t, KECCAK_ROTC[i]);
+            t = u;
+        }
+        for (int j = 0; j < 25; j += 5) {
+            for (int i = 0; i < 5; i++)
+                c[i] = a[j + i];
+            for (int i = 0; i < 5; i++)
+                a[j + i] ^= ~c[(i + 1) % 5] & c[(i + 2) % 5];
+        }
+        a[0] ^= KECCAK_RC[round];
+    }
+}
+
+// Each digest below runs the lanes of one vector, starting at tails[0] and hash[0]
+
+template<typename V>
+LANES_INLINE void Sha256Lanes(const sph_sha256_context& ctx, const unsigned char* const tails[], size_t len, uint512 hash[][7])
+{
+    const int N = sizeof(V) / sizeof(uint32_t);
+    unsigned char msg[N][MAX_MESSAGE];
+    size_t nBlocks = 0;
+    for (int l = 0; l < N; l++)
+        nBlocks = PadMessage(msg[l], ctx.buf, ctx.count & 63, tails[l], len, 64, 8, ctx.count + len, true);
+
+    V s[8], w[16];
+    for (int i = 0; i < 8; i++)
+        s[i] = V() + ctx.val[i];
+    for (size_t b = 0; b < nBlocks; b++) {
+        for (int i = 0; i < 16; i++)
+            for (int l = 0; l < N; l++)
+                w[i][l] = sph_dec32be(msg[l] + b * 64 + i * 4);
+        Sha256Compress(s, w);
+    }
+    for (int l = 0; l < N; l++)
+        for (int i = 0; i < 8; i++)
+            sph_enc32be((unsigned char*)&hash[l][0] + i * 4, s[i][l]);
+}
+
+template<typename V>
+LANES_INLINE void Sha512Lanes(const sph_sha512_context& ctx, const unsigned char* const tails[], size_t len, uint512 hash[][7])
+{
+    const int N = sizeof(V) / sizeof(uint64_t);
+    unsigned char msg[N][MAX_MESSAGE];
+    size_t nBlocks = 0;
+    for (int l = 0; l < N; l++)
+        nBlocks = PadMessage(msg[l], ctx.buf, ctx.count & 127, tails[l], len, 128, 16, ctx.count + len, true);
+
+    V s[8], w[16];
+    for (int i = 0; i < 8; i++)
+        s[i] = V() + ctx.val[i];
+    for (size_t b = 0; b < nBlocks; b++) {
+        for (int i = 0; i < 16; i++)
+            for (int l = 0; l < N; l++)
+                w[i][l] = sph_dec64be(msg[l] + b * 128 + i * 8);
+        Sha512Compress(s, w);
+    }
+    for (int l = 0; l < N; l++)
+        for (int i = 0; i < 8; i++)
+            sph_enc64be((unsigned char*)&hash[l][1] + i * 8, s[i][l]);
+}
+
+// Keccak512 with the original (pre-SHA3) padding
+template<typename V>
+LANES_INLINE void KeccakLanes(const sph_keccak512_context& ctx, const unsigned char* const tails[], size_t len, uint512 hash[][7])
+{
+    const int N = sizeof(V) / sizeof(uint64_t);
+    unsigned char msg[N][MAX_MESSAGE];
+    size_t n = ctx.ptr + len;
+    size_t nBlocks = n / KECCAK512_RATE + 1;
+    for (int l = 0; l < N; l++) {
+        memcpy(msg[l], ctx.buf, ctx.ptr);
+        memcpy(msg[l] + ctx.ptr, tails[l], len);
+        memset(msg[l] + n, 0, nBlocks * KECCAK512_RATE - n);
+        msg[l][n] = 0x01;
+        msg[l][nBlocks * KECCAK512_RATE - 1] |= 0x80;
+    }
+
+    V a[25];
+    for (int i = 0; i < 25; i++)
+        a[i] = V() + ctx.u.wide[i];
+    for (int i = 0; i < 6; i++)
+        a[KECCAK_COMPLEMENTED[i]] = ~a[KECCAK_COMPLEMENTED[i]];
+    for (size_t b = 0; b < nBlocks; b++) {
+        for (size_t i = 0; i < KECCAK512_RATE / 8; i++)
+            for (int l = 0; l < N; l++)
+                a[i][l] ^= sph_dec64le(msg[l] + b * KECCAK512_RATE + i * 8);
+        KeccakF(a);
+    }
+    for (int l = 0; l < N; l++)
+        for (int i = 0; i < 8; i++)
+            sph_enc64le((unsigned char*)&hash[l][2] + i * 8, a[i][l]);
+}
+
+template<typename V>
+LANES_INLINE void RipemdLanes(const sph_ripemd160_context& ctx, const unsigned char* const tails[], size_t len, uint512 hash[][7])
+{
+    const int N = sizeof(V) / sizeof(uint32_t);
+    unsigned char msg[N][MAX_MESSAGE];
+    size_t nBlocks = 0;
+    for (int l = 0; l < N; l++)
+        nBlocks = PadMessage(msg[l], ctx.buf, ctx.count & 63, tails[l], len, 64, 8, ctx.count + len, false);
+
+    V s[5], x[16];
+    for (int i = 0; i < 5; i++)
+        s[i] = V() + ctx.val[i];
+    for (size_t b = 0; b < nBlocks; b++) {
+        for (int i = 0; i < 16; i++)
+            for (int l = 0; l < N; l++)
+                x[i][l] = sph_dec32le(msg[l] + b * 64 + i * 4);
+        RipemdCompress(s, x);
+    }
+    for (int l = 0; l < N; l++)
+        for (int i = 0; i < 5; i++)
+            sph_enc32le((unsigned char*)&hash[l][6] + i * 4, s[i][l]);
+}
+
+// The four vectorized digests of nLanes lanes, into hash[lane][0], [1], [2] and [6].
+// V32 and V64 are picked per instruction set so the state stays in registers.
+template<typename V32, typename V64>
+LANES_INLINE void HashLanes(const sph_sha256_context& sha256, const sph_sha512_context& sha512,
+                            const sph_keccak512_context& keccak, const sph_ripemd160_context& ripemd,
+                            const unsigned char* const tails[], size_t len, uint512 hash[][7], int nLanes)
+{
+    const int N32 = sizeof(V32) / sizeof(uint32_t);
+    const int N64 = sizeof(V64) / sizeof(uint64_t);
+    for (int l = 0; l < nLanes; l += N32) {
+        Sha256Lanes<V32>(sha256, tails + l, len, hash + l);
+        RipemdLanes<V32>(ripemd, tails + l, len, hash + l);
+    }
+    for (int l = 0; l < nLanes; l += N64) {
+        Sha512Lanes<V64>(sha512, tails + l, len, hash + l);
+        KeccakLanes<V64>(keccak, tails + l, len, hash + l);
+    }
+}
+
+typedef void (*HashLanesFn)(const sph_sha256_context&, const sph_sha512_context&, const sph_keccak512_context&,
+                            const sph_ripemd160_context&, const unsigned char* const[], size_t, uint512[][7], int);
+
+#define DEFINE_LANES(name, target, V32, V64) \
+    target void name(const sph_sha256_context& sha256, const sph_sha512_context& sha512, \
+                     const sph_keccak512_context& keccak, const sph_ripemd160_context& ripemd, \
+                     const unsigned char* const tails[], size_t len, uint512 hash[][7], int nLanes) \
+    { \
+        HashLanes<V32, V64>(sha256, sha512, keccak, ripemd, tails, len, hash, nLanes); \
+    }
+
+// SSE2 lanes were measured no faster than the scalar sph code, so without AVX2
+// the lanes are hashed one after the other
+DEFINE_LANES(HashLanes4AVX2, __attribute__((target("avx2"))), v4u32, v4u64)
+DEFINE_LANES(HashLanes8AVX2, __attribute__((target("avx2"))), v8u32, v4u64)
+DEFINE_LANES(HashLanes8AVX512, __attribute__((target("avx512f,avx512vl"))), v8u32, v8u64)
+
+struct CLanesDispatch
+{
+    HashLanesFn pLanes4;
+    HashLanesFn pLanes8;
+    const char* strName;
+
+    CLanesDispatch()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+            pLanes4 = HashLanes4AVX2;
+            pLanes8 = HashLanes8AVX512;
+            strName = "avx512";
+        } else if (__builtin_cpu_supports("avx2")) {
+            pLanes4 = HashLanes4AVX2;
+            pLanes8 = HashLanes8AVX2;
+            strName = "avx2";
+        } else {
+            pLanes4 = NULL;
+            pLanes8 = NULL;
+            strName = "scalar";
+        }
+    }
+};
+
+const CLanesDispatch& LanesDispatch()
+{
+    static const CLanesDispatch dispatch;
+    return dispatch;
+}
+
+}
+
+void CHash7Midstate::Hash(const unsigned char* const tails[], size_t sz, int nLanes, uint256 hashes[]) const
+{
+    const CLanesDispatch& dispatch = LanesDispatch();
+    HashLanesFn pLanes = (nLanes == 8 ? dispatch.pLanes8 : nLanes == 4 ? dispatch.pLanes4 : NULL);
+    if (pLanes == NULL || sz > MAX_TAIL) {
+        for (int l = 0; l < nLanes; l++)
+            hashes[l] = Hash(tails[l], sz);
+        return;
+    }
+
+    uint512 hash[8][7];
+    for (int l = 0; l < nLanes; l++)
+        for (int i = 0; i < 7; i++)
+            hash[l][i] = 0;
+
+    pLanes(ctx_sha256, ctx_sha512, ctx_keccak, ctx_ripemd, tails, sz, hash, nLanes);
+
+    static unsigned char pblank[1];
+    for (int l = 0; l < nLanes; l++) {
+        const void* ptr = (sz == 0 ? pblank : tails[l]);
+        sph_whirlpool_context    whirlpool = ctx_whirlpool;
+        sph_haval256_5_context   haval = ctx_haval;
+        sph_tiger_context        tiger = ctx_tiger;
+
+        sph_whirlpool (&whirlpool, ptr, sz);
+        sph_whirlpool_close(&whirlpool, static_cast<void*>(&hash[l][3]));
+        sph_haval256_5 (&haval, ptr, sz);
+        sph_haval256_5_close(&haval, static_cast<void*>(&hash[l][4]));
+        sph_tiger (&tiger, ptr, sz);
+        sph_tiger_close(&tiger, static_cast<void*>(&hash[l][5]));
+
+        hashes[l] = Hash7Product(hash[l]);
+    }
+}
+
+const char* Hash7LanesImplementation()
+{
+    return LanesDispatch().strName;
+}
+
+#else
+
+void CHash7Midstate::Hash(const unsigned char* const tails[], size_t sz, int nLanes, uint256 hashes[]) const
+{
+    for (int l = 0; l < nLanes; l++)
+        hashes[l] = Hash(tails[l], sz);
+}
+
+const char* Hash7LanesImplementation()
+{
+    return "scalar";
+}
+
+#endif
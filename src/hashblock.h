@@ -12,148 +12,211 @@
 #include "hash/sph_whirlpool.h"
 #include "hash/sph_ripemd.h"
 
-#ifndef QT_NO_DEBUG
-#include <string>
-#endif
-
-#ifdef GLOBALDEFINED
-#define GLOBAL
+//The product of seven 512 bit digests fits in 56 64 bit limbs
+static const int HASH7_PRODUCT_LIMBS = 7 * 8;
+
+//Multiply the seven digests (zeros count as one) into a little endian byte string
+//without its high zero bytes, the same bytes mpz_export(data, NULL, -1, 1, 0, 0, product)
+//gives. Schoolbook on stack limbs, one digest limb per row; zero high limbs of the
+//shorter digests are skipped. Returns the number of bytes written to data, which must
+//hold HASH7_PRODUCT_LIMBS * 8.
+inline int Hash7Multiply(const uint512 hash[7], unsigned char* data)
+{
+    typedef unsigned __int128 uint128_t;
+    uint64_t limbs[2][HASH7_PRODUCT_LIMBS];
+    uint64_t* product = limbs[0];
+    uint64_t* result = limbs[1];
+    int nProduct = 1;
+    product[0] = 1;
+
+    for(int k=0; k < 7; k++){
+	uint64_t digest[8];
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	const unsigned char* p = (const unsigned char*)&hash[k];
+	for(int i=0; i < 8; i++){
+	    digest[i] = 0;
+	    for(int j=7; j >= 0; j--)
+		digest[i] = (digest[i] << 8) | p[i*8 + j];
+	}
 #else
-#define GLOBAL extern
+	memcpy(digest, &hash[k], sizeof(digest));
 #endif
+	int nDigest = 8;
+	while(nDigest > 0 && digest[nDigest - 1] == 0)
+	    nDigest--;
+	if(nDigest == 0){
+	    digest[0] = 1;
+	    nDigest = 1;
+	}
+
+	//The first row stores, the others add in
+	uint64_t carry = 0;
+	for(int i=0; i < nProduct; i++){
+	    uint128_t c = (uint128_t)product[i] * digest[0] + carry;
+	    result[i] = (uint64_t)c;
+	    carry = c >> 64;
+	}
+	result[nProduct] = carry;
+	for(int j=1; j < nDigest; j++){
+	    uint64_t* row = result + j;
+	    carry = 0;
+	    for(int i=0; i < nProduct; i++){
+		uint128_t c = (uint128_t)product[i] * digest[j] + row[i] + carry;
+		row[i] = (uint64_t)c;
+		carry = c >> 64;
+	    }
+	    row[nProduct] = carry;
+	}
+
+	nProduct += nDigest;
+	while(nProduct > 1 && result[nProduct - 1] == 0)
+	    nProduct--;
+	uint64_t* swap = product;
+	product = result;
+	result = swap;
+    }
 
-GLOBAL sph_sha256_context     z_sha256;
-GLOBAL sph_sha512_context     z_sha512;
-GLOBAL sph_keccak512_context  z_keccak;
-GLOBAL sph_whirlpool_context  z_whirlpool;
-GLOBAL sph_haval256_5_context z_haval;
-GLOBAL sph_tiger_context      z_tiger;
-GLOBAL sph_ripemd160_context  z_ripemd;
-
-
-
-#define fillz() do { \
-    sph_sha512_init(&z_sha512); \
-    sph_sha256_init(&z_sha256); \
-    sph_keccak512_init(&z_keccak); \
-    sph_whirlpool_init(&z_whirlpool); \
-    sph_haval256_5_init(&z_haval); \
-    sph_tiger_init(&z_tiger); \
-    sph_ripemd160_init(&z_ripemd); \
-} while (0) 
-
-#define ZSHA256 (memcpy(&ctx_sha256, &z_sha256, sizeof(z_sha256)))
-#define ZSHA512 (memcpy(&ctx_sha512, &z_sha512, sizeof(z_sha512)))
-#define ZKECCAK (memcpy(&ctx_keccak, &z_keccak, sizeof(z_keccak)))
-#define ZWHIRLPOOL (memcpy(&ctx_whirlpool, &z_whirlpool, sizeof(z_whirlpool)))
-#define ZHAVAL (memcpy(&ctx_haval, &z_haval, sizeof(z_haval)))
-#define ZTIGER (memcpy(&ctx_tiger, &z_tiger, sizeof(z_tiger)))
-#define ZRIPEMD (memcpy(&ctx_ripemd, &z_ripemd, sizeof(z_ripemd)))
+    for(int i=0; i < nProduct; i++){
+	for(int j=0; j < 8; j++)
+	    data[i*8 + j] = (unsigned char)(product[i] >> (8 * j));
+    }
+    int bytes = nProduct * 8;
+    while(data[bytes - 1] == 0)
+	bytes--;
+    return bytes;
+}
 
-template<typename T1>
-inline uint256 Hash7(const T1 pbegin, const T1 pend)
+//SHA256 of the digest product, the last step of Hash7
+inline uint256 Hash7Product(const uint512 hash[7])
 {
     sph_sha256_context       ctx_sha256;
-    sph_sha512_context       ctx_sha512;
-    sph_keccak512_context    ctx_keccak;
-    sph_whirlpool_context    ctx_whirlpool;
-    sph_haval256_5_context   ctx_haval;
-    sph_tiger_context        ctx_tiger;
-    sph_ripemd160_context    ctx_ripemd;
-    static unsigned char pblank[1];
-
-#ifndef QT_NO_DEBUG
-    //std::string strhash;
-    //strhash = "";
-#endif
-    
-    uint512 hash[7];
     uint256 finalhash;
-    for(int i=0; i < 7; i++)
-	hash[i] = 0;
-
-    const void* ptr = (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0]));
-    size_t sz = (pend - pbegin) * sizeof(pbegin[0]);
+    unsigned char data[HASH7_PRODUCT_LIMBS * 8];
+    int bytes = Hash7Multiply(hash, data);
 
     sph_sha256_init(&ctx_sha256);
-    // ZSHA256;
-    sph_sha256 (&ctx_sha256, ptr, sz);
-    sph_sha256_close(&ctx_sha256, static_cast<void*>(&hash[0]));
-    
-    sph_sha512_init(&ctx_sha512);
-    // ZSHA512;
-    sph_sha512 (&ctx_sha512, ptr, sz);
-    sph_sha512_close(&ctx_sha512, static_cast<void*>(&hash[1]));
-    
-    sph_keccak512_init(&ctx_keccak);
-    // ZKECCAK;
-    sph_keccak512 (&ctx_keccak, ptr, sz);
-    sph_keccak512_close(&ctx_keccak, static_cast<void*>(&hash[2]));
-
-    sph_whirlpool_init(&ctx_whirlpool);
-    // ZWHIRLPOOL;
-    sph_whirlpool (&ctx_whirlpool, ptr, sz);
-    sph_whirlpool_close(&ctx_whirlpool, static_cast<void*>(&hash[3]));
-    
-    sph_haval256_5_init(&ctx_haval);
-    // ZHAVAL;
-    sph_haval256_5 (&ctx_haval, ptr, sz);
-    sph_haval256_5_close(&ctx_haval, static_cast<void*>(&hash[4]));
-
-    sph_tiger_init(&ctx_tiger);
-    // ZTIGER;
-    sph_tiger (&ctx_tiger, ptr, sz);
-    sph_tiger_close(&ctx_tiger, static_cast<void*>(&hash[5]));
-
-#if 1
-    sph_ripemd160_init(&ctx_ripemd);
-    // ZRIPEMD;
-    sph_ripemd160 (&ctx_ripemd, ptr, sz);
-    sph_ripemd160_close(&ctx_ripemd, static_cast<void*>(&hash[6]));
-
-    //printf("%s\n", hash[6].GetHex().c_str());
-#endif
-    mpz_t bns[7];
-
-    //Take care of zeros and load gmp
-    for(int i=0; i < 7; i++){
-	if(hash[i]==0)
-	    hash[i] = 1;
-	mpz_init(bns[i]);
-	mpz_set_uint512(bns[i],hash[i]);
-    }
- 
-    mpz_t product;
-    mpz_init(product);
-    mpz_set_ui(product,1);
-    for(int i=0; i < 7; i++){
-	mpz_mul(product,product,bns[i]);
+    sph_sha256 (&ctx_sha256, data,bytes);
+    sph_sha256_close(&ctx_sha256, static_cast<void*>(&finalhash));
+    return finalhash;
+}
+
+//The seven Hash7 contexts with a constant message prefix already absorbed. The miner
+//absorbs everything in front of nNonce once per template and then only feeds the tail
+//for each attempt. Every full block of the prefix is compressed up front (64 byte blocks
+//for SHA256, Whirlpool, Tiger and RIPEMD, 72 for Keccak); SHA512 and HAVAL use 128 byte
+//blocks so for them the prefix is only buffered.
+class CHash7Midstate
+{
+public:
+    CHash7Midstate()
+    {
+        Init(NULL, 0);
     }
 
-    int bytes = mpz_sizeinbase(product, 256);
-    char *data = (char*)malloc(bytes);
-    mpz_export(data, NULL, -1, 1, 0, 0, product);
+    CHash7Midstate(const void* ptr, size_t sz)
+    {
+        Init(ptr, sz);
+    }
 
-    //Free the memory
-    for(int i=0; i < 7; i++){
-	mpz_clear(bns[i]);
+    void Init(const void* ptr, size_t sz)
+    {
+        static unsigned char pblank[1];
+        if (sz == 0)
+            ptr = pblank;
+
+        sph_sha256_init(&ctx_sha256);
+        sph_sha256 (&ctx_sha256, ptr, sz);
+        sph_sha512_init(&ctx_sha512);
+        sph_sha512 (&ctx_sha512, ptr, sz);
+        sph_keccak512_init(&ctx_keccak);
+        sph_keccak512 (&ctx_keccak, ptr, sz);
+        sph_whirlpool_init(&ctx_whirlpool);
+        sph_whirlpool (&ctx_whirlpool, ptr, sz);
+        sph_haval256_5_init(&ctx_haval);
+        sph_haval256_5 (&ctx_haval, ptr, sz);
+        sph_tiger_init(&ctx_tiger);
+        sph_tiger (&ctx_tiger, ptr, sz);
+        sph_ripemd160_init(&ctx_ripemd);
+        sph_ripemd160 (&ctx_ripemd, ptr, sz);
     }
-    mpz_clear(product);
 
-    sph_sha256_init(&ctx_sha256);
-    // ZSHA256;
-    sph_sha256 (&ctx_sha256, data,bytes);
-    sph_sha256_close(&ctx_sha256, static_cast<void*>(&finalhash));
+    //Hash7 of the absorbed prefix followed by each of nLanes (4 or 8) equally long tails.
+    //SHA256, SHA512, Keccak and RIPEMD run all lanes at once on vector kernels picked for
+    //the CPU at runtime; see hashblock.cpp.
+    void Hash(const unsigned char* const tails[], size_t sz, int nLanes, uint256 hashes[]) const;
+
+    //Hash7 of the absorbed prefix followed by the given tail, the midstate is unchanged
+    uint256 Hash(const void* ptr, size_t sz) const
+    {
+        static unsigned char pblank[1];
+        if (sz == 0)
+            ptr = pblank;
+
+        //The contexts are plain structs so a copy resumes where Init stopped
+        sph_sha256_context       sha256 = ctx_sha256;
+        sph_sha512_context       sha512 = ctx_sha512;
+        sph_keccak512_context    keccak = ctx_keccak;
+        sph_whirlpool_context    whirlpool = ctx_whirlpool;
+        sph_haval256_5_context   haval = ctx_haval;
+        sph_tiger_context        tiger = ctx_tiger;
+        sph_ripemd160_context    ripemd = ctx_ripemd;
+
+        uint512 hash[7];
+        for(int i=0; i < 7; i++)
+            hash[i] = 0;
+
+        sph_sha256 (&sha256, ptr, sz);
+        sph_sha256_close(&sha256, static_cast<void*>(&hash[0]));
+        sph_sha512 (&sha512, ptr, sz);
+        sph_sha512_close(&sha512, static_cast<void*>(&hash[1]));
+        sph_keccak512 (&keccak, ptr, sz);
+        sph_keccak512_close(&keccak, static_cast<void*>(&hash[2]));
+        sph_whirlpool (&whirlpool, ptr, sz);
+        sph_whirlpool_close(&whirlpool, static_cast<void*>(&hash[3]));
+        sph_haval256_5 (&haval, ptr, sz);
+        sph_haval256_5_close(&haval, static_cast<void*>(&hash[4]));
+        sph_tiger (&tiger, ptr, sz);
+        sph_tiger_close(&tiger, static_cast<void*>(&hash[5]));
+        sph_ripemd160 (&ripemd, ptr, sz);
+        sph_ripemd160_close(&ripemd, static_cast<void*>(&hash[6]));
+
+        return Hash7Product(hash);
+    }
 
+private:
+    sph_sha256_context       ctx_sha256;
+    sph_sha512_context       ctx_sha512;
+    sph_keccak512_context    ctx_keccak;
+    sph_whirlpool_context    ctx_whirlpool;
+    sph_haval256_5_context   ctx_haval;
+    sph_tiger_context        ctx_tiger;
+    sph_ripemd160_context    ctx_ripemd;
+};
 
-    free(data);
-    return finalhash;
+//Four or eight Hash7s sharing a prefix, for consecutive nonces in the miner or a batch
+//of whole headers (with an empty midstate) in header sync
+inline void Hash7x4(const CHash7Midstate& midstate, const unsigned char* const tails[4], size_t sz, uint256 hashes[4])
+{
+    midstate.Hash(tails, sz, 4, hashes);
 }
 
+inline void Hash7x8(const CHash7Midstate& midstate, const unsigned char* const tails[8], size_t sz, uint256 hashes[8])
+{
+    midstate.Hash(tails, sz, 8, hashes);
+}
 
+//Name of the lane kernels Hash7x4 and Hash7x8 use on this CPU
+const char* Hash7LanesImplementation();
 
+template<typename T1>
+inline uint256 Hash7(const T1 pbegin, const T1 pend)
+{
+    static unsigned char pblank[1];
+    const void* ptr = (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0]));
+    size_t sz = (pend - pbegin) * sizeof(pbegin[0]);
 
-
+    return CHash7Midstate(ptr, sz).Hash(pblank, 0);
+}
 
 #endif // HASHBLOCK_H
 
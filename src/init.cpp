@@ -12,6 +12,7 @@
 
 #include "addrman.h"
 #include "checkpoints.h"
+#include "hashblock.h"
 #include "main.h"
 #include "miner.h"
 #include "net.h"
@@ -93,6 +94,8 @@ enum BindFlags {
 //
 
 volatile bool fRequestShutdown = false;
+// Only dump the memory pool once mempool.dat was loaded, or the unloaded part would be lost
+static bool fDumpMempoolLater = false;
 
 void StartShutdown()
 {
@@ -121,14 +124,18 @@ void Shutdown()
 #endif
     StopNode();
     UnregisterNodeSignals(GetNodeSignals());
+    if (fDumpMempoolLater)
+        DumpMempool();
     {
         LOCK(cs_main);
 #ifdef ENABLE_WALLET
         if (pwalletMain)
             pwalletMain->SetBestChain(chainActive.GetLocator());
 #endif
-        if (pblocktree)
+        if (pblocktree) {
+            blockCache.Sync();
             pblocktree->Flush();
+        }
         if (pviewTip)
             pviewTip->Flush();
         delete pviewTip; pviewTip = NULL;
@@ -232,7 +239,10 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
     strUsage += "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
-    strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -blockflushinterval=<n> " + strprintf(_("Milliseconds between syncs of block, undo and index writes (default: %d)"), DEFAULT_BLOCK_FLUSH_INTERVAL) + "\n";
+    strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification and transaction admission threads (%u to %d, 0 = auto, <0 = leave that many cores free, 1 = verify and admit on the calling thread, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -prefetchblocks=<n>    " + strprintf(_("Number of blocks to read ahead while connecting or disconnecting blocks (default: %d)"), DEFAULT_PREFETCH_BLOCKS) + "\n";
+    strUsage += "  -prefetchthreads=<n>   " + strprintf(_("Number of block read-ahead threads, 0 to disable (default: %d)"), DEFAULT_PREFETCH_THREADS) + "\n";
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: feedbackcoind.pid)") + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup") + "\n";
     strUsage += "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n";
@@ -261,6 +271,8 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -solomine		  " + _("Allow mining to continue even if no peer connections") + "\n";
     strUsage += "  -resync		  " + _("Force the system to purge the blockchain and resync") + "\n";
     strUsage += "  -purge                 " + _("Purge all unneeded historical data from the database") + "\n";
+    strUsage += "  -prune                 " + _("Delete block and undo files older than the kept history while running (default: 0)") + "\n";
+    strUsage += "  -pruneinterval=<n>     " + strprintf(_("Seconds between pruning passes (default: %d)"), DEFAULT_PRUNE_INTERVAL) + "\n";
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n";
@@ -317,12 +329,16 @@ std::string HelpMessage(HelpMessageMode hmm)
     }
     strUsage += "  -mintxfee=<amt>        " + _("Fees smaller than this are considered zero fee (for transaction creation) (default:") + " " + FormatMoney(CTransaction::nMinTxFee) + ")" + "\n";
 	strUsage += "  -minrelaytxfee=<amt>   " + _("Fees smaller than this are considered zero fee (for relaying) (default:") + " " + FormatMoney(CTransaction::nMinRelayTxFee) + ")" + "\n";
+    strUsage += "  -maxmempool=<n>        " + strprintf(_("Keep the transaction memory pool below <n> megabytes, evicting the lowest fee rates (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE) + "\n";
+    strUsage += "  -mempoolexpiry=<n>     " + strprintf(_("Do not keep transactions in the memory pool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY) + "\n";
+    strUsage += "  -persistmempool        " + _("Save the memory pool to mempool.dat on shutdown and reload it on startup (default: 1)") + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
     if (GetBoolArg("-help-debug", false))
     {
         strUsage += "  -printblock=<hash>     " + _("Print block on startup, if found in block index") + "\n";
         strUsage += "  -printblocktree        " + _("Print block tree on startup (default: 0)") + "\n";
         strUsage += "  -printpriority         " + _("Log transaction priority and fee per kB when mining blocks (default: 0)") + "\n";
+        strUsage += "  -replaybench=<from>:<to> " + _("Re-connect the given block range against the stored account trie, print per stage timings as JSON and exit") + "\n";
         strUsage += "  -privdb                " + _("Sets the DB_PRIVATE flag in the wallet db environment (default: 1)") + "\n";
         strUsage += "  -regtest               " + _("Enter regression test mode, which uses a special chain in which blocks can be solved instantly.") + "\n";
         strUsage += "                         " + _("This is intended for regression testing tools and app development.") + "\n";
@@ -334,7 +350,6 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "\n" + _("Block creation options:") + "\n";
     strUsage += "  -blockminsize=<n>      " + _("Set minimum block size in bytes (default: 0)") + "\n";
     strUsage += "  -blockmaxsize=<n>      " + strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE) + "\n";
-    strUsage += "  -blockprioritysize=<n> " + strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE) + "\n";
 
     strUsage += "\n" + _("RPC server options:") + "\n";
     strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
@@ -417,6 +432,57 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
             LogPrintf("Warning: Could not open blocks file %s\n", path.string());
         }
     }
+
+    if (GetBoolArg("-persistmempool", true)) {
+        LoadMempool();
+        fDumpMempoolLater = !ShutdownRequested();
+    }
+    // Until then a dump would replace mempool.dat with what was read so far
+    fMempoolLoaded = !ShutdownRequested();
+}
+
+// Nearest rank percentile of sorted per block timings, in milliseconds
+static double ReplayPercentile(const std::vector<int64_t> &vSorted, int nPercent)
+{
+    if (vSorted.empty())
+        return 0;
+    size_t nRank = (vSorted.size() * nPercent + 99) / 100;
+    return 0.001 * vSorted[nRank ? nRank - 1 : 0];
+}
+
+static json_spirit::Object ReplayTimingsToJSON(std::vector<int64_t> vTime)
+{
+    sort(vTime.begin(), vTime.end());
+    int64_t nTotal = 0;
+    BOOST_FOREACH(int64_t n, vTime)
+        nTotal += n;
+    json_spirit::Object obj;
+    obj.push_back(json_spirit::Pair("total_ms", 0.001 * nTotal));
+    obj.push_back(json_spirit::Pair("mean_ms", vTime.empty() ? 0 : 0.001 * nTotal / vTime.size()));
+    obj.push_back(json_spirit::Pair("p50_ms", ReplayPercentile(vTime, 50)));
+    obj.push_back(json_spirit::Pair("p90_ms", ReplayPercentile(vTime, 90)));
+    obj.push_back(json_spirit::Pair("p99_ms", ReplayPercentile(vTime, 99)));
+    obj.push_back(json_spirit::Pair("max_ms", ReplayPercentile(vTime, 100)));
+    return obj;
+}
+
+static std::string ReplayStatsToJSON(int nFrom, int nTo, const CReplayStats &stats)
+{
+    double dSeconds = 0.000001 * stats.nTotalTime;
+    json_spirit::Object result, stages;
+    result.push_back(json_spirit::Pair("from", nFrom));
+    result.push_back(json_spirit::Pair("to", nTo));
+    result.push_back(json_spirit::Pair("blocks", (int)stats.vBlockTime.size()));
+    result.push_back(json_spirit::Pair("transactions", (boost::uint64_t)stats.nTx));
+    result.push_back(json_spirit::Pair("inputs", (boost::uint64_t)stats.nInputs));
+    result.push_back(json_spirit::Pair("seconds", dSeconds));
+    result.push_back(json_spirit::Pair("blocks_per_sec", dSeconds > 0 ? stats.vBlockTime.size() / dSeconds : 0));
+    result.push_back(json_spirit::Pair("tx_per_sec", dSeconds > 0 ? stats.nTx / dSeconds : 0));
+    result.push_back(json_spirit::Pair("block", ReplayTimingsToJSON(stats.vBlockTime)));
+    for (int i = 0; i < REPLAY_STAGES; i++)
+        stages.push_back(json_spirit::Pair(GetReplayStageName(i), ReplayTimingsToJSON(stats.vStageTime[i])));
+    result.push_back(json_spirit::Pair("stages", stages));
+    return json_spirit::write_string(json_spirit::Value(result), false);
 }
 
 /** Initialize bitcoin.
@@ -495,6 +561,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (mapArgs.count("-purge"))
 	PurgeDB();
 
+    if (GetBoolArg("-prune", false) && GetBoolArg("-reindex", false))
+        return InitError(_("Prune mode is incompatible with -reindex."));
+
     if (mapArgs.count("-bind")) {
         // when specifying an explicit binding address, you want to listen on it
         // even when -connect or -proxy is specified
@@ -657,12 +726,24 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
     LogPrintf("Using data directory %s\n", strDataDir);
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
+    LogPrintf("Using %s kernels for batched Hash7\n", Hash7LanesImplementation());
     std::ostringstream strErrors;
 
     if (nScriptCheckThreads) {
-        LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+        LogPrintf("Using %u threads for script, header and transaction verification\n", nScriptCheckThreads);
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
+        for (int i=0; i<nScriptCheckThreads; i++)
+            threadGroup.create_thread(&ThreadTxAdmission);
+    }
+
+    int nPrefetchThreads = GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS);
+    if (nPrefetchThreads > 0) {
+        LogPrintf("Using %u threads for block read-ahead\n", nPrefetchThreads);
+        for (int i=0; i<nPrefetchThreads; i++)
+            threadGroup.create_thread(&ThreadPrefetchBlocks);
     }
 
     int64_t nStart;
@@ -964,6 +1045,20 @@ bool AppInit2(boost::thread_group& threadGroup)
         return false;
     }
 
+    if (mapArgs.count("-replaybench"))
+    {
+        int nFrom = 0, nTo = 0;
+        if (sscanf(mapArgs["-replaybench"].c_str(), "%d:%d", &nFrom, &nTo) != 2)
+            return InitError(_("Invalid -replaybench range, expected <from>:<to>"));
+        CReplayStats stats;
+        if (!ReplayBlocks(nFrom, nTo, stats))
+            return InitError(_("Block replay failed, see debug.log"));
+        std::string strJSON = ReplayStatsToJSON(nFrom, nTo, stats);
+        LogPrintf("replaybench: %s\n", strJSON);
+        fprintf(stdout, "%s\n", strJSON.c_str());
+        return false;
+    }
+
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
     if (fDisableWallet) {
@@ -1092,6 +1187,11 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
+    threadGroup.create_thread(&ThreadFlushBlockFiles);
+
+    if (GetBoolArg("-prune", false))
+        threadGroup.create_thread(&ThreadPruneBlockFiles);
+
     // ********************************************************* Step 10: load peers
 
     uiInterface.InitMessage(_("Loading addresses..."));
@@ -3,8 +3,14 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "bitcoin-config.h"
+#endif
+
 #include "key.h"
 
+#include "ecrecover.h"
+
 #include <openssl/bn.h>
 #include <openssl/ecdsa.h>
 #include <openssl/obj_mac.h>
@@ -447,6 +453,21 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const unsigned char* vchSig) {
+#ifdef USE_NATIVE_ECRECOVER
+    if(vchSig[0] >= 8)
+	return false;
+    unsigned char pubkey[65];
+    unsigned int nSize;
+    if (!ECRecover((const unsigned char*)&hash, &vchSig[1], (vchSig[0]) & ~4, (vchSig[0]) & 4, pubkey, nSize))
+        return false;
+    Set(&pubkey[0], &pubkey[nSize]);
+    return true;
+#else
+    return RecoverCompactOpenSSL(hash, vchSig);
+#endif
+}
+
+bool CPubKey::RecoverCompactOpenSSL(const uint256 &hash, const unsigned char* vchSig) {
     CECKey key;
     if(vchSig[0] >= 8)
 	return false;
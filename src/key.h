@@ -163,6 +163,9 @@ public:
     // Recover a public key from a compact signature.
     bool RecoverCompact(const uint256 &hash, const unsigned char* vchSig);
 
+    // Same as RecoverCompact, but always through OpenSSL. Reference for the native recovery.
+    bool RecoverCompactOpenSSL(const uint256 &hash, const unsigned char* vchSig);
+
     // Turn this public key into an uncompressed public key.
     bool Decompress();
 
@@ -20,6 +20,7 @@
 
 #include <sys/types.h>
 #include <sstream>
+#include <cmath>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -56,6 +57,7 @@ int64_t nTimeBestReceived = 0;
 int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
+bool fMempoolLoaded = false;
 bool fBenchmark = false;
 bool fLoading = false;
 bool fTxIndex = true;
@@ -609,14 +611,12 @@ double GetPriority(vector<CTxIn> vtxin){
     return dPriority;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee)
+// The checks of AcceptToMemoryPool that depend only on the transaction, the block
+// index and the signature cache. They need no cs_main, so the admission threads
+// run them before taking it.
+static bool PreAcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx,
+                                  bool fRejectInsaneFee)
 {
-    //assert(0);
-
-    if (pfMissingInputs)
-        *pfMissingInputs = false;
-
     if (!CheckTransaction(tx, state))
         return error("AcceptToMemoryPool: : CheckTransaction failed");
 
@@ -625,18 +625,67 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         return state.DoS(100, error("AcceptToMemoryPool: : coinbase as individual tx"),
                          REJECT_INVALID, "coinbase");
 
+    // Check both memory pool and tx index for this tx, without reading it from disk
+    uint256 hash = tx.GetTxID();
+    //No DoS here because node propagation regularly causes dups
+    if (pool.exists(hash) || TxExists(hash))
+        return state.Invalid(error("AcceptToMemoryPool: : transaction already exists"),
+			REJECT_DUPLICATE, "exists");
+
+    int64_t nValueIn = tx.GetValueIn();
+    int64_t nValueOut = tx.GetValueOut();
+    int64_t nFees = nValueIn-nValueOut;
+
+    // Note: if you modify this code to accept non-standard transactions, then
+    // you should add code here to check that the transaction does a
+    // reasonable number of ECDSA signature verifications.
+
+    //allow no output as part of 100% fee tx for pruning
+    if(nValueIn == 0){
+        return state.DoS(100, error("AcceptToMemoryPool : no inputs/outputs %s",
+                                  hash.ToString()),
+                         REJECT_INSUFFICIENTFEE, "no i/o");
+    }
+
+    if(nValueOut==0 && !tx.fSetLimit && (tx.vout.size() > 1 || (tx.vout.size() == 1 && tx.vout[0].pubKey != 0))){
+        return state.DoS(100, error("AcceptToMemoryPool : destruction transaction not to coinbase %s",
+                                  hash.ToString()),
+                         REJECT_INSUFFICIENTFEE, "bad destroy");
+    }
+
+    if(nValueIn < nValueOut){
+        return state.DoS(100, error("AcceptToMemoryPool : input less than output %s",
+                                  hash.ToString()),
+                         REJECT_INSUFFICIENTFEE, "neg fee");
+    }
+
+    if (fRejectInsaneFee && nFees > CTransaction::nMinRelayTxFee * 10000)
+        return error("AcceptToMemoryPool: : insane fees %s, %d > %d",
+                     hash.ToString(),
+                     nFees, CTransaction::nMinRelayTxFee * 10000);
+
+    // Check the signatures
+    // The recovered keys are cached for when the transaction is mined or connected.
+    if (!CheckInputs(tx, state, NULL, true))
+        return error("AcceptToMemoryPool: : CheckInputs failed %s", hash.ToString());
+
+    return true;
+}
+
+// The rest of AcceptToMemoryPool, against the trie and the pool, under cs_main.
+// The transaction must have passed PreAcceptToMemoryPool.
+static bool AcceptPreCheckedToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx,
+                                         bool fLimitFree, int64_t nAcceptTime)
+{
     // Reject non final tx
     if (!IsFinalTx(tx,chainActive.Height()+5)) //Fudge time to stop height skew problems
         return state.Invalid(error("AcceptToMemoryPool: : transaction not final"),
                          REJECT_INVALID, "final");
 
-
-    // Check both memory pool and view for this tx    
+    // Another thread may have admitted it since the check without locks. A block
+    // connected since then is caught by the miner and the pool cleanup instead.
     uint256 hash = tx.GetTxID();
-    CTransaction txout;
-    uint256 blockhash;
-    //No DoS here because node propagation regularly causes dups
-    if (GetTransaction(hash,txout,blockhash))
+    if (pool.exists(hash))
         return state.Invalid(error("AcceptToMemoryPool: : transaction already exists"),
 			REJECT_DUPLICATE, "exists");
 
@@ -679,33 +728,10 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 		}
 	}
 
-        // Note: if you modify this code to accept non-standard transactions, then
-        // you should add code here to check that the transaction does a
-        // reasonable number of ECDSA signature verifications.
-
-  	//allow no output as part of 100% fee tx for pruning
-	if(nValueIn == 0){
-            return state.DoS(100, error("AcceptToMemoryPool : no inputs/outputs %s",
-                                      hash.ToString()),
-                             REJECT_INSUFFICIENTFEE, "no i/o");	
-	}
-
-	if(nValueOut==0 && !tx.fSetLimit && (tx.vout.size() > 1 || (tx.vout.size() == 1 && tx.vout[0].pubKey != 0))){
-            return state.DoS(100, error("AcceptToMemoryPool : destruction transaction not to coinbase %s",
-                                      hash.ToString()),
-                             REJECT_INSUFFICIENTFEE, "bad destroy");	
-	}
-
-	if(nValueIn < nValueOut){
-            return state.DoS(100, error("AcceptToMemoryPool : input less than output %s",
-                                      hash.ToString()),
-                             REJECT_INSUFFICIENTFEE, "neg fee");	
-	}
-
 	//TODO: fixme!!!!
         double dPriority = GetPriority(tx.vin);
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime ? nAcceptTime : GetTime(), dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
     	// Size check
@@ -716,6 +742,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                       hash.ToString(), nFees, txMinFee),
                              REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+        // Raised above the relay fee while the pool is full, see CTxMemPool::TrimToSize
+        int64_t nPoolMinFee = pool.GetMinFeePerK() * nSize / 1000;
+        if (nFees < nPoolMinFee && nValueOut != 0)
+            return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nFees, nPoolMinFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
 
         // Continuously rate-limit free transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
@@ -741,17 +774,6 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             dFreeCount += nSize;
         }
 
-        if (fRejectInsaneFee && nFees > CTransaction::nMinRelayTxFee * 10000)
-            return error("AcceptToMemoryPool: : insane fees %s, %d > %d",
-                         hash.ToString(),
-                         nFees, CTransaction::nMinRelayTxFee * 10000);
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state))
-        {
-            return error("AcceptToMemoryPool: : CheckInputs failed %s", hash.ToString());
-        }
-
 	//Only allow a small number of withdrawal limit update transactions in the pool as these are effectively rate limited
 	if(tx.fSetLimit && pool.numLimits(tx.vin[0].pubKey) > (int64_t)(MIN_HISTORY / MIN_LIMIT_TIME)){
             return error("AcceptToMemoryPool: : Too many limit updates %s", hash.ToString());
@@ -759,6 +781,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // Keep the pool within -maxmempool, this transaction may be the one evicted
+        pool.Expire(GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, error("AcceptToMemoryPool : mempool full %s", hash.ToString()),
+                             REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     g_signals.SyncTransaction(hash, tx, NULL);
@@ -766,11 +795,128 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectInsaneFee, int64_t nAcceptTime)
+{
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    return PreAcceptToMemoryPool(pool, state, tx, fRejectInsaneFee) &&
+           AcceptPreCheckedToMemoryPool(pool, state, tx, fLimitFree, nAcceptTime);
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+// Transactions LoadMempool admits for each time it takes cs_main
+static const unsigned int MEMPOOL_LOAD_BATCH = 100;
+// Only one dump writes mempool.dat.new at a time
+static CCriticalSection cs_dumpmempool;
+
+bool DumpMempool()
+{
+    LOCK(cs_dumpmempool);
+    int64_t nStart = GetTimeMillis();
+
+    vector<CTxMemPoolEntry> vEntries;
+    {
+        LOCK(mempool.cs);
+        vEntries.reserve(mempool.mapTx.size());
+        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+            vEntries.push_back(mi->second);
+    }
+
+    // Write to a temporary file first so a crash never leaves a truncated mempool.dat
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("DumpMempool() : open failed");
+
+    try {
+        fileout << MEMPOOL_DUMP_VERSION;
+        fileout << (uint64_t)vEntries.size();
+        BOOST_FOREACH(const CTxMemPoolEntry &entry, vEntries) {
+            fileout << entry.GetTx();
+            fileout << entry.GetFee();
+            fileout << entry.GetTime();
+        }
+    }
+    catch (std::exception &e) {
+        return error("DumpMempool() : I/O error %s", e.what());
+    }
+    FileCommit(fileout);
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, pathMempool))
+        return error("DumpMempool() : Rename-into-place failed");
+
+    LogPrintf("Dumped %u mempool transactions  %dms\n", vEntries.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool LoadMempool()
+{
+    FILE *file = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!filein) {
+        LogPrintf("No mempool.dat to load\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nExpiryTime = GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    unsigned int nAccepted = 0, nFailed = 0, nExpired = 0;
+    try {
+        uint64_t nVersion, nEntries;
+        filein >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("LoadMempool() : unknown version %u", nVersion);
+        filein >> nEntries;
+
+        while (nEntries > 0) {
+            boost::this_thread::interruption_point();
+            if (ShutdownRequested())
+                break;
+
+            // Read a batch without locks, then admit it in one go so cs_main is
+            // only held briefly while the node is already running
+            vector<pair<CTransaction, int64_t> > vBatch;
+            for (; nEntries > 0 && vBatch.size() < MEMPOOL_LOAD_BATCH; nEntries--) {
+                CTransaction tx;
+                int64_t nFee, nTime;
+                filein >> tx >> nFee >> nTime;
+                // The fee is recomputed on admission, it is only kept for inspecting the file
+                if (nTime < nExpiryTime) {
+                    nExpired++;
+                    continue;
+                }
+                vBatch.push_back(make_pair(tx, nTime));
+            }
+
+            LOCK(cs_main);
+            for (unsigned int i = 0; i < vBatch.size(); i++) {
+                CValidationState state;
+                if (AcceptToMemoryPool(mempool, state, vBatch[i].first, false, NULL, false, vBatch[i].second))
+                    nAccepted++;
+                else
+                    nFailed++;
+            }
+        }
+    }
+    catch (std::exception &e) {
+        return error("LoadMempool() : I/O error %s", e.what());
+    }
+
+    LogPrintf("Loaded %u mempool transactions (%u failed, %u expired)  %dms\n",
+              nAccepted, nFailed, nExpired, GetTimeMillis() - nStart);
+    return true;
+}
+
 CBlockIndex* GetTxBlock(uint256 txid){
     uint256 hashBlock;
 
     CDiskTxPos postx;
-    if(!pblocktree->ReadTxIndex(txid, postx)) 
+    if(!blockCache.ReadTxIndex(txid, postx)) 
 	return NULL;
 
     hashBlock = postx.hashBlock;
@@ -779,7 +925,7 @@ CBlockIndex* GetTxBlock(uint256 txid){
 
 bool TxExists(uint256 txid){
        CDiskTxPos postx;
-       return pblocktree->ReadTxIndex(txid, postx); 
+       return blockCache.ReadTxIndex(txid, postx); 
 }
 
 int64_t GetDepthInMainChain(uint256 txid){
@@ -817,7 +963,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     if (fTxIndex) {
        //printf("Lookup: %s\n", hash.GetHex().c_str());
        CDiskTxPos postx;
-       if (pblocktree->ReadTxIndex(hash, postx)) {
+       if (blockCache.ReadTxIndex(hash, postx)) {
            hashBlock = postx.hashBlock;
 	   if(!blockCache.ReadTxFromDisk(txOut,postx))
                return error("%s : Deserialize or I/O error ", __PRETTY_FUNCTION__);
@@ -839,39 +985,15 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 // CBlock and CBlockIndex
 //
 
-void mpz_set_uii(mpz_t &mpz, uint64_t v){
-    mpz_import(mpz, 1, -1, sizeof(uint64_t), -1, 0, &v);
-}
-
-uint64_t mpz_get_uii(mpz_t &mpz){
-    uint64_t v[16];
-    mpz_export(v, 0, -1, sizeof(uint64_t), -1, 0, mpz);
-    return v[0];
-}
-
 int64_t GetBlockValue(uint64_t coinbase, uint64_t nFees)
 {
-    mpz_t mcb,mquot,t;
-    mpz_init(mcb);
-    mpz_init(mquot);
-    mpz_init(t);
- 
     //Setup so half of coinbase distributed in ~10 years
-    mpz_set_uii(mcb,coinbase);
-    mpz_set_uii(t,243*COIN+10*CENT);
-    mpz_mul(mcb,mcb,t);
-    mpz_set_uii(t,MAX_MONEY);
-    mpz_div(mquot,mcb,t);
-
-    uint64_t value = mpz_get_uii(mquot);
+    //coinbase * (243.1 COIN) needs ~105 bits, so 256 bits can never overflow
+    uint256 value = coinbase;
+    value *= uint256(243*COIN+10*CENT);
+    value /= uint256(MAX_MONEY);
 
-    //cout << __func__ << ": " << coinbase << ", " << nFees << ", " << value << ", " <<  (24310*COIN) << ", " <<  MAX_MONEY << ", " << sizeof(mp_limb_t) << "\n";
-
-    mpz_clear(mcb);
-    mpz_clear(mquot);
-    mpz_clear(t);
-
-    return value + nFees;
+    return value.GetLow64() + nFees;
 }
 
 static const int64_t nTargetTimespan = 1 * 60 * 60 * 24; // 1 day
@@ -985,36 +1107,63 @@ uint64_t GetNextMaxSize(const CBlockIndex* pindexLast){
      return v > MAX_BLOCK_SIZE ? v : MAX_BLOCK_SIZE;
 }
 
-uint256 GetTargetWork(double nBits){
+// Convert an integral double to a 512 bit integer, truncating the same way
+// mpz_set_d does. Anything that doesn't fit saturates to all ones.
+static uint512 Uint512FromDouble(double d)
+{
+    uint512 ret = 0;
+    if (!(d >= 1.0))
+        return ret;
+    if (std::isinf(d))
+        return ~ret;
+
+    int nExp;
+    double dMantissa = frexp(d, &nExp); // d = dMantissa * 2^nExp, 0.5 <= dMantissa < 1
+    if (nExp > 512)
+        return ~ret;
+
+    ret = (uint64_t)ldexp(dMantissa, 53);
+    if (nExp >= 53)
+        ret <<= nExp - 53;
+    else
+        ret >>= 53 - nExp;
+    return ret;
+}
 
-    CBigNum bnTarget = Params().ProofOfWorkLimit();
-    uint256 target = bnTarget.getuint256();
+// Targets are requested over and over for the same difficulty (header sync,
+// CheckBlockHeader, AcceptBlockHeader, the miner and getwork), so keep them.
+static const unsigned int MAX_TARGET_CACHE = 4096;
+static CCriticalSection cs_targetcache;
+static map<double, uint256> mapTargetCache;
 
-    //printf("Target: %s\n", target.GetHex().c_str());
+uint256 GetTargetWork(double nBits){
 
     assert(nBits>=1.0);
-    nBits *= (1LL<<52); //Weird shift
-   
-    mpz_t mbits,mtarget,t;
-    mpz_init(mbits);
-    mpz_init(mtarget);
-    mpz_init(t);
 
-    mpz_set_d(mbits,nBits);
-    mpz_set_uint256(mtarget,target);
-    mpz_set_uii(t,(1LL<<52));
-    mpz_mul(mtarget,mtarget,t);
-    //gmp_printf ("%Zx\n", mtarget);
+    {
+        LOCK(cs_targetcache);
+        map<double, uint256>::const_iterator it = mapTargetCache.find(nBits);
+        if (it != mapTargetCache.end())
+            return it->second;
+    }
+
+    CBigNum bnTarget = Params().ProofOfWorkLimit();
+    uint256 target = bnTarget.getuint256();
 
-    
-    mpz_div(mtarget,mtarget,mbits);
+    //target * 2^52 / (nBits * 2^52), the numerator is at most 308 bits
+    uint512 mtarget = 0;
+    memcpy(mtarget.begin(), target.begin(), target.size());
+    mtarget <<= 52;
+    mtarget /= Uint512FromDouble(nBits * (1LL<<52)); //Weird shift
 
-    //gmp_printf ("%Zx %Zx\n", mtarget, mbits);
+    memcpy(target.begin(), mtarget.begin(), target.size());
 
-    mpz_get_uint256(mtarget,target);
-    mpz_clear(mbits);
-    mpz_clear(mtarget);
-    mpz_clear(t);
+    {
+        LOCK(cs_targetcache);
+        if (mapTargetCache.size() >= MAX_TARGET_CACHE)
+            mapTargetCache.clear();
+        mapTargetCache[nBits] = target;
+    }
 
     //printf("HashCPOW: %s %f\n", target.GetHex().c_str(), nBits);
     return target;
@@ -1198,7 +1347,7 @@ void Misbehaving(NodeId pnode, int howmuch)
 void InvalidBlockFound(CBlockIndex *pindex) {
     // Mark pindex as invalid.
     pindex->nStatus |= BLOCK_FAILED_VALID;
-    pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex));
+    blockCache.WriteBlockIndex(pindex);
     LogPrintf("Marked %s as invalid\n", pindex->GetBlockHash().ToString().c_str());
     setBlockIndexValid.erase(pindex);
 
@@ -1243,18 +1392,17 @@ uint256 UpdateTime(CBlockHeader& block, const CBlockIndex* pindexPrev)
 }
 
 bool CScriptCheck::operator()() const {
-    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, pubKey, *ptxTo, nIn))
+    if (!VerifyInputSignature(ptxTo->vin[nIn], hashSig, fCacheStore))
         return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString());
     return true;
 }
 
 bool VerifySignature(const uint160 &pubKey, const CTransaction& txTo, unsigned int nIn)
 {
-    return CScriptCheck(pubKey, txTo, nIn)();
+    return VerifyScript(txTo.vin[nIn].scriptSig, pubKey, txTo, nIn);
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, std::vector<CScriptCheck> *pvChecks, bool fCacheStore)
 {
     //printf("Check inputs\n");
     if (!tx.IsCoinBase())
@@ -1262,10 +1410,25 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state)
 	//Don't need to check input balances here because accept to mempool does it using
 	//Trie and connectblock also does it with Trie
 
+        // The signature hash covers the whole transaction, so it is the same for every input
+        const uint256 &hashSig = tx.GetTxID();
+
+        if (pvChecks)
+            pvChecks->reserve(tx.vin.size());
+
+        // An input is valid iff its signatures match its own key, so inputs repeating the
+        // key and signatures of an earlier one need no second check
+        std::set<std::pair<uint160, CScript> > setChecked;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            if (!setChecked.insert(std::make_pair(tx.vin[i].pubKey, tx.vin[i].scriptSig)).second)
+                continue;
+
             // Verify signature
-            CScriptCheck check(tx.vin[i].pubKey, tx, i);
-            if (!check()) {
+            CScriptCheck check(hashSig, tx, i, fCacheStore);
+            if (pvChecks) {
+                pvChecks->push_back(CScriptCheck());
+                check.swap(pvChecks->back());
+            } else if (!check()) {
                 return state.DoS(100,false, REJECT_NONSTANDARD, "non-canonical");
             }
         }
@@ -1276,6 +1439,16 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state)
 
 
 
+void PrecheckBlockSignatures(const CBlock& block)
+{
+    // Results only go to the signature cache, failures are reported by ConnectBlock
+    CValidationState state;
+    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        boost::this_thread::interruption_point();
+        CheckInputs(tx, state, NULL, true);
+    }
+}
+
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex)
 {
     assert(pindex->GetBlockHash() == chainActive.Tip()->GetBlockHash());
@@ -1283,10 +1456,11 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     pindex->fConnected = false;
 
     //modify txindex
-    BOOST_FOREACH(CTransaction tx, block.vtx){
-	if(!pblocktree->EraseTxIndex(tx.GetTxID())){
-	    LogPrintf("DisconnectBlock: Horrible terrible thing happened\n");
-	}
+    vector<uint256> vErase;
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+	vErase.push_back(tx.GetTxID());
+    if(!blockCache.EraseTxIndex(vErase)){
+	LogPrintf("DisconnectBlock: Horrible terrible thing happened\n");
     }
 
     //About to become an orphan
@@ -1326,6 +1500,161 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Closure representing the context free part of a header check: the
+ *  Hash7 and the minimum proof of work of up to eight consecutive headers,
+ *  hashed side by side when there are eight. Results go to the given slots.
+ *  A failure stops the queue, checks not run yet leave their headers not ok.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlock *pblocks;
+    unsigned int nCount;
+    uint256 *phash;
+    char *pfOk;
+
+public:
+    CHeaderCheck() : pblocks(NULL), nCount(0), phash(NULL), pfOk(NULL) {}
+    CHeaderCheck(const CBlock *pblocksIn, unsigned int nCountIn, uint256 *phashIn, char *pfOkIn) :
+        pblocks(pblocksIn), nCount(nCountIn), phash(phashIn), pfOk(pfOkIn) {}
+
+    bool operator()() {
+        if (nCount == 8) {
+            const CBlockHeader *pheaders[8];
+            for (unsigned int i = 0; i < 8; i++)
+                pheaders[i] = &pblocks[i];
+            CBlockHeader::GetHashes(pheaders, phash);
+        } else {
+            for (unsigned int i = 0; i < nCount; i++)
+                phash[i] = pblocks[i].GetHash();
+        }
+        bool fOk = true;
+        for (unsigned int i = 0; i < nCount; i++)
+            fOk &= (pfOk[i] = CheckProofOfWork(phash[i], 1.0));
+        return fOk;
+    }
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pblocks, check.pblocks);
+        std::swap(nCount, check.nCount);
+        std::swap(phash, check.phash);
+        std::swap(pfOk, check.pfOk);
+    }
+};
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(8);
+
+void ThreadHeaderCheck() {
+    RenameThread("feedbackcoin-headerch");
+    headercheckqueue.Thread();
+}
+
+// Admit a transaction received from pfrom to the memory pool, relaying or rejecting it.
+// The checks that need no locks, including the signatures, run before taking cs_main.
+static void AdmitTransaction(const CTransaction &tx, CNode *pfrom)
+{
+    CInv inv(MSG_TX, tx.GetTxID());
+    CValidationState state;
+    bool fPreChecked = PreAcceptToMemoryPool(mempool, state, tx, false);
+
+    LOCK(cs_main);
+    if (fPreChecked && AcceptPreCheckedToMemoryPool(mempool, state, tx, true, 0))
+    {
+        RelayTransaction(tx, inv.hash);
+        mapAlreadyAskedFor.erase(inv);
+
+        LogPrint("mempool", "AcceptToMemoryPool: %s %s : accepted %s (poolsz %" PRIszu ")\n",
+           pfrom->addr.ToString(), pfrom->cleanSubVer,
+           tx.GetTxID().ToString(),
+           mempool.mapTx.size());
+    }
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempool", "%s from %s %s was not accepted into the memory pool: %s\n", tx.GetTxID().ToString(),
+          pfrom->addr.ToString(), pfrom->cleanSubVer,
+          state.GetRejectReason());
+        pfrom->PushMessage("reject", string("tx"), state.GetRejectCode(),
+                       state.GetRejectReason(), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+/** Transactions received from peers, waiting for the admission threads. The
+ *  message handler only deserializes them; the context free checks, the
+ *  duplicate check and the signature recovery run on the admission threads
+ *  without locks, and only the pool recheck, the balance checks and the insert
+ *  are serialized by cs_main.
+ */
+class CTxAdmissionQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    std::deque<std::pair<CTransaction, CNode*> > queue;
+    unsigned int nMaxSize;
+
+public:
+    CTxAdmissionQueue(unsigned int nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+    // Returns false and drops the transaction when the queue is full, so a flood
+    // neither grows the queue without bound nor stalls the message handler
+    bool Push(const CTransaction &tx, CNode *pfrom) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (queue.size() >= nMaxSize)
+            return false;
+        queue.push_back(std::make_pair(tx, pfrom->AddRef()));
+        condWorker.notify_one();
+        return true;
+    }
+
+    void Thread() {
+        while (true) {
+            std::pair<CTransaction, CNode*> item;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty())
+                    condWorker.wait(lock);
+                item = queue.front();
+                queue.pop_front();
+            }
+            AdmitTransaction(item.first, item.second);
+            item.second->Release();
+        }
+    }
+};
+
+static CTxAdmissionQueue txadmissionqueue(1000);
+
+void ThreadTxAdmission() {
+    RenameThread("feedbackcoin-txadmit");
+    txadmissionqueue.Thread();
+}
+
+// Hash and check the minimum proof of work of a batch of headers on the
+// header check threads. Needs no locks, vHash and vfOk are resized to match.
+static void CheckHeaders(const std::vector<CBlock> &vBlocks, std::vector<uint256> &vHash, std::vector<char> &vfOk)
+{
+    vHash.assign(vBlocks.size(), 0);
+    vfOk.assign(vBlocks.size(), 0);
+    CCheckQueueControl<CHeaderCheck> control(nScriptCheckThreads ? &headercheckqueue : NULL);
+    std::vector<CHeaderCheck> vChecks;
+    vChecks.reserve((vBlocks.size() + 7) / 8);
+    for (unsigned int i = 0; i < vBlocks.size(); i += 8) {
+        unsigned int nCount = std::min((unsigned int)vBlocks.size() - i, 8u);
+        CHeaderCheck check(&vBlocks[i], nCount, &vHash[i], &vfOk[i]);
+        if (nScriptCheckThreads) {
+            vChecks.push_back(CHeaderCheck());
+            check.swap(vChecks.back());
+        } else
+            check();
+    }
+    control.Add(vChecks);
+    control.Wait();
+}
+
 bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex,bool fJustCheck)
 {
     //printf("ConnectBlock %d %d\n", fJustCheck, fTxIndex);
@@ -1359,6 +1688,10 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex,bo
 
 #endif
 
+    //ECDSA check on startup takes forever!
+    bool fScriptChecks = !fLoading;
+    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+
     int64_t nStart = GetTimeMicros();
     int64_t nFees = 0;
     int nInputs = 0;
@@ -1381,11 +1714,12 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex,bo
 
             nFees += tx.GetFee();
 
-	    //ECDSA check on startup takes forever!
-            if (!fLoading && !CheckInputs(tx, state)){
+            std::vector<CScriptCheck> vChecks;
+            if (fScriptChecks && !CheckInputs(tx, state, nScriptCheckThreads ? &vChecks : NULL)){
                 return state.DoS(100, error("ConnectBlock() : inputs nonstandard"),
                                  REJECT_INVALID, "bad-txns-inputs-missingorspent");
 	    }
+            control.Add(vChecks);
 
 	    if(!fLoading && TxExists(tx.GetTxID())){
                 return state.DoS(100, error("ConnectBlock() : tx duplicate"),
@@ -1406,6 +1740,9 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex,bo
     if (fBenchmark)
         LogPrintf("- Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin)\n", (unsigned)block.vtx.size(), 0.001 * nTime, 0.001 * nTime / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * nTime / (nInputs-1));
 
+    if (!control.Wait())
+        return state.DoS(100, error("ConnectBlock() : inputs nonstandard"),
+                         REJECT_INVALID, "bad-txns-inputs-missingorspent");
     int64_t nTime2 = GetTimeMicros() - nStart;
     if (fBenchmark)
         LogPrintf("- Verify %u txins: %.2fms (%.3fms/txin)\n", nInputs - 1, 0.001 * nTime2, nInputs <= 1 ? 0 : 0.001 * nTime2 / (nInputs-1));
@@ -1414,7 +1751,7 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex,bo
         return true;
 
     if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+        if (!blockCache.WriteTxIndex(vPos))
             return state.Abort(_("Failed to write transaction index"));
 
     // Watch for transactions paying to me
@@ -1435,6 +1772,165 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex,bo
     return true;
 }
 
+const char *GetReplayStageName(int nStage)
+{
+    static const char *pszNames[REPLAY_STAGES] = {
+        "read", "deserialize", "merkle", "signatures", "tempapply", "triehash", "undowrite", "indexwrite"
+    };
+    return pszNames[nStage];
+}
+
+// Read the serialized bytes of a block, the size is stored just before it
+static bool ReadRawBlock(const CDiskBlockPos &pos, CDataStream &ss)
+{
+    if (pos.nPos < 4)
+        return error("ReadRawBlock() : bad block position");
+    CAutoFile filein = CAutoFile(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReadRawBlock() : OpenBlockFile failed");
+    try {
+        unsigned int nSize;
+        filein >> nSize;
+        if (nSize > MAX_SIZE)
+            return error("ReadRawBlock() : block too large");
+        ss.resize(nSize);
+        filein.read(&ss[0], nSize);
+    }
+    catch (std::exception &e) {
+        return error("%s : I/O error - %s", __PRETTY_FUNCTION__, e.what());
+    }
+    return true;
+}
+
+bool ReplayBlocks(int nFrom, int nTo, CReplayStats &stats)
+{
+    LOCK(cs_main);
+    if (nFrom < 1 || nFrom > nTo || nTo > chainActive.Height())
+        return error("ReplayBlocks() : range %d:%d outside of the active chain (1:%d)", nFrom, nTo, chainActive.Height());
+
+    // The index entries rewritten below go straight to the database, so nothing
+    // queued for the same blocks may be left to overtake them
+    if (!blockCache.Sync())
+        return error("ReplayBlocks() : could not sync queued index writes");
+
+    // Rewind the trie to the snapshot the range starts from
+    uint256 hashTrie = pviewTip->GetBestBlock();
+    uint256 badBlock;
+    if (!pviewTip->Activate(chainActive[nFrom - 1], badBlock))
+        return error("ReplayBlocks() : could not move the trie to height %d", nFrom - 1);
+
+    // Undo data goes to a scratch file so the rev files are left alone
+    boost::filesystem::path pathScratch = GetDataDir() / "replaybench.tmp";
+    CAutoFile fileUndo = CAutoFile(fopen(pathScratch.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (!fileUndo)
+        return error("ReplayBlocks() : could not open %s", pathScratch.string());
+
+    bool fOk = true;
+    int64_t nStartAll = GetTimeMicros();
+    for (int nHeight = nFrom; nHeight <= nTo && fOk; nHeight++) {
+        boost::this_thread::interruption_point();
+        CBlockIndex *pindex = chainActive[nHeight];
+        int64_t nTime[REPLAY_STAGES];
+        int64_t nStart = GetTimeMicros();
+
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        if (!ReadRawBlock(pindex->GetBlockPos(), ss)) {
+            fOk = false;
+            break;
+        }
+        nTime[REPLAY_READ] = GetTimeMicros() - nStart;
+
+        nStart = GetTimeMicros();
+        CBlock block;
+        try {
+            ss >> block;
+        }
+        catch (std::exception &e) {
+            fOk = error("ReplayBlocks() : deserialize error at height %d - %s", nHeight, e.what());
+            break;
+        }
+        nTime[REPLAY_DESERIALIZE] = GetTimeMicros() - nStart;
+
+        nStart = GetTimeMicros();
+        if (block.BuildMerkleTree() != block.hashMerkleRoot) {
+            fOk = error("ReplayBlocks() : hashMerkleRoot mismatch at height %d", nHeight);
+            break;
+        }
+        nTime[REPLAY_MERKLE] = GetTimeMicros() - nStart;
+
+        nStart = GetTimeMicros();
+        BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+            stats.nInputs += tx.vin.size();
+            CValidationState state;
+            if (!tx.IsCoinBase() && !CheckInputs(tx, state)) {
+                fOk = error("ReplayBlocks() : signature check failed at height %d", nHeight);
+                break;
+            }
+        }
+        if (!fOk)
+            break;
+        nTime[REPLAY_SIGNATURES] = GetTimeMicros() - nStart;
+
+        list<CTxUndo> undos;
+        if (!pviewTip->ReplayBlock(block, pindex, undos, nTime[REPLAY_TEMPAPPLY], nTime[REPLAY_TRIEHASH])) {
+            fOk = false;
+            break;
+        }
+
+        // Encode, checksum and write the undo data the way WriteUndoToDisk does
+        nStart = GetTimeMicros();
+        CBlockUndo blockundo;
+        blockundo.vtxundo.assign(undos.begin(), undos.end());
+        CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+        ssUndo << blockundo;
+        unsigned int nSize = ssUndo.size();
+        fileUndo << FLATDATA(Params().MessageStart()) << nSize;
+        fileUndo.write(&ssUndo[0], nSize);
+        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+        hasher << pindex->GetBlockHash();
+        hasher.write(&ssUndo[0], nSize);
+        fileUndo << hasher.GetHash();
+        fflush(fileUndo);
+        nTime[REPLAY_UNDOWRITE] = GetTimeMicros() - nStart;
+
+        // Rewrite the block's own index entries, which leaves them unchanged
+        nStart = GetTimeMicros();
+        if (fTxIndex) {
+            CDiskTxPos pos(pindex->GetBlockPos(), 0, pindex->GetBlockHash());
+            std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+            vPos.reserve(block.vtx.size());
+            for (unsigned int i = 0; i < block.vtx.size(); i++) {
+                pos.nTxOffset = i;
+                vPos.push_back(std::make_pair(block.vtx[i].GetTxID(), pos));
+            }
+            fOk = pblocktree->WriteTxIndex(vPos);
+        }
+        fOk = fOk && pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex));
+        if (!fOk) {
+            error("ReplayBlocks() : index write failed at height %d", nHeight);
+            break;
+        }
+        nTime[REPLAY_INDEXWRITE] = GetTimeMicros() - nStart;
+
+        int64_t nBlockTime = 0;
+        for (int i = 0; i < REPLAY_STAGES; i++) {
+            stats.vStageTime[i].push_back(nTime[i]);
+            nBlockTime += nTime[i];
+        }
+        stats.vBlockTime.push_back(nBlockTime);
+        stats.nTx += block.vtx.size();
+    }
+    stats.nTotalTime = GetTimeMicros() - nStartAll;
+
+    fileUndo.fclose();
+    boost::filesystem::remove(pathScratch);
+
+    // Put the trie back where it was
+    if (mapBlockIndex.count(hashTrie) && !pviewTip->Activate(mapBlockIndex[hashTrie], badBlock))
+        return error("ReplayBlocks() : could not restore the trie to %s", hashTrie.GetHex());
+    return fOk;
+}
+
 // Update the on-disk chain state.
 bool static WriteChainState(CValidationState &state) {
     static int64_t nLastWrite = 0;
@@ -1592,8 +2088,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew) {
     if(pindexSyncPoint && (pindexSyncPoint->nHeight + (int64_t)MIN_HISTORY) < pindexNew->nHeight && pindexNew->nHeight > (int64_t)MIN_HISTORY){
 	//write crap into blockdb
 	pindexSyncPoint=chainActive[pindexNew->nHeight-MIN_HISTORY];
-	pblocktree->WriteSyncPoint(pindexSyncPoint->GetBlockHash());
-	pblocktree->Flush();
+	blockCache.WriteSyncPoint(pindexSyncPoint->GetBlockHash());
     }
 
     mapBlockByHeight[pindexNew->nHeight] = pindexNew;
@@ -1611,9 +2106,18 @@ static bool ActivateBestChainStep(CValidationState &state) {
     if (chainHeaders.Tip() == NULL)
         return true;
 
+    int nPrefetch = blockCache.PrefetchWindow();
+
     //First unwind the active chain
     CBlockIndex *pindexFork = chainHeaders.FindFork(chainActive.Tip());
+    CBlockIndex *pindexPrefetch = chainActive.Tip();
+    for(int i = 0; i < nPrefetch && pindexPrefetch && pindexPrefetch != pindexFork; i++, pindexPrefetch = pindexPrefetch->pprev)
+	blockCache.Prefetch(pindexPrefetch);
     while(chainActive.Tip() != pindexFork){
+	if(pindexPrefetch && pindexPrefetch != pindexFork){
+	    blockCache.Prefetch(pindexPrefetch);
+	    pindexPrefetch = pindexPrefetch->pprev;
+	}
   	DisconnectTip(state);
     }
 
@@ -1622,7 +2126,14 @@ static bool ActivateBestChainStep(CValidationState &state) {
     //printf("nHeight %d\n", nHeight);
     bool fError=false;
 
+    //Read and signature check ahead of the blocks about to be connected, so the
+    //prefetch threads work on later blocks while this one is connected
+    for(int i = nHeight; i < nHeight + nPrefetch && i <= (int)chainHeaders.Height(); i++)
+	blockCache.Prefetch(chainHeaders[i], false, true);
+
     while (nHeight <= (int)chainHeaders.Height()) {
+        if (nPrefetch && nHeight + nPrefetch <= (int)chainHeaders.Height())
+            blockCache.Prefetch(chainHeaders[nHeight + nPrefetch], false, true);
         CBlockIndex *pindexNew = chainHeaders[nHeight];
 	//printf("pindexNew %p\n", pindexNew);
         if (!(pindexNew->nStatus & BLOCK_HAVE_DATA) ||
@@ -1653,10 +2164,15 @@ static bool ActivateBestChainStep(CValidationState &state) {
 	InvalidBlockFound(mapBlockIndex[badBlock]);
 	return ActivateBestChain(state); //Loop until the pain stops
     }
-    pviewTip->Flush();
+    if(!pviewTip->Flush())
+	return state.Abort(_("Failed to write the trie"));
 
+    //Only transactions touching accounts the trie changed can have become invalid
     vector<CTransaction> conflicts;
-    mempool.validate(conflicts);
+    set<uint160> setChanged;
+    bool fAllChanged;
+    pviewTip->GetChangedAccounts(setChanged, fAllChanged);
+    mempool.validate(conflicts, fAllChanged ? NULL : &setChanged);
 
     // Tell wallet about transactions that went from mempool
     // to conflicted:
@@ -1852,6 +2368,19 @@ bool ActivateBestChain(CValidationState &state) {
     return true;
 }
 
+int64_t GetPruneHeight(){
+    AssertLockHeld(cs_main);
+    //Blocks above the sync point get reconnected on startup, so they have to stay too
+    if(!pindexSyncPoint || chainActive.Height() <= (int64_t)MIN_HISTORY)
+	return -1;
+    return std::min(chainActive.Height() - (int64_t)MIN_HISTORY, pindexSyncPoint->nHeight);
+}
+
+int GetLastBlockFile(){
+    LOCK(cs_LastBlockFile);
+    return nLastBlockFile;
+}
+
 bool ActivateTrie(CValidationState &state){
     bool ret = ActivateBestChain(state);
     // New best?
@@ -1879,7 +2408,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (nLastBlockFile != pos.nFile) {
             nLastBlockFile = pos.nFile;
             infoLastBlockFile.SetNull();
-            pblocktree->ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile);
+            blockCache.ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile);
             fUpdatedLast = true;
         }
     } else {
@@ -1888,7 +2417,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
             FlushBlockFile(true);
             nLastBlockFile++;
             infoLastBlockFile.SetNull();
-            pblocktree->ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile); // check whether data for the new file somehow already exist; can fail just fine
+            blockCache.ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile); // check whether data for the new file somehow already exist; can fail just fine
             fUpdatedLast = true;
         }
         pos.nFile = nLastBlockFile;
@@ -1915,10 +2444,10 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         }
     }
 
-    if (!pblocktree->WriteBlockFileInfo(nLastBlockFile, infoLastBlockFile))
+    if (!blockCache.WriteBlockFileInfo(nLastBlockFile, infoLastBlockFile))
         return state.Abort(_("Failed to write file info"));
     if (fUpdatedLast)
-        pblocktree->WriteLastBlockFile(nLastBlockFile);
+        blockCache.WriteLastBlockFile(nLastBlockFile);
 
     return true;
 }
@@ -1933,15 +2462,15 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     if (nFile == nLastBlockFile) {
         pos.nPos = infoLastBlockFile.nUndoSize;
         nNewSize = (infoLastBlockFile.nUndoSize += nAddSize);
-        if (!pblocktree->WriteBlockFileInfo(nLastBlockFile, infoLastBlockFile))
+        if (!blockCache.WriteBlockFileInfo(nLastBlockFile, infoLastBlockFile))
             return state.Abort(_("Failed to write block info"));
     } else {
         CBlockFileInfo info;
-        if (!pblocktree->ReadBlockFileInfo(nFile, info))
+        if (!blockCache.ReadBlockFileInfo(nFile, info))
             return state.Abort(_("Failed to read block info"));
         pos.nPos = info.nUndoSize;
         nNewSize = (info.nUndoSize += nAddSize);
-        if (!pblocktree->WriteBlockFileInfo(nFile, info))
+        if (!blockCache.WriteBlockFileInfo(nFile, info))
             return state.Abort(_("Failed to write block info"));
     }
 
@@ -2073,16 +2602,15 @@ bool static WriteBlockPosition(CBlockIndex *pindexNew, const CBlock &block, cons
     if ((pindexNew->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS)
         pindexNew->nStatus = (pindexNew->nStatus & ~BLOCK_VALID_MASK) | BLOCK_VALID_TRANSACTIONS;
  
-    return pblocktree->WriteBlockIndex(CDiskBlockIndex(pindexNew));
+    return blockCache.WriteBlockIndex(pindexNew);
  }
 
 
-bool static AcceptBlockHeader(const CBlockHeader &block, CValidationState& state, CBlockIndex* &pindexNew)
+bool static AcceptBlockHeader(const CBlockHeader &block, const uint256 &hash, CValidationState& state, CBlockIndex* &pindexNew)
 {
     printf("Accept block header\n");
 
     // Check for duplicate
-    uint256 hash = block.GetHash();
     map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         pindexNew = mi->second;
@@ -2119,7 +2647,7 @@ bool static AcceptBlockHeader(const CBlockHeader &block, CValidationState& state
         // Check proof of work
 	{
 		//run real checkprooffowork here after we find out number of bits
-	        if (!CheckProofOfWork(block.GetHash(),GetNextWorkRequired(pindexPrev, &block)))
+	        if (!CheckProofOfWork(hash,GetNextWorkRequired(pindexPrev, &block)))
 	            return state.DoS(100, error("AcceptBlockHeader() : incorrect proof of work"),
 	                             REJECT_INVALID, "bad-diffbits");
 	}
@@ -2171,7 +2699,7 @@ bool static AcceptBlockHeader(const CBlockHeader &block, CValidationState& state
     if (LinkOrphans(&block.hashPrevBlock))
         if (!ActivateBestHeader(state))
             return false;
-    if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindexNew)))
+    if (!blockCache.WriteBlockIndex(pindexNew))
         return state.Abort(_("Failed to write block index"));
     pindexNew->fConnected=true;
    // printf("Accepted block header\n");
@@ -2185,7 +2713,7 @@ bool static AcceptBlock(CBlock& block, CValidationState& state)
 {
     //LogPrintf("AcceptBlock()\n");
     CBlockIndex *pindexNew = NULL;
-    if (!AcceptBlockHeader(block, state, pindexNew))
+    if (!AcceptBlockHeader(block, block.GetHash(), state, pindexNew))
         return false;
 
     if (pindexNew->nStatus & BLOCK_HAVE_DATA && (pindexNew->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS){
@@ -2254,20 +2782,21 @@ int64_t CBlockIndex::GetMedianTime() const
     return pindex->GetMedianTimePast();
 }
 
-bool ProcessBlockHeader(CValidationState &state, const CBlockHeader* pheader){
-    uint256 hash = pheader->GetHash();
+bool ProcessBlockHeader(CValidationState &state, const CBlockHeader* pheader, const uint256 *phash){
+    // A given hash comes from CheckHeaders, which has checked the minimum proof of work already
+    uint256 hash = phash ? *phash : pheader->GetHash();
     if (mapBlockIndex.count(hash))
         return true;
 
     // Preliminary checks
-    if (!CheckBlockHeader(*pheader, state)){
+    if (!CheckBlockHeader(*pheader, state, phash == NULL)){
 	LogPrintf("CheckBlockHeader(): %s\n", state.GetRejectReason());
         return error("ProcessBlockHeader() : CheckBlockHeader FAILED");
     } 
 
     // Include in the block tree.
     CBlockIndex *pindexNew = NULL;
-    if (!AcceptBlockHeader(*pheader, state, pindexNew))
+    if (!AcceptBlockHeader(*pheader, hash, state, pindexNew))
         return error("ProcessBlockHeader() : AcceptBlockHeader FAILED");
 
     if(fTrieOnline && chainHeaders.Height() > (chainActive.Height() + (int64_t)MIN_HISTORY) && !ForceNoTrie()){
@@ -2403,8 +2932,7 @@ void ActivateTrie(){
 	printf("Ready for committal\n");
 	fTrieOnline=true;
 	//write crap into blockdb
-	pblocktree->WriteSyncPoint(block);
-	pblocktree->Flush();
+	blockCache.WriteSyncPoint(block);
 	pindexSyncPoint=pindex;
     }else{
 	//Very bad
@@ -2782,7 +3310,7 @@ printAffairs();
     //if genesis is really young set trieonline and write syncpoint to db
     if(syncPoint==0 && triePoint != 0 && triePoint != Params().HashGenesisBlock()){
 	syncPoint = pindexGenesisBlock->GetBlockHash();
-	pblocktree->WriteSyncPoint(syncPoint); 
+	blockCache.WriteSyncPoint(syncPoint); 
 	//init will activate trie?
     }
 
@@ -2926,6 +3454,9 @@ bool LoadBlockIndex()
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB())
         return false;
+    // Without the filter every txindex lookup simply goes to the database
+    if (!pblocktree->LoadTxIndexFilter())
+        LogPrintf("LoadBlockIndex() : could not load the txindex filter\n");
     return true;
 }
 
@@ -3043,7 +3574,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
         if (dbp) {
             // (try to) skip already indexed part
             CBlockFileInfo info;
-            if (pblocktree->ReadBlockFileInfo(dbp->nFile, info)) {
+            if (blockCache.ReadBlockFileInfo(dbp->nFile, info)) {
                 nStartByte = info.nSize;
                 blkdat.Seek(info.nSize);
             }
@@ -3102,7 +3633,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                     if (LinkOrphans(&block.hashPrevBlock)) {
                         ActivateBestHeader(state);
                         ActivateBestChain(state);
-                        pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex));
+                        blockCache.WriteBlockIndex(pindex);
                     }
                 }
             } catch (std::exception &e) {
@@ -3758,7 +4289,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
         vector<CBlock> vHeaders;
-        int nLimit = 2000;
+        int nLimit = MAX_HEADERS_RESULTS;
         LogPrint("net", "getheaders %d to %s\n", (pindex ? pindex->nHeight : -1), hashStop.ToString());
         for (; pindex && pindex->nHeight <= chainActive.Height(); pindex = chainActive.Next(pindex))
         {
@@ -3772,48 +4303,28 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
     else if (strCommand == "tx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
         CInv inv(MSG_TX, tx.GetTxID());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK(cs_main);
-
-	//Ignore incoming tx's until we are online
-	if(!IsInitialBlockDownload() && (fTrieOnline || ForceNoTrie())){
-
-            bool fMissingInputs = false;
-            CValidationState state;
-            if (AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
-            {
-//              mempool.check(pcoinsTip);
-                RelayTransaction(tx, inv.hash);
-                mapAlreadyAskedFor.erase(inv);
-                vWorkQueue.push_back(inv.hash);
-                vEraseQueue.push_back(inv.hash);
-
-
-                LogPrint("mempool", "AcceptToMemoryPool: %s %s : accepted %s (poolsz %" PRIszu ")\n",
-                   pfrom->addr.ToString(), pfrom->cleanSubVer,
-                   tx.GetTxID().ToString(),
-                   mempool.mapTx.size());
-
-            }
+        bool fOnline;
+        {
+            LOCK(cs_main);
+            fOnline = !IsInitialBlockDownload() && (fTrieOnline || ForceNoTrie());
+        }
 
-            int nDoS = 0;
-            if (state.IsInvalid(nDoS))
-            {
-                LogPrint("mempool", "%s from %s %s was not accepted into the memory pool: %s\n", tx.GetTxID().ToString(),
-                  pfrom->addr.ToString(), pfrom->cleanSubVer,
-                  state.GetRejectReason());
-                pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason(), inv.hash);
-                if (nDoS > 0)
-                    Misbehaving(pfrom->GetId(), nDoS);
-            }
+	//Ignore incoming tx's until we are online. The admission threads run whenever the
+	//verification threads do, which includes the -par=0 default on more than one core;
+	//only -par=1 (or a single core) admits on this thread
+	if(fOnline){
+            if (nScriptCheckThreads) {
+                if (!txadmissionqueue.Push(tx, pfrom))
+                    LogPrint("mempool", "admission queue full, dropped %s from %s\n",
+                             inv.hash.ToString(), pfrom->addr.ToString());
+            } else
+                AdmitTransaction(tx, pfrom);
 	}
     }
   
@@ -3905,20 +4416,38 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         std::vector<CBlock> vBlocks;
         vRecv >> vBlocks;
 
+        if (vBlocks.size() > MAX_HEADERS_RESULTS) {
+            Misbehaving(pfrom->GetId(), 20);
+            return error("headers message size = %u", vBlocks.size());
+        }
+
         if (vBlocks.size() == 0)
             return true;
 
         CBlockIndex *pindexBefore = chainHeaders.Tip();
 
+        // The expensive hashing needs no context, do it for the whole batch before taking cs_main
+        std::vector<uint256> vHash;
+        std::vector<char> vfOk;
+        CheckHeaders(vBlocks, vHash, vfOk);
+
         CValidationState state;
-        BOOST_FOREACH(const CBlock &block, vBlocks) {
+        unsigned int nProcessed = 0;
+        for (; nProcessed < vBlocks.size(); nProcessed++) {
 	    LOCK(cs_main);
-            if (!ProcessBlockHeader(state, &block)) {
+            // The first header failing the parallel check goes the slow way, to get the
+            // right rejection. Nothing after it is looked at, its check may have been skipped.
+            bool fOk = vfOk[nProcessed];
+            if (!ProcessBlockHeader(state, &vBlocks[nProcessed], fOk ? &vHash[nProcessed] : NULL)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS))
                     Misbehaving(pfrom->GetId(),nDoS);
                 break;
             }
+            if (!fOk) {
+                nProcessed++;
+                break;
+            }
         }
 
         if (chainHeaders.Tip() != pindexBefore) {
@@ -3928,8 +4457,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
               log(chainHeaders.Tip()->nChainWork.getdouble())/log(2.0),
               DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainHeaders.Tip()->GetBlockTime()).c_str());
 
-            // Assume the headers are in order, so only check the last one to update pindexLastBlock.
-            std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(vBlocks.back().GetHash());
+            // Assume the headers are in order, so only check the last one accepted to update pindexLastBlock.
+            const CBlock &last = vBlocks[nProcessed - 1];
+            std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(vfOk[nProcessed - 1] ? vHash[nProcessed - 1] : last.GetHash());
             if (it != mapBlockIndex.end()) {
                 CBlockIndex *pindex = it->second;
                 if (pfrom->pindexLastBlock == NULL || pindex->nChainWork >= pfrom->pindexLastBlock->nChainWork)
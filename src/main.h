@@ -70,6 +70,12 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Seconds between background pruning passes with -prune */
+static const int64_t DEFAULT_PRUNE_INTERVAL = 60;
+/** Number of txindex entries erased per database batch while pruning */
+static const unsigned int PRUNE_TXINDEX_BATCH = 1000;
+/** Number of headers sent in one getheaders result, and the most a headers message may hold */
+static const unsigned int MAX_HEADERS_RESULTS = 2000;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 32;
 /** Timeout in seconds before considering a block download peer unresponsive. */
@@ -105,6 +111,7 @@ extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
 extern bool fImporting;
 extern bool fReindex;
+extern bool fMempoolLoaded;
 extern bool fLoading;
 extern bool fBenchmark;
 extern bool fTrieOnline;
@@ -145,8 +152,8 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
 
 extern boost::signals2::signal<void (const std::string &title, int nProgress)> ShowProgress;
 
-/** Process an incoming block header */
-bool ProcessBlockHeader(CValidationState &state, const CBlockHeader* pheader);
+/** Process an incoming block header. phash, if given, is its hash with the minimum proof of work already checked */
+bool ProcessBlockHeader(CValidationState &state, const CBlockHeader* pheader, const uint256 *phash = NULL);
 /** Process an incoming block */
 bool ProcessBlock(CValidationState &state, CBlock* pblock, CNode* pfrom=0);
 /** Check whether enough disk space is available for an incoming block */
@@ -167,12 +174,20 @@ void UnloadBlockIndex();
 bool VerifyDB(int nCheckLevel, int nCheckDepth);
 /** Print the loaded block tree */
 void PrintBlockTree();
+/** Write the memory pool to mempool.dat */
+bool DumpMempool();
+/** Readmit the transactions in mempool.dat to the memory pool */
+bool LoadMempool();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /** Send queued protocol messages to be sent to a give node */
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header checking thread */
+void ThreadHeaderCheck();
+/** Run an instance of the transaction admission thread */
+void ThreadTxAdmission();
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, double nBits);
 /** Calculate the minimum amount of work a received block needs, without knowing its direct parent */
@@ -198,6 +213,14 @@ uint256 UpdateTime(CBlockHeader& block, const CBlockIndex* pindexPrev);
 int GetTotalMissing();
 void SystemResync(bool fRestart=true);
 void PurgeDB();
+/** Lowest height whose block and undo data must be kept, -1 if nothing can be pruned yet */
+int64_t GetPruneHeight();
+/** Number of the block file currently being written to */
+int GetLastBlockFile();
+/** Delete block and undo files that lie entirely below GetPruneHeight() */
+void PruneBlockFiles();
+/** Run PruneBlockFiles periodically (-prune) */
+void ThreadPruneBlockFiles();
 bool ForceNoTrie();
 
 /** Create a new block index entry for a given block hash */
@@ -214,7 +237,7 @@ void Misbehaving(NodeId nodeid, int howmuch);
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee=false);
+                        bool* pfMissingInputs, bool fRejectInsaneFee=false, int64_t nAcceptTime=0);
 
 
 
@@ -330,8 +353,13 @@ inline bool AllowFree(double dPriority)
 
 // Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
 // This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
-// instead of being performed inline.
-bool CheckInputs(const CTransaction& tx, CValidationState &state);
+// instead of being performed inline. Keys recovered from the signatures are only cached when
+// fCacheStore is set.
+bool CheckInputs(const CTransaction& tx, CValidationState &state, std::vector<CScriptCheck> *pvChecks = NULL, bool fCacheStore = false);
+
+// Check the signatures of all transactions of a block ahead of ConnectBlock, storing the
+// recovered keys in the signature cache. Used by the block prefetch threads, needs no locks.
+void PrecheckBlockSignatures(const CBlock& block);
 
 // Apply the effects of this transaction on the UTXO set represented by view
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CTxUndo &txundo, int nHeight, const uint256 &txhash);
@@ -346,14 +374,195 @@ bool IsStandardTx(const CTransaction& tx, std::string& reason);
 
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight = 0, int64_t nBlockTime = 0);
 
+/** wrapper for the undo records of a block that provides a more compact serialization.
+ *  The compact format starts with a marker byte that can never begin the compact size of
+ *  the old plain vector<CTxUndo> encoding, followed by a format version, a dictionary of
+ *  the keys touched by the block and one record per undo entry: a key index, a flags byte
+ *  for create/destroy and default values, and varints for the rest. The age is delta encoded
+ *  against the previous record. Records in the old format are still read and re-serialized
+ *  in the format they were read in so their checksums can be verified.
+ */
+class CBlockUndoCompressor
+{
+private:
+    std::vector<CTxUndo> &vtxundo;
+    int &nFormat;
+
+    static const unsigned char UNDO_MARKER = 0xff;
+
+    enum
+    {
+        UNDO_CREATE          = (1 << 0),
+        UNDO_DESTROY         = (1 << 1),
+        UNDO_ZEROBALANCE     = (1 << 2),
+        UNDO_ZEROAGE         = (1 << 3),
+        UNDO_ZEROLIMIT       = (1 << 4),
+        UNDO_NOLIMIT         = (1 << 5), // m_limit is UINT64_MAX
+        UNDO_SAMEFUTURELIMIT = (1 << 6), // m_futurelimit equals m_limit
+        UNDO_ALLFLAGS        = (1 << 7) - 1,
+    };
+
+    static uint64_t ZigZag(uint64_t nDelta) { return (nDelta << 1) ^ (uint64_t)((int64_t)nDelta >> 63); }
+    static uint64_t UnZigZag(uint64_t n) { return (n >> 1) ^ (~(n & 1) + 1); }
+
+public:
+    enum
+    {
+        UNDO_FORMAT_LEGACY  = 0,
+        UNDO_FORMAT_COMPACT = 1,
+    };
+
+    CBlockUndoCompressor(std::vector<CTxUndo> &vtxundoIn, int &nFormatIn) : vtxundo(vtxundoIn), nFormat(nFormatIn) { }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        if (nFormat == UNDO_FORMAT_LEGACY)
+            return ::GetSerializeSize(vtxundo, nType, nVersion);
+        CDataStream ss(nType, nVersion);
+        Serialize(ss, nType, nVersion);
+        return ss.size();
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const
+    {
+        if (nFormat == UNDO_FORMAT_LEGACY) {
+            ::Serialize(s, vtxundo, nType, nVersion);
+            return;
+        }
+
+        // Key dictionary in order of first use
+        std::vector<uint160> vKeys;
+        std::vector<unsigned int> vIndex;
+        std::map<uint160, unsigned int> mapKeys;
+        vIndex.reserve(vtxundo.size());
+        BOOST_FOREACH(const CTxUndo &undo, vtxundo) {
+            std::map<uint160, unsigned int>::iterator it = mapKeys.find(undo.m_key);
+            if (it == mapKeys.end()) {
+                it = mapKeys.insert(std::make_pair(undo.m_key, (unsigned int)vKeys.size())).first;
+                vKeys.push_back(undo.m_key);
+            }
+            vIndex.push_back(it->second);
+        }
+
+        unsigned char chMarker = UNDO_MARKER;
+        WRITEDATA(s, chMarker);
+        WriteVarInt<Stream,unsigned int>(s, UNDO_FORMAT_COMPACT);
+        ::Serialize(s, vKeys, nType, nVersion);
+        WriteCompactSize(s, vtxundo.size());
+
+        uint64_t nPrevAge = 0;
+        for (unsigned int i = 0; i < vtxundo.size(); i++) {
+            const CTxUndo &undo = vtxundo[i];
+            unsigned char chFlags = 0;
+            if (undo.m_create)                    chFlags |= UNDO_CREATE;
+            if (undo.m_destroy)                   chFlags |= UNDO_DESTROY;
+            if (undo.m_balance == 0)              chFlags |= UNDO_ZEROBALANCE;
+            if (undo.m_age == 0)                  chFlags |= UNDO_ZEROAGE;
+            if (undo.m_limit == 0)                chFlags |= UNDO_ZEROLIMIT;
+            if (undo.m_limit == UINT64_MAX)       chFlags |= UNDO_NOLIMIT;
+            if (undo.m_futurelimit == undo.m_limit) chFlags |= UNDO_SAMEFUTURELIMIT;
+
+            WriteVarInt<Stream,unsigned int>(s, vIndex[i]);
+            WRITEDATA(s, chFlags);
+            if (!(chFlags & UNDO_ZEROBALANCE))
+                WriteVarInt<Stream,uint64_t>(s, undo.m_balance);
+            if (!(chFlags & UNDO_ZEROAGE)) {
+                WriteVarInt<Stream,uint64_t>(s, ZigZag(undo.m_age - nPrevAge));
+                nPrevAge = undo.m_age;
+            }
+            if (!(chFlags & (UNDO_ZEROLIMIT | UNDO_NOLIMIT)))
+                WriteVarInt<Stream,uint64_t>(s, undo.m_limit);
+            if (!(chFlags & UNDO_SAMEFUTURELIMIT))
+                WriteVarInt<Stream,uint64_t>(s, undo.m_futurelimit);
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion)
+    {
+        vtxundo.clear();
+
+        unsigned char chMarker;
+        READDATA(s, chMarker);
+        if (chMarker != UNDO_MARKER) {
+            // Old format: the byte read is the start of the vector's compact size
+            uint64_t nCount = chMarker;
+            if (chMarker == 253) {
+                unsigned short xSize;
+                READDATA(s, xSize);
+                nCount = xSize;
+            } else if (chMarker == 254) {
+                unsigned int xSize;
+                READDATA(s, xSize);
+                nCount = xSize;
+            }
+            if (nCount > MAX_SIZE)
+                throw std::ios_base::failure("CBlockUndoCompressor : size too large");
+            for (uint64_t i = 0; i < nCount; i++) {
+                CTxUndo undo;
+                ::Unserialize(s, undo, nType, nVersion);
+                vtxundo.push_back(undo);
+            }
+            nFormat = UNDO_FORMAT_LEGACY;
+            return;
+        }
+
+        unsigned int nFormatIn = ReadVarInt<Stream,unsigned int>(s);
+        if (nFormatIn != UNDO_FORMAT_COMPACT)
+            throw std::ios_base::failure("CBlockUndoCompressor : unknown undo format");
+
+        std::vector<uint160> vKeys;
+        ::Unserialize(s, vKeys, nType, nVersion);
+        uint64_t nCount = ReadCompactSize(s);
+
+        uint64_t nPrevAge = 0;
+        for (uint64_t i = 0; i < nCount; i++) {
+            unsigned int nKey = ReadVarInt<Stream,unsigned int>(s);
+            unsigned char chFlags;
+            READDATA(s, chFlags);
+            if (nKey >= vKeys.size() || (chFlags & ~UNDO_ALLFLAGS))
+                throw std::ios_base::failure("CBlockUndoCompressor : invalid undo record");
+
+            CTxUndo undo(vKeys[nKey]);
+            undo.m_create = (chFlags & UNDO_CREATE) != 0;
+            undo.m_destroy = (chFlags & UNDO_DESTROY) != 0;
+            if (!(chFlags & UNDO_ZEROBALANCE))
+                undo.m_balance = ReadVarInt<Stream,uint64_t>(s);
+            if (!(chFlags & UNDO_ZEROAGE)) {
+                undo.m_age = nPrevAge + UnZigZag(ReadVarInt<Stream,uint64_t>(s));
+                nPrevAge = undo.m_age;
+            }
+            if (chFlags & UNDO_NOLIMIT)
+                undo.m_limit = UINT64_MAX;
+            else if (!(chFlags & UNDO_ZEROLIMIT))
+                undo.m_limit = ReadVarInt<Stream,uint64_t>(s);
+            if (chFlags & UNDO_SAMEFUTURELIMIT)
+                undo.m_futurelimit = undo.m_limit;
+            else
+                undo.m_futurelimit = ReadVarInt<Stream,uint64_t>(s);
+            vtxundo.push_back(undo);
+        }
+        nFormat = UNDO_FORMAT_COMPACT;
+    }
+};
+
 /** Undo information for a CBlock */
 class CBlockUndo
 {
 public:
     std::vector<CTxUndo> vtxundo; // for all but the coinbase
 
+    // memory only: encoding the undo data was read in, new undo data is always compact
+    int nFormat;
+
+    CBlockUndo()
+    {
+        nFormat = CBlockUndoCompressor::UNDO_FORMAT_COMPACT;
+    }
+
     IMPLEMENT_SERIALIZE(
-        READWRITE(vtxundo);
+        READWRITE(REF(CBlockUndoCompressor(REF(vtxundo), REF(nFormat))));
     )
 
     bool WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
@@ -369,25 +578,28 @@ public:
 
 
 /** Closure representing one script verification
- *  Note that this stores references to the spending transaction */
+ *  Note that this stores references to the spending transaction. The signature
+ *  hash is computed once per transaction by the caller and shared by its checks. */
 class CScriptCheck
 {
 private:
-    uint160 pubKey;
+    uint256 hashSig;
     const CTransaction *ptxTo;
     unsigned int nIn;
+    bool fCacheStore;
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const uint160 &pubKeyIn, const CTransaction& txToIn, unsigned int nInIn) :
-        pubKey(pubKeyIn), ptxTo(&txToIn), nIn(nInIn) { }
+    CScriptCheck(const uint256 &hashSigIn, const CTransaction& txToIn, unsigned int nInIn, bool fCacheStoreIn = false) :
+        hashSig(hashSigIn), ptxTo(&txToIn), nIn(nInIn), fCacheStore(fCacheStoreIn) { }
 
     bool operator()() const;
 
     void swap(CScriptCheck &check) {
-        std::swap(pubKey,check.pubKey);
+        std::swap(hashSig, check.hashSig);
         std::swap(ptxTo, check.ptxTo);
         std::swap(nIn, check.nIn);
+        std::swap(fCacheStore, check.fCacheStore);
     }
 };
 
@@ -502,6 +714,39 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 // Apply the effects of this block (with given index) on the UTXO set represented by coins
 bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, bool fJustCheck = false);
 
+/** Stages of block validation timed by -replaybench */
+enum ReplayStage
+{
+    REPLAY_READ,
+    REPLAY_DESERIALIZE,
+    REPLAY_MERKLE,
+    REPLAY_SIGNATURES,
+    REPLAY_TEMPAPPLY,
+    REPLAY_TRIEHASH,
+    REPLAY_UNDOWRITE,
+    REPLAY_INDEXWRITE,
+    REPLAY_STAGES
+};
+
+const char *GetReplayStageName(int nStage);
+
+/** Timings of a -replaybench run, microseconds per block and stage */
+struct CReplayStats
+{
+    std::vector<int64_t> vStageTime[REPLAY_STAGES];
+    std::vector<int64_t> vBlockTime;
+    uint64_t nTx;
+    uint64_t nInputs;
+    int64_t nTotalTime;
+
+    CReplayStats() : nTx(0), nInputs(0), nTotalTime(0) {}
+};
+
+// Re-connect the active chain blocks nFrom..nTo against the account trie rewound to
+// nFrom-1, timing every validation stage. Nothing but the (unchanged) index entries is
+// written to the datadir, and the trie is put back where it was afterwards.
+bool ReplayBlocks(int nFrom, int nTo, CReplayStats &stats);
+
 // Context-independent validity checks
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 bool CheckBlockHeader(const CBlockHeader& header, CValidationState& state, bool fCheckPOW = true);
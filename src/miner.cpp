@@ -8,6 +8,7 @@
 #include "rpcclient.h"
 
 #include "core.h"
+#include "hashblock.h"
 #include "main.h"
 #include "net.h"
 #ifdef ENABLE_WALLET
@@ -20,58 +21,21 @@
 
 static bool fSoloMine=false;
 
-// Some explaining would be appreciated
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
-    double dFeePerKb;
-
-    COrphan(const CTransaction* ptxIn)
-    {
-        ptx = ptxIn;
-        dPriority = dFeePerKb = 0;
-    }
-
-    void print() const
-    {
-        LogPrintf("COrphan(hash=%s, dPriority=%.1f, dFeePerKb=%.1f)\n",
-               ptx->GetHash().ToString(), dPriority, dFeePerKb);
-        BOOST_FOREACH(uint256 hash, setDependsOn)
-            LogPrintf("   setDependsOn %s\n", hash.ToString());
-    }
-};
+// Candidates in a row that may fail to fit before the block is considered full,
+// so a nearly full block does not walk the rest of the pool
+static const int MAX_CONSECUTIVE_FAILURES = 1000;
 
+// The last template built, handed out again while the tip, the pool and the coinbase
+// key are unchanged so the mining threads and getblocktemplate share one build.
+// Protected by cs_main.
+static CBlockTemplate* pblocktemplateCached = NULL;
+static uint256 hashCachedPrevBlock;
+static unsigned int nCachedTransactionsUpdated = 0;
+static uint160 cachedPubKey;
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-// We want to sort transactions by priority and fee, so:
-typedef boost::tuple<double, double, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
-    }
-};
-
 string gen_random() {
     char s[64];
     memset(s,0,sizeof(s));
@@ -90,8 +54,76 @@ string gen_random() {
     return string(s);
 }
 
+// Supertransactions only go in a block once their external token checks out.
+// fRemove is set when the transaction should leave the memory pool instead.
+static bool CheckSuperTransactionForBlock(const CTransaction& tx, int64_t nTxFees, bool& fRemove)
+{
+	fRemove = false;
+	string External=std::string(tx.url.data(), tx.url.size());
+	if(External.substr(0, 4)!="http"){
+		fRemove = true;
+		return false;
+	}
+	//Remove if we are not check supertransactions
+	if(GetBoolArg("-enableverif", true)==false){
+		fRemove = true;
+		return false;
+	}
+	//Remove if Duration to check of supertransactions is exceeded
+	if((chainActive.Height()-tx.nLockHeight)>GetArg("-duratverif", 1000)){
+		fRemove = true;
+		return false;
+	}
+	//Remove if TxFees to small to check of supertransactions 
+	if(nTxFees<GetArg("-minastxfee", nTransactionFFee)){
+		fRemove = true;
+		return false;
+	}
+	//Check frequency of verification of supertransactions
+	int64_t f;
+	f=chainActive.Height()-tx.nLockHeight;
+	if ((f%GetArg("-freqverif", 10)))
+		return false;
+
+	if (tx.token.size()==0){
+		fRemove = true;
+		return false;
+	}
+
+	string URL=External.substr(0);
+	std::size_t ProtocolEx =0;
+	std::size_t HostEx =0;
+	string Protocol=URL.substr(0, (URL.find('://')-1));
+	ProtocolEx = URL.find('://')+2;
+
+	string pHost=URL.substr(ProtocolEx);
+
+	string Host=pHost.substr(0, (pHost.find('/')));
+	HostEx = pHost.find('/');
+
+	std::size_t posp =(ProtocolEx+HostEx);
+	string Patch=URL.substr(posp);
+
+	string token_=std::string(tx.token.data(), tx.token.size());
+
+	string tvalue_=std::string(tx.tvalue.data(), tx.tvalue.size());
+	return CheckSuperTransaction(Protocol, Host, Patch, token_, tvalue_);
+}
+
 CBlockTemplate* CreateNewBlock(uint160 pubKey)
 {
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+
+    // Nothing the template depends on changed since the last one was built
+    if (pblocktemplateCached && hashCachedPrevBlock == pindexPrev->GetBlockHash() &&
+        nCachedTransactionsUpdated == mempool.GetTransactionsUpdated() && cachedPubKey == pubKey)
+    {
+        CBlockTemplate* pblocktemplate = new CBlockTemplate(*pblocktemplateCached);
+        UpdateTime(pblocktemplate->block, pindexPrev);
+        return pblocktemplate;
+    }
+
     // Create new block
     auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
     if(!pblocktemplate.get())
@@ -99,7 +131,7 @@ CBlockTemplate* CreateNewBlock(uint160 pubKey)
     CBlock *pblock = &pblocktemplate->block; // pointer for convenience
 
     // Create coinbase tx
-    CTransaction txNew;
+    CMutableTransaction txNew;
     txNew.vin.resize(1);
     txNew.vin[0].SetNull();
     txNew.vout.resize(1);
@@ -118,293 +150,174 @@ CBlockTemplate* CreateNewBlock(uint160 pubKey)
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
+    // Largest block you're willing to create:
+    unsigned int nBlockMaxSize = GetNextMaxSize(pindexPrev);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
 
-    // Collect memory pool transactions into the block
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+    int nHeight = pindexPrev->nHeight + 1;
+
+    // Collect memory pool transactions into the block. The pool keeps them ranked by fee
+    // rate as they arrive and leave, and drops the ones a connected block invalidated,
+    // so the candidates are taken from the top until the block is full. Sizes and fees
+    // are cached in the pool entries and signatures were checked on entering the pool.
     int64_t nFees = 0;
+    uint64_t nBlockSize = 1000;
+    uint64_t nBlockTx = 0;
+    int nBlockSigOps = 100;
+    int nConsecutiveFailed = 0;
+
+    map<uint160,uint64_t> mapBalances; // spendable balance left to the block's transactions
+    set<uint160> setTxOps;
+    set<uint160> setLimits;
+    vector<CTransaction> vRemove;
+
+    for (set<pair<int64_t, uint256> >::reverse_iterator it = mempool.setFeeRate.rbegin();
+         it != mempool.setFeeRate.rend() && nConsecutiveFailed < MAX_CONSECUTIVE_FAILURES; ++it)
     {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-
-    	// Largest block you're willing to create:
-    	unsigned int nBlockMaxSize = GetNextMaxSize(pindexPrev);
-    	// Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    	nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
-
-    	// How much of the block should be dedicated to high-priority transactions,
-    	// included regardless of the fees they pay
-    	unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    	nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-	map<uint160,uint64_t> mapBalances;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-	    //printf("Analyzing tx\n");
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || !IsFinalTx(tx, pindexPrev->nHeight + 1))
-                continue;
+        // Skip free transactions, everything after this one pays less
+        if (it->first < CTransaction::nMinRelayTxFee)
+            break;
+
+        const CTxMemPoolEntry& entry = mempool.mapTx[it->second];
+        const CTransaction& tx = entry.GetTx();
+        if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight))
+            continue;
+
+        // Size limits
+        unsigned int nTxSize = entry.GetTxSize();
+        if (nBlockSize + nTxSize >= nBlockMaxSize) {
+            nConsecutiveFailed++;
+            continue;
+        }
 
-	    if(TxExists(tx.GetTxID()))
-		continue;
+        if (TxExists(tx.GetTxID()))
+            continue;
 
-            double dPriority = 0;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
+        // Age limits
+        bool fLimitConflict = false;
+        if (tx.fSetLimit) {
+            //Can't have a block where a tx and set limit exist simultaneously
+            fLimitConflict = setTxOps.count(tx.vin[0].pubKey) || setLimits.count(tx.vin[0].pubKey);
+        } else {
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-		//printf("Analyzing txin\n");
-		if(mapBalances.find(txin.pubKey)!=mapBalances.end()){
-		    uint64_t balance = mapBalances[txin.pubKey];
-		    if(balance < txin.nValue){
-			fMissingInputs=true;
-			break;
-		    }
-		    mapBalances[txin.pubKey] -= txin.nValue;
-		}else{
-		    uint64_t balance=0;
-		    if(!pviewTip->Balance(txin.pubKey,balance)){
-			fMissingInputs=true;
-			break;
-		    }
-		    uint64_t limit=0;
-		    pviewTip->Limit(txin.pubKey,limit,pindexPrev->nHeight+1);
-		    if(balance > limit)
-			balance = limit;
-		    if(balance < txin.nValue){
-			fMissingInputs=true;
-			break;
-		    }
-		    mapBalances[txin.pubKey] = balance - txin.nValue;
-		}
-                nTotalIn += txin.nValue;
-                int nConf = pviewTip->CoinAge(txin.pubKey);
-                dPriority += (double)txin.nValue * nConf;
+                fLimitConflict |= setLimits.count(txin.pubKey) > 0;
+        }
+        if (fLimitConflict)
+            continue;
+
+        // Inputs have to fit in what the transactions already in the block left
+        bool fMissingInputs = false;
+        map<uint160,uint64_t> mapSpend;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            mapSpend[txin.pubKey] += txin.nValue;
+        for (map<uint160,uint64_t>::iterator mi = mapSpend.begin(); mi != mapSpend.end() && !fMissingInputs; ++mi) {
+            map<uint160,uint64_t>::iterator itBalance = mapBalances.find(mi->first);
+            if (itBalance == mapBalances.end()) {
+                uint64_t balance=0;
+                if(!pviewTip->Balance(mi->first,balance)){
+                    fMissingInputs=true;
+                    break;
+                }
+                uint64_t limit=0;
+                pviewTip->Limit(mi->first,limit,nHeight);
+                if(balance > limit)
+                    balance = limit;
+                itBalance = mapBalances.insert(make_pair(mi->first, balance)).first;
             }
-            if (fMissingInputs) continue;
-
-	    bool fCantCreate=false;
-	    BOOST_FOREACH(const CTxOut& txout, tx.vout){
-		uint64_t balance=0;
-		if(!pviewTip->Balance(txout.pubKey,balance) && txout.nValue < tx.GetFee()){
-		    fCantCreate=true;
-		    break;
-		}
-	    }
-	    if(fCantCreate) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
-
-            vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &mi->second.GetTx()));
+            fMissingInputs = itBalance->second < mi->second;
         }
+        if (fMissingInputs) continue;
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-	//printf("Tx's: %ld\n", vecPriority.size());
-
-	set<uint160> setTxOps;
-	set<uint160> setLimits;
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize){
-		printf("Too big\n");
-                continue;
-	    }
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-
-            // Skip free transactions:
-            if (dFeePerKb < CTransaction::nMinRelayTxFee){
-		printf("Was free\n");
-                continue;
-	    }
-
-	    // Age limits
-	    if(tx.fSetLimit){
-		if(setTxOps.count(tx.vin[0].pubKey) || setLimits.count(tx.vin[0].pubKey))
-		    continue; //Can't have a block where a tx and set limit exist simultaneously 
-
-		//Limit transactions always valid now
-		setLimits.insert(tx.vin[0].pubKey);
-	    }else{
-	    	BOOST_FOREACH(const CTxIn& txin, tx.vin){
-		     if(setLimits.count(txin.pubKey))
-			continue;
-	    	}
-	    }
-
-            // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        bool fCantCreate=false;
+        BOOST_FOREACH(const CTxOut& txout, tx.vout){
+            uint64_t balance=0;
+            if(!pviewTip->Balance(txout.pubKey,balance) && txout.nValue < tx.GetFee()){
+                fCantCreate=true;
+                break;
             }
-
-            int64_t nTxFees = tx.GetValueIn()-tx.GetValueOut();
-
-	    if(tx.GetValueIn() < tx.GetValueOut()){
-		printf("Value foobar\n");
-		continue;
-	    }
-
-            CValidationState state;
-            //Double check signatures
-            if (!CheckInputs(tx, state))
+        }
+        if(fCantCreate) continue;
+
+        int64_t nTxFees = entry.GetFee();
+        if (tx.txType==2) {
+            bool fRemove = false;
+            if (!CheckSuperTransactionForBlock(tx, nTxFees, fRemove)) {
+                if (fRemove)
+                    vRemove.push_back(tx);
                 continue;
-		//todo
-		//Добавить параметры повторной проверки и удаления из mempool
-		//mempool.remove(tx);
-		//chek external world token in SuperTransactions
-		
-		bool Fchekstx=true;
-			
-		if (tx.txType==2){
-			string External=std::string(tx.url.data(), tx.url.size());
-			if(External.substr(0, 4)=="http"){
-				//Remove if we are not check supertransactions
-				if(GetBoolArg("-enableverif", true)==false){
-					mempool.remove(tx);
-					continue;
-				}
-				//Remove if Duration to check of supertransactions is exceeded
-				//std::cout << " duratverif = ?" << chainActive.Height() - tx.nLockHeight <<" > "<< GetArg("-duratverif", 1000) << std::endl;
-				if((chainActive.Height()-tx.nLockHeight)>GetArg("-duratverif", 1000)){
-					mempool.remove(tx);
-					continue;
-				}
-				//Remove if TxFees to small to check of supertransactions 
-				//std::cout << " minastxfee = ?" << nTxFees << " < " << GetArg("-minastxfee", nTransactionFFee) << std::endl;
-				if(nTxFees<GetArg("-minastxfee", nTransactionFFee)){
-					mempool.remove(tx);
-					continue;
-				}
-				//Check frequency of verification of supertransactions
-				int64_t f;
-				f=chainActive.Height()-tx.nLockHeight;
-				if ((f%GetArg("-freqverif", 10)))
-					continue;
-				
-				if (tx.token.size()>0){
-					string URL=External.substr(0);
-					std::size_t ProtocolEx =0;
-					std::size_t HostEx =0;
-					string Protocol=URL.substr(0, (URL.find('://')-1));
-					ProtocolEx = URL.find('://')+2;
-					
-					string pHost=URL.substr(ProtocolEx);
-					
-					string Host=pHost.substr(0, (pHost.find('/')));
-					HostEx = pHost.find('/');
-					
-					std::size_t posp =(ProtocolEx+HostEx);
-					string Patch=URL.substr(posp);
-					
-					string token_=std::string(tx.token.data(), tx.token.size());
-					
-					string tvalue_=std::string(tx.tvalue.data(), tx.tvalue.size());
-					//std::cout << " protocol: " << Protocol << " Host: " << Host << " Patch: " << Patch << " Token: " << token_ << " Token value: " << tvalue_ << std::endl;
-					bool Fchekstx=CheckSuperTransaction(Protocol, Host, Patch, token_, tvalue_);
-					if (!Fchekstx)
-						continue;
-				}else{
-					mempool.remove(tx);
-					continue;
-				}	
-			}else{
-				mempool.remove(tx);
-				continue;
-			}
-			
-		}
-		
-		//
-	    BOOST_FOREACH(const CTxIn& txin, tx.vin){
-		setTxOps.insert(txin.pubKey);
-	    }
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
-                       dPriority, dFeePerKb, tx.GetHash().ToString());
             }
         }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
-
-	uint64_t balance=0;
-	pviewTip->Balance(0,balance);
-        pblock->vtx[0].vout[0].nValue = GetBlockValue(balance, nFees);
-	pblock->vtx[0].vin[0].nValue = pblock->vtx[0].vout[0].nValue;
-        pblocktemplate->vTxFees[0] = -nFees;
-
-        // Fill in header
-        pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-        UpdateTime(*pblock, pindexPrev);
-        //pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock);
-        pblock->nNonce         = 0;
-	pblock->nHeight	       = pindexPrev->nHeight+1;
-        pblock->vtx[0].vin[0].scriptSig.clear();
-	pblock->vtx[0].nLockHeight = pblock->nHeight;
-        if(!pviewTip->HashForBlock(*pblock, pblock->hashAccountRoot)){
-		return 0;
-	}
-	LogPrintf("Mining for trie hash: %s\n", pblock->hashAccountRoot.GetHex().c_str());
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
-	pblock->hashMerkleRoot = pblock->BuildMerkleTree();
-
-        CBlockIndex indexDummy(*pblock);
-        indexDummy.pprev = pindexPrev;
-        indexDummy.nHeight = pindexPrev->nHeight + 1;
-        CValidationState state;
-        if (!ConnectBlock(*pblock, state, &indexDummy, true))
-            throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+
+        for (map<uint160,uint64_t>::iterator mi = mapSpend.begin(); mi != mapSpend.end(); ++mi)
+            mapBalances[mi->first] -= mi->second;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            setTxOps.insert(txin.pubKey);
+        if (tx.fSetLimit)
+            setLimits.insert(tx.vin[0].pubKey);
+
+        // Added
+        pblock->vtx.push_back(tx);
+        pblocktemplate->vTxFees.push_back(nTxFees);
+        pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += nTxSize;
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        nConsecutiveFailed = 0;
+
+        if (fPrintPriority)
+        {
+            LogPrintf("priority %.1f feeperkb %d txid %s\n",
+                   entry.GetPriority(nHeight), it->first, tx.GetHash().ToString());
+        }
     }
 
+    BOOST_FOREACH(const CTransaction& tx, vRemove)
+        mempool.remove(tx);
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+
+    uint64_t balance=0;
+    pviewTip->Balance(0,balance);
+    txNew.vout[0].nValue = GetBlockValue(balance, nFees);
+    txNew.vin[0].nValue = txNew.vout[0].nValue;
+    pblocktemplate->vTxFees[0] = -nFees;
+
+    // Fill in header
+    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
+    UpdateTime(*pblock, pindexPrev);
+    pblock->nNonce         = 0;
+    pblock->nHeight        = nHeight;
+    txNew.vin[0].scriptSig.clear();
+    txNew.nLockHeight = pblock->nHeight;
+    pblock->vtx[0] = txNew;
+    if(!pviewTip->HashForBlock(*pblock, pblock->hashAccountRoot)){
+        return 0;
+    }
+    LogPrintf("Mining for trie hash: %s\n", pblock->hashAccountRoot.GetHex().c_str());
+    pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+
+    CBlockIndex indexDummy(*pblock);
+    indexDummy.pprev = pindexPrev;
+    indexDummy.nHeight = nHeight;
+    CValidationState state;
+    if (!ConnectBlock(*pblock, state, &indexDummy, true))
+        throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
+
+    delete pblocktemplateCached;
+    pblocktemplateCached = new CBlockTemplate(*pblocktemplate);
+    hashCachedPrevBlock = pindexPrev->GetBlockHash();
+    nCachedTransactionsUpdated = mempool.GetTransactionsUpdated();
+    cachedPubKey = pubKey;
+
     return pblocktemplate.release();
 }
 
@@ -531,15 +444,31 @@ void static BitcoinMiner(CWallet *pwallet)
         while (true)
         {
             unsigned int nHashesDone = 0;
+            // Everything in front of nNonce stays put until UpdateTime below
+            CHash7Midstate midstate;
+            pblock->GetHashMidstate(midstate);
 	    RAND_bytes((unsigned char *)&pblock->nNonce, sizeof(pblock->nNonce));
-	    uint256 hash = pblock->GetHash();
-            while (hash > hashTarget) {
-            		++pblock->nNonce;
-			hash = pblock->GetHash();
-			if(hash < bestHash){
-				bestHash=hash;
-				//printf("New best: %s\n", hash.GetHex().c_str());
+	    // Nonces are hashed eight at a time, keep the batches aligned
+	    pblock->nNonce &= ~(uint64_t)7;
+	    uint256 hash = ~uint256(0);
+            while (true) {
+			uint256 hashes[8];
+			pblock->GetNonceHashes(midstate, hashes);
+			int i = 0;
+			while (i < 8 && hashes[i] > hashTarget)
+				i++;
+			if (i < 8) {
+				pblock->nNonce += i;
+				hash = hashes[i];
+				break;
+			}
+			for (i = 0; i < 8; i++) {
+				if(hashes[i] < bestHash){
+					bestHash=hashes[i];
+					//printf("New best: %s\n", bestHash.GetHex().c_str());
+				}
 			}
+			pblock->nNonce += 8;
 			if ((pblock->nNonce & 0xfff) == 0){
             			boost::this_thread::interruption_point();
 			        if ((pblock->nNonce & 0xffff) == 0) {
@@ -123,3 +123,109 @@ fail :
     lock.unlock();
     exit(0);
 }
+
+//Lowest block file that may still have data on disk, -1 until looked up
+static int nFirstUnprunedFile = -1;
+
+static boost::filesystem::path GetBlockFilePath(const char *prefix, int nFile){
+    return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, nFile);
+}
+
+void PruneBlockFiles(){
+    vector<int> vFiles;
+    map<int, vector<CBlockIndex*> > mapFileBlocks;
+
+    {
+	LOCK(cs_main);
+	int64_t nPruneHeight = GetPruneHeight();
+	if(nPruneHeight < 0)
+	    return;
+
+	//The file being appended to is never pruned
+	int nLastFile = GetLastBlockFile();
+	if(nFirstUnprunedFile < 0){
+	    nFirstUnprunedFile = 0;
+	    while(nFirstUnprunedFile < nLastFile && !boost::filesystem::exists(GetBlockFilePath("blk", nFirstUnprunedFile)))
+		nFirstUnprunedFile++;
+	}
+
+	//Files are filled in height order, so stop at the first one still in use
+	for(int nFile = nFirstUnprunedFile; nFile < nLastFile; nFile++){
+	    CBlockFileInfo info;
+	    if(!blockCache.ReadBlockFileInfo(nFile, info) || (int64_t)info.nHeightLast >= nPruneHeight)
+		break;
+	    vFiles.push_back(nFile);
+	}
+	if(vFiles.empty())
+	    return;
+
+	BOOST_FOREACH(PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex){
+	    CBlockIndex *pindex = item.second;
+	    if((pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) && pindex->nFile >= vFiles.front() && pindex->nFile <= vFiles.back())
+		mapFileBlocks[pindex->nFile].push_back(pindex);
+	}
+    }
+
+    BOOST_FOREACH(int nFile, vFiles){
+	boost::this_thread::interruption_point();
+
+	//txindex entries can only be found through the block data, so they go first.
+	//Only erase entries that point at this block, a stale block may share a tx with the main chain
+	vector<uint256> vErase;
+	BOOST_FOREACH(CBlockIndex *pindex, mapFileBlocks[nFile]){
+	    CBlock block;
+	    if(!(pindex->nStatus & BLOCK_HAVE_DATA) || !blockCache.ReadBlockFromDiskI(block, pindex->GetBlockPos()))
+		continue;
+	    BOOST_FOREACH(const CTransaction &tx, block.vtx){
+		uint256 txid = tx.GetTxID();
+		CDiskTxPos postx;
+		if(!blockCache.ReadTxIndex(txid, postx) || postx.hashBlock != pindex->GetBlockHash())
+		    continue;
+		vErase.push_back(txid);
+		if(vErase.size() >= PRUNE_TXINDEX_BATCH){
+		    blockCache.EraseTxIndex(vErase);
+		    vErase.clear();
+		}
+	    }
+	}
+	if(!vErase.empty())
+	    blockCache.EraseTxIndex(vErase);
+
+	{
+	    LOCK(cs_main);
+	    BOOST_FOREACH(CBlockIndex *pindex, mapFileBlocks[nFile])
+		pindex->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+	    BOOST_FOREACH(CBlockIndex *pindex, mapFileBlocks[nFile])
+		blockCache.WriteBlockIndex(pindex);
+	}
+	if(!blockCache.Sync())
+	    return;
+
+	//Index no longer refers to the files, so a crash from here on just leaves them around
+	//for the next pass
+	boost::system::error_code ec;
+	boost::filesystem::remove(GetBlockFilePath("blk", nFile), ec);
+	boost::filesystem::remove(GetBlockFilePath("rev", nFile), ec);
+	nFirstUnprunedFile = nFile + 1;
+
+	LogPrintf("PruneBlockFiles() : pruned block file %d (%u blocks)\n", nFile, mapFileBlocks[nFile].size());
+    }
+}
+
+void ThreadPruneBlockFiles(){
+    RenameThread("feedbackcoin-prune");
+    int64_t nInterval = std::max(GetArg("-pruneinterval", DEFAULT_PRUNE_INTERVAL), (int64_t)1);
+
+    LogPrintf("ThreadPruneBlockFiles started\n");
+    try {
+	while(true){
+	    if(!fImporting && !fReindex)
+		PruneBlockFiles();
+	    MilliSleep(nInterval * 1000);
+	}
+    }
+    catch (boost::thread_interrupted){
+	LogPrintf("ThreadPruneBlockFiles terminated\n");
+	throw;
+    }
+}
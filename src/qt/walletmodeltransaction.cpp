@@ -13,15 +13,18 @@ WalletModelTransaction::WalletModelTransaction(const QList<SendCoinsRecipient> &
     fee(0)
 {
     walletTransaction = new CWalletTx();
-	walletTransaction->txType = txType_;
+    // The type and its data are kept by CreateTransaction
+    CMutableTransaction txMeta;
+	txMeta.txType = txType_;
 	string feedback = feedback_.toStdString();
-    walletTransaction->feedback = vector<char>(feedback.begin(),feedback.end());
+    txMeta.feedback = vector<char>(feedback.begin(),feedback.end());
     string url = url_.toStdString();
-    walletTransaction->url = vector<char>(url.begin(),url.end());
+    txMeta.url = vector<char>(url.begin(),url.end());
 	string token = token_.toStdString();
-    walletTransaction->token = vector<char>(token.begin(),token.end());
+    txMeta.token = vector<char>(token.begin(),token.end());
 	string tvalue = tvalue_.toStdString();
-    walletTransaction->tvalue = vector<char>(tvalue.begin(),tvalue.end());
+    txMeta.tvalue = vector<char>(tvalue.begin(),tvalue.end());
+    *static_cast<CTransaction*>(walletTransaction) = CTransaction(txMeta);
 }
 
 WalletModelTransaction::~WalletModelTransaction()
@@ -205,6 +205,26 @@ Value getrawmempool(const Array& params, bool fHelp)
     }
 }
 
+Value savemempool(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "savemempool\n"
+            "\nDumps the memory pool to mempool.dat in the data directory.\n"
+            "\nExamples\n"
+            + HelpExampleCli("savemempool", "")
+            + HelpExampleRpc("savemempool", "")
+        );
+
+    if (!fMempoolLoaded)
+        throw JSONRPCError(RPC_MISC_ERROR, "The memory pool was not loaded yet");
+
+    if (!DumpMempool())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to dump memory pool to disk");
+
+    return Value::null;
+}
+
 Value getblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
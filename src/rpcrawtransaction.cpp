@@ -83,7 +83,7 @@ bool GetKeysFromSig(uint256 hash, vector<unsigned char> sig, vector<uint160> &re
     return true;
 }
 
-bool SignOnce(CTransaction &tx, uint256 hash, unsigned idx, CKey key){
+bool SignOnce(CMutableTransaction &tx, uint256 hash, unsigned idx, CKey key){
     vector<pair<uint160, vector<unsigned char> > > recoveredPairs;
     vector<uint160> explicitKeys;
     if(!DecomposeSig(hash,tx.vin[idx].scriptSig,recoveredPairs,explicitKeys))
@@ -221,7 +221,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry, ma
 		int assumedSigs=0;
 		if(mapSigs && mapSigs->find(i) != mapSigs->end())
 		    assumedSigs = (*mapSigs)[i];
-		uint160 recoveredHash = ValueFromSig(SignatureHash(tx),txin.scriptSig,sigAsm,assumedSigs);
+		uint160 recoveredHash = ValueFromSig(tx.GetTxID(),txin.scriptSig,sigAsm,assumedSigs);
 		o.push_back(Pair("asm",sigAsm));
 		o.push_back(Pair("signed", recoveredHash==txin.pubKey));
 	    }else{
@@ -485,7 +485,7 @@ Value createrawtransaction(const Array& params, bool fHelp)
     Object inputs = params[0].get_obj();
     Object outputs = params[1].get_obj();
 
-    CTransaction rawTx;
+    CMutableTransaction rawTx;
 
     set<CBitcoinAddress> setInAddress;
     BOOST_FOREACH(const Pair& input, inputs)
@@ -556,7 +556,7 @@ Value createrawtransaction(const Array& params, bool fHelp)
     }
 	
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << rawTx;
+    ss << CTransaction(rawTx);
     return HexStr(ss.begin(), ss.end());
 }
 
@@ -594,14 +594,16 @@ Value setuprawtransaction(const Array& params, bool fHelp)
 
     vector<unsigned char> txData(ParseHexV(params[0], "argument"));
     CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
-    CTransaction tx;
+    CTransaction txRead;
     try {
-        ssData >> tx;
+        ssData >> txRead;
     }
     catch (std::exception &e) {
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
     }
 
+    CMutableTransaction tx(txRead);
+
     Object inputs = params[1].get_obj();
 
     set<int> indexSet;
@@ -650,7 +652,7 @@ Value setuprawtransaction(const Array& params, bool fHelp)
 	tx.vin[idx].scriptSig.assign(data,data+sizeof(data));
     }
     ssData.clear();
-    ssData << tx;
+    ssData << CTransaction(tx);
     return HexStr(ssData.begin(), ssData.end());
     return Value::null;
 }
@@ -796,18 +798,19 @@ Value signrawtransaction(const Array& params, bool fHelp)
     vector<unsigned char> txData(ParseHexV(params[0], "argument 1"));
     CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
 
-    CTransaction tx;
+    CTransaction txRead;
     if(!ssData.empty())
     {
         try {
-            ssData >> tx;
+            ssData >> txRead;
         }
         catch (std::exception &e) {
             throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
         }
     }
 
-    uint256 hash = SignatureHash(tx);
+    CMutableTransaction tx(txRead);
+    uint256 hash = txRead.GetTxID();
 
     bool fComplete = true;
 
@@ -904,13 +907,13 @@ Value signrawtransaction(const Array& params, bool fHelp)
 	    }
 	} 
 
-        if (!VerifyScript(txin.scriptSig, txin.pubKey, tx, i))
+        if (!VerifyScript(txin.scriptSig, txin.pubKey, CTransaction(tx), i))
             fComplete = false;
     }
 
     Object result;
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-    ssTx << tx;
+    ssTx << CTransaction(tx);
     result.push_back(Pair("hex", HexStr(ssTx.begin(), ssTx.end())));
     result.push_back(Pair("complete", fComplete));
 
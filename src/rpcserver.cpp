@@ -306,6 +306,7 @@ static const CRPCCommand vRPCCommands[] =
     { "getblockheader",         &getblockheader,         false,     false,      false },
     { "getdifficulty",          &getdifficulty,          true,      false,      false },
     { "getrawmempool",          &getrawmempool,          true,      false,      false },
+    { "savemempool",            &savemempool,            true,      false,      false },
     { "gettxout",               &gettxout,               true,      false,      false },
     { "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
     { "verifychain",            &verifychain,            true,      false,      false },
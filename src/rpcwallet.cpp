@@ -297,7 +297,9 @@ Value sendtoaddress(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Invalid transaction type");
 	
 	uint64_t txType=params[2].get_int();
-	wtx.txType=txType;
+	// Carries the type and its data into the transaction CreateTransaction builds
+	CMutableTransaction txMeta;
+	txMeta.txType=txType;
 	
 	if (params[2].get_int()==0 && params.size() > 3 )
         throw JSONRPCError(RPC_WALLET_ERROR, "Invalid positive transaction params");
@@ -312,16 +314,17 @@ Value sendtoaddress(const Array& params, bool fHelp)
 	
 	if (txType==1){
 	string feedback = params[3].get_str();
-        wtx.feedback = vector<char>(feedback.begin(), feedback.end());
+        txMeta.feedback = vector<char>(feedback.begin(), feedback.end());
     }
     if (txType==2){
 	string url= params[3].get_str();
-    wtx.url = vector<char>(url.begin(), url.end());
+    txMeta.url = vector<char>(url.begin(), url.end());
 	string token = params[4].get_str();
-    wtx.token = vector<char>(token.begin(), token.end());
+    txMeta.token = vector<char>(token.begin(), token.end());
 	string tvalue = params[5].get_str();
-    wtx.tvalue = vector<char>(tvalue.begin(), tvalue.end());
+    txMeta.tvalue = vector<char>(tvalue.begin(), tvalue.end());
     }
+    *static_cast<CTransaction*>(&wtx) = CTransaction(txMeta);
 
     EnsureWalletIsUnlocked();
 
@@ -797,7 +800,9 @@ Value sendfrom(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Invalid transaction type");
 	
 	uint64_t txType=params[4].get_int();
-	wtx.txType=txType;
+	// Carries the type and its data into the transaction CreateTransaction builds
+	CMutableTransaction txMeta;
+	txMeta.txType=txType;
 	
 	if (params[4].get_int()==0 && params.size() > 5)
         throw JSONRPCError(RPC_WALLET_ERROR, "Invalid positive transaction params");
@@ -812,16 +817,17 @@ Value sendfrom(const Array& params, bool fHelp)
 	
 	if (txType==1){
 	string feedback = params[5].get_str();
-        wtx.feedback = vector<char>(feedback.begin(), feedback.end());
+        txMeta.feedback = vector<char>(feedback.begin(), feedback.end());
     }
     if (txType==2){
 	string url= params[5].get_str();
-    wtx.url = vector<char>(url.begin(), url.end());
+    txMeta.url = vector<char>(url.begin(), url.end());
 	string token = params[6].get_str();
-    wtx.token = vector<char>(token.begin(), token.end());
+    txMeta.token = vector<char>(token.begin(), token.end());
 	string tvalue = params[7].get_str();
-    wtx.tvalue = vector<char>(tvalue.begin(), tvalue.end());
+    txMeta.tvalue = vector<char>(tvalue.begin(), tvalue.end());
     }
+    *static_cast<CTransaction*>(&wtx) = CTransaction(txMeta);
 	
     EnsureWalletIsUnlocked();
 
@@ -885,7 +891,9 @@ Value sendmany(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Invalid transaction type");
 	
 	uint64_t txType=params[3].get_int();
-	wtx.txType=txType;
+	// Carries the type and its data into the transaction CreateTransaction builds
+	CMutableTransaction txMeta;
+	txMeta.txType=txType;
 	
 	if (params[3].get_int()==0 && params.size() > 4)
         throw JSONRPCError(RPC_WALLET_ERROR, "Invalid positive transaction params");
@@ -900,16 +908,17 @@ Value sendmany(const Array& params, bool fHelp)
 	
 	if (txType==1){
 	string feedback = params[4].get_str();
-        wtx.feedback = vector<char>(feedback.begin(), feedback.end());
+        txMeta.feedback = vector<char>(feedback.begin(), feedback.end());
     }
     if (txType==2){
 	string url= params[4].get_str();
-    wtx.url = vector<char>(url.begin(), url.end());
+    txMeta.url = vector<char>(url.begin(), url.end());
 	string token = params[5].get_str();
-    wtx.token = vector<char>(token.begin(), token.end());
+    txMeta.token = vector<char>(token.begin(), token.end());
 	string tvalue = params[6].get_str();
-    wtx.tvalue = vector<char>(tvalue.begin(), tvalue.end());
+    txMeta.tvalue = vector<char>(tvalue.begin(), tvalue.end());
     }
+    *static_cast<CTransaction*>(&wtx) = CTransaction(txMeta);
 	
     set<CBitcoinAddress> setAddress;
     map<CKeyID, int64_t> mapSend;
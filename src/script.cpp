@@ -16,8 +16,6 @@
 #include "util.h"
 
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 using namespace std;
 using namespace boost;
@@ -112,35 +110,36 @@ uint256 SignatureHash(const CTransaction& txTo)
 }
 
 
-// Valid signature cache, to avoid doing expensive ECDSA signature checking
-// twice for every transaction (once when accepted into memory pool, and
-// again when accepted into the block chain)
+// Recovered key cache, to avoid doing expensive ECDSA public key recovery
+// again for every transaction (once when accepted into memory pool, and
+// again when put into a block template and when accepted into the block chain)
 
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
+     // sigdata_type is (signature hash, compact signature), mapped to the recovered key id
+    typedef std::pair<uint256, std::vector<unsigned char> > sigdata_type;
+    std::map<sigdata_type, uint160> mapRecovered;
     boost::shared_mutex cs_sigcache;
 
 public:
     bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, uint160& keyID)
     {
         boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        sigdata_type k(hash, vchSig);
+        std::map<sigdata_type, uint160>::iterator mi = mapRecovered.find(k);
+        if (mi == mapRecovered.end())
+            return false;
+        keyID = mi->second;
+        return true;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const uint160& keyID)
     {
         // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
+        // (~150 bytes per cache entry times 50,000 entries)
         // Since there are a maximum of 20,000 signature operations per block
         // 50,000 is a reasonable default.
         int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
@@ -148,7 +147,7 @@ public:
 
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
+        while (static_cast<int64_t>(mapRecovered.size()) > nMaxCacheSize)
         {
             // Evict a random entry. Random because that helps
             // foil would-be DoS attackers who might try to pre-generate
@@ -156,18 +155,38 @@ public:
             // than our cache size.
             uint256 randomHash = GetRandHash();
             std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+            std::map<sigdata_type, uint160>::iterator it =
+                mapRecovered.lower_bound(sigdata_type(randomHash, unused));
+            if (it == mapRecovered.end())
+                it = mapRecovered.begin();
+            mapRecovered.erase(it);
         }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        sigdata_type k(hash, vchSig);
+        mapRecovered.insert(make_pair(k, keyID));
     }
 };
 
+static CSignatureCache signatureCache;
+
+// Recover the key id of a 65 byte compact signature, consulting the cache first.
+// Recovered keys are only added to the cache when fCacheStore is set.
+static bool RecoverKeyID(const uint256 &hash, const unsigned char *pchSig, uint160 &keyID, bool fCacheStore)
+{
+    std::vector<unsigned char> vchSig(pchSig, pchSig + 65);
+    if (signatureCache.Get(hash, vchSig, keyID))
+        return true;
+
+    CPubKey key;
+    if (!key.RecoverCompact(hash, pchSig))
+        return false;
+    keyID = key.GetID();
+
+    if (fCacheStore)
+        signatureCache.Set(hash, vchSig, keyID);
+    return true;
+}
+
 bool Sign1(const CKeyID& address, const CKeyStore& keystore, uint256 hash, CScript& scriptSigRet)
 {
     CKey key;
@@ -210,112 +229,118 @@ unsigned int HaveKeys(const vector<valtype>& pubkeys, const CKeyStore& keystore)
     return nResult;
 }
 
-bool VerifyScript(const CScript& scriptSig, const uint160& pubKey, const CTransaction& txTo, unsigned int nIn)
+bool VerifyInputSignature(const CTxIn& txin, const uint256& hash, bool fCacheStore)
 {
-    assert(nIn < txTo.vin.size());
-    // Leave out the signature from the hash, since a signature can't sign itself.
-    // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(txTo);
-    //cout << "Tx Hash: " << hash.GetHex() << endl;
-    //cout << "Key: " << pubKey.GetHex() << endl;
-    bool found=false;
-    BOOST_FOREACH(const CTxIn &txin, txTo.vin){
-	if(txin.pubKey!=pubKey)
-	    continue;
 #if 0
-	printf("Size: %ld\n", txin.scriptSig.size());
-	for(int i=0; i < txin.scriptSig.size(); i++){
-		printf("%2.2X", txin.scriptSig[i]);
-	}
-	printf("\n");
+    printf("Size: %ld\n", txin.scriptSig.size());
+    for(int i=0; i < txin.scriptSig.size(); i++){
+	printf("%2.2X", txin.scriptSig[i]);
+    }
+    printf("\n");
 #endif
-	if(!txin.scriptSig.size())
-	    return false;
+    if(!txin.scriptSig.size())
+	return false;
 
-	//Signature format is 1 byte for number of signatures.
-	//Signatures are 65 bytes each
-	//Public hashs of (m-n) of m are 20 bytes
-	uint32_t nSigs = txin.scriptSig[0];
-	if(!nSigs)
-	    return false;
+    //Signature format is 1 byte for number of signatures.
+    //Signatures are 65 bytes each
+    //Public hashs of (m-n) of m are 20 bytes
+    uint32_t nSigs = txin.scriptSig[0];
+    if(!nSigs)
+	return false;
 
-	uint32_t nHashStart = nSigs*65 + 1;
+    uint32_t nHashStart = nSigs*65 + 1;
 
-	if(txin.scriptSig.size() < nHashStart)
-	    return false;
+    if(txin.scriptSig.size() < nHashStart)
+	return false;
 
-	uint32_t nHashArea = txin.scriptSig.size() - nHashStart;
-	if(nHashArea%20)
-	    return false;
+    uint32_t nHashArea = txin.scriptSig.size() - nHashStart;
+    if(nHashArea%20)
+	return false;
 
-	uint32_t nHashSigs = nHashArea/20;
+    uint32_t nHashSigs = nHashArea/20;
 
-	CPubKey key;
-    	vector<uint160> recoveredKeys;
-	for(uint32_t i=0; i < nSigs; i++){
-	    if(!key.RecoverCompact(hash,&txin.scriptSig[1+i*65])){
-		printf("Could not recover key\n");
-		return false;
-	    }
-	    recoveredKeys.push_back(key.GetID());
+    vector<uint160> recoveredKeys;
+    for(uint32_t i=0; i < nSigs; i++){
+	uint160 keyID;
+	if(!RecoverKeyID(hash,&txin.scriptSig[1+i*65],keyID,fCacheStore)){
+	    printf("Could not recover key\n");
+	    return false;
 	}
+	recoveredKeys.push_back(keyID);
+    }
 
-	vector<uint160> explicitKeys;
-	for(uint32_t i=0; i < nHashSigs; i++){
-	    uint160 temp;
-	    memcpy(&temp, &txin.scriptSig[nHashStart + i * 20], 20);
-	    explicitKeys.push_back(temp);
-	}
-        
-	//printf("Recovered: %s for %s\n", recoveredKeys[0].GetHex().c_str(), pubKey.GetHex().c_str());
+    vector<uint160> explicitKeys;
+    for(uint32_t i=0; i < nHashSigs; i++){
+	uint160 temp;
+	memcpy(&temp, &txin.scriptSig[nHashStart + i * 20], 20);
+	explicitKeys.push_back(temp);
+    }
 
-	//We must enforce that the keys are sorted in order to remove malleability
-	if(!is_sorted(recoveredKeys.begin(),recoveredKeys.end()))
-	    return false;
+    //printf("Recovered: %s for %s\n", recoveredKeys[0].GetHex().c_str(), txin.pubKey.GetHex().c_str());
 
-	if(!is_sorted(explicitKeys.begin(),explicitKeys.end()))
-	    return false;
+    //We must enforce that the keys are sorted in order to remove malleability
+    if(!is_sorted(recoveredKeys.begin(),recoveredKeys.end()))
+	return false;
 
-	//combine the vectors
-	vector<uint160> allKeys;
-	allKeys.insert(allKeys.end(), recoveredKeys.begin(), recoveredKeys.end());
-	allKeys.insert(allKeys.end(), explicitKeys.begin(), explicitKeys.end());
-
-	//Special case for single sigs
-	if(nSigs==1 && nHashSigs==0){
-	    //printf("RecoveredKeys:s %lu\n", recoveredKeys.size());
-	    if(recoveredKeys[0] != pubKey){
-		printf("Fail!!!!\n");
-		return false;
-	    }
-	    found=true;
-	    continue;
-	}
+    if(!is_sorted(explicitKeys.begin(),explicitKeys.end()))
+	return false;
 
-	//Sort the complete key collection
-	sort(allKeys.begin(),allKeys.end());
-	char data[allKeys.size()*20 + 1];
-	for(uint32_t i=0; i < allKeys.size(); i++){
-	    memcpy(&data[i*20],&allKeys[i],20);
+    //Special case for single sigs
+    if(nSigs==1 && nHashSigs==0){
+	//printf("RecoveredKeys:s %lu\n", recoveredKeys.size());
+	if(recoveredKeys[0] != txin.pubKey){
+	    printf("Fail!!!!\n");
+	    return false;
 	}
-	data[sizeof(data)-1] = nSigs;
+	return true;
+    }
+
+    //combine the vectors
+    vector<uint160> allKeys;
+    allKeys.insert(allKeys.end(), recoveredKeys.begin(), recoveredKeys.end());
+    allKeys.insert(allKeys.end(), explicitKeys.begin(), explicitKeys.end());
+
+    //Sort the complete key collection
+    sort(allKeys.begin(),allKeys.end());
+    char data[allKeys.size()*20 + 1];
+    for(uint32_t i=0; i < allKeys.size(); i++){
+	memcpy(&data[i*20],&allKeys[i],20);
+    }
+    data[sizeof(data)-1] = nSigs;
+
+    uint160 hashKeys = Hash160(data,data+sizeof(data));
+    if(hashKeys!=txin.pubKey){
+	printf("Multisig fail\n");
+	return false;
+    }
+    return true;
+}
 
-	uint160 hash = Hash160(data,data+sizeof(data));	
-	if(hash!=pubKey){
-	    printf("Multisig fail\n");
+bool VerifyScript(const CScript& scriptSig, const uint160& pubKey, const CTransaction& txTo, unsigned int nIn, bool fCacheStore)
+{
+    assert(nIn < txTo.vin.size());
+    // Leave out the signature from the hash, since a signature can't sign itself.
+    // The checksig op will also drop the signatures from its hash.
+    const uint256 &hash = txTo.GetTxID();
+    //cout << "Tx Hash: " << hash.GetHex() << endl;
+    //cout << "Key: " << pubKey.GetHex() << endl;
+    bool found=false;
+    BOOST_FOREACH(const CTxIn &txin, txTo.vin){
+	if(txin.pubKey!=pubKey)
+	    continue;
+	if(!VerifyInputSignature(txin, hash, fCacheStore))
 	    return false;
-	}
 	found=true;
     }
     return found;
 }
 
-bool SignSignature(const CKeyStore &keystore, uint160 pubKey, CTransaction& txTo, uint32_t nIn)
+bool SignSignature(const CKeyStore &keystore, uint160 pubKey, CMutableTransaction& txTo, uint32_t nIn)
 {
     assert(nIn < txTo.vin.size());
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(txTo);
+    uint256 hash = CTransaction(txTo).GetTxID();
     //cout << "Tx Hash: " << hash.GetHex() << endl;
     //cout << "Key: " << pubKey.GetHex() << endl;
     BOOST_FOREACH(CTxIn &txin, txTo.vin){
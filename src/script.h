@@ -22,6 +22,8 @@
 class CCoins;
 class CKeyStore;
 class CTransaction;
+struct CMutableTransaction;
+class CTxIn;
 
 static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
 static const unsigned int MAX_OP_RETURN_RELAY = 40;      // bytes
@@ -144,7 +146,9 @@ public:
 
 uint256 SignatureHash(const CTransaction& txTo);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
-bool SignSignature(const CKeyStore& keystore, uint160 pubkey, CTransaction& txTo, unsigned int nIn);
-bool VerifyScript(const CScript& scriptSig, const uint160& pubKey, const CTransaction& txTo, unsigned int nIn);
+bool SignSignature(const CKeyStore& keystore, uint160 pubkey, CMutableTransaction& txTo, unsigned int nIn);
+// Check the signatures of one input against the signature hash of its transaction
+bool VerifyInputSignature(const CTxIn& txin, const uint256& hash, bool fCacheStore = false);
+bool VerifyScript(const CScript& scriptSig, const uint160& pubKey, const CTransaction& txTo, unsigned int nIn, bool fCacheStore = false);
 
 #endif
@@ -0,0 +1,101 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+static uint256 RandHash()
+{
+    uint256 hash;
+    for (unsigned char* p = hash.begin(); p != hash.end(); p++)
+        *p = insecure_rand();
+    return hash;
+}
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+BOOST_AUTO_TEST_CASE(index_writes_wait_for_sync)
+{
+    // A writer thread that never wakes up on its own, so only Sync() writes
+    mapArgs["-blockflushinterval"] = "1000000000";
+    boost::thread threadFlush(&ThreadFlushBlockFiles);
+    for (int i = 0; i < 500 && !blockCache.IsFlushThreadRunning(); i++)
+        MilliSleep(10);
+    BOOST_REQUIRE(blockCache.IsFlushThreadRunning());
+
+    uint256 hashSyncPointOld = 0;
+    bool fHadSyncPoint = pblocktree->ReadSyncPoint(hashSyncPointOld);
+
+    uint256 txidKept = RandHash(), txidErased = RandHash(), hashBlock = RandHash();
+    CDiskTxPos pos(CDiskBlockPos(0, 1234), 5, hashBlock), posRead;
+    vector<pair<uint256, CDiskTxPos> > vPos;
+    vPos.push_back(make_pair(txidKept, pos));
+    vPos.push_back(make_pair(txidErased, pos));
+    BOOST_CHECK(blockCache.WriteTxIndex(vPos));
+    BOOST_CHECK(blockCache.EraseTxIndex(vector<uint256>(1, txidErased)));
+
+    const int nFile = 9999;
+    CBlockFileInfo info, infoRead;
+    info.nBlocks = 3;
+    info.nSize = 4321;
+    BOOST_CHECK(blockCache.WriteBlockFileInfo(nFile, info));
+    uint256 hashSyncPoint = RandHash(), hashSyncPointRead;
+    BOOST_CHECK(blockCache.WriteSyncPoint(hashSyncPoint));
+
+    // Queued writes are visible through the cache but have not reached the database
+    BOOST_CHECK(blockCache.ReadTxIndex(txidKept, posRead));
+    BOOST_CHECK(posRead.hashBlock == hashBlock && posRead.nTxOffset == 5);
+    BOOST_CHECK(!blockCache.ReadTxIndex(txidErased, posRead));
+    BOOST_CHECK(blockCache.ReadBlockFileInfo(nFile, infoRead));
+    BOOST_CHECK_EQUAL(infoRead.nSize, 4321u);
+    BOOST_CHECK(!pblocktree->ReadTxIndex(txidKept, posRead));
+    BOOST_CHECK(!pblocktree->ReadBlockFileInfo(nFile, infoRead));
+    BOOST_CHECK(!pblocktree->ReadSyncPoint(hashSyncPointRead) || hashSyncPointRead != hashSyncPoint);
+
+    // Sync commits the data files first, then writes all of it at once
+    BOOST_CHECK(blockCache.Sync());
+    BOOST_CHECK(pblocktree->ReadTxIndex(txidKept, posRead));
+    BOOST_CHECK(posRead.hashBlock == hashBlock);
+    BOOST_CHECK(!pblocktree->ReadTxIndex(txidErased, posRead));
+    BOOST_CHECK(pblocktree->ReadBlockFileInfo(nFile, infoRead));
+    BOOST_CHECK_EQUAL(infoRead.nBlocks, 3u);
+    BOOST_CHECK(pblocktree->ReadSyncPoint(hashSyncPointRead));
+    BOOST_CHECK(hashSyncPointRead == hashSyncPoint);
+
+    // An erase queued after a synced write removes it on the next sync
+    BOOST_CHECK(blockCache.EraseTxIndex(vector<uint256>(1, txidKept)));
+    BOOST_CHECK(!blockCache.ReadTxIndex(txidKept, posRead));
+    BOOST_CHECK(pblocktree->ReadTxIndex(txidKept, posRead));
+    BOOST_CHECK(blockCache.Sync());
+    BOOST_CHECK(!pblocktree->ReadTxIndex(txidKept, posRead));
+
+    // Writing the trie takes everything queued to disk ahead of it
+    uint256 txidTrie = RandHash();
+    BOOST_CHECK(blockCache.WriteTxIndex(vector<pair<uint256, CDiskTxPos> >(1, make_pair(txidTrie, pos))));
+    BOOST_CHECK(!pblocktree->ReadTxIndex(txidTrie, posRead));
+    BOOST_CHECK(pviewTip->Flush());
+    BOOST_CHECK(pblocktree->ReadTxIndex(txidTrie, posRead));
+    BOOST_CHECK(blockCache.EraseTxIndex(vector<uint256>(1, txidTrie)));
+    BOOST_CHECK(blockCache.Sync());
+
+    threadFlush.interrupt();
+    threadFlush.join();
+    BOOST_CHECK(!blockCache.IsFlushThreadRunning());
+    mapArgs.erase("-blockflushinterval");
+
+    // Put the database back as the other tests expect it
+    pblocktree->Erase(make_pair('f', nFile), true);
+    if (fHadSyncPoint)
+        pblocktree->WriteSyncPoint(hashSyncPointOld);
+    else
+        pblocktree->Erase('S', true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
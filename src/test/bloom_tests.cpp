@@ -8,6 +8,7 @@
 #include "key.h"
 #include "main.h"
 #include "serialize.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "util.h"
 
@@ -420,4 +421,53 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
     BOOST_CHECK(merkleBlock.header.GetHash() == block.GetHash());
 }
 
+BOOST_AUTO_TEST_CASE(blocked_bloom_filter)
+{
+    CBlockedBloomFilter filter(10000);
+    BOOST_CHECK(filter.capacity() >= 10000);
+
+    vector<uint256> vHash;
+    for (int i = 0; i < 10000; i++) {
+        vHash.push_back(GetRandHash());
+        filter.insert(vHash.back());
+    }
+    BOOST_CHECK_EQUAL(filter.size(), 10000U);
+    BOOST_FOREACH(const uint256 &hash, vHash)
+        BOOST_CHECK(filter.contains(hash));
+
+    // Sized for ~0.1%, allow some slack
+    int nFalse = 0;
+    for (int i = 0; i < 100000; i++)
+        if (filter.contains(GetRandHash()))
+            nFalse++;
+    BOOST_CHECK(nFalse < 500);
+
+    filter.reset(10000);
+    BOOST_CHECK_EQUAL(filter.size(), 0U);
+    BOOST_CHECK(!filter.contains(vHash[0]));
+}
+
+BOOST_AUTO_TEST_CASE(txindex_filter)
+{
+    uint256 txidOld = GetRandHash(), txidNew = GetRandHash(), txidMissing = GetRandHash();
+    CDiskTxPos pos(CDiskBlockPos(1, 2), 3, GetRandHash()), posRead;
+
+    // Entries written before the filter is loaded are picked up by the load
+    vector<pair<uint256, CDiskTxPos> > vPos(1, make_pair(txidOld, pos));
+    BOOST_CHECK(pblocktree->WriteTxIndex(vPos));
+    BOOST_CHECK(pblocktree->LoadTxIndexFilter());
+    BOOST_CHECK(pblocktree->ReadTxIndex(txidOld, posRead));
+    BOOST_CHECK(posRead.hashBlock == pos.hashBlock);
+
+    vPos[0].first = txidNew;
+    BOOST_CHECK(pblocktree->WriteTxIndex(vPos));
+    BOOST_CHECK(pblocktree->ReadTxIndex(txidNew, posRead));
+    BOOST_CHECK(!pblocktree->ReadTxIndex(txidMissing, posRead));
+
+    BOOST_CHECK(pblocktree->EraseTxIndex(txidOld));
+    BOOST_CHECK(!pblocktree->ReadTxIndex(txidOld, posRead));
+    BOOST_CHECK(pblocktree->ReadTxIndex(txidNew, posRead));
+    BOOST_CHECK(pblocktree->EraseTxIndex(txidNew));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
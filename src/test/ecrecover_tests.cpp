@@ -0,0 +1,134 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ecrecover.h"
+#include "key.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// Order of the secp256k1 group, big endian
+static const unsigned char vchOrder[32] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,
+    0xBA,0xAE,0xDC,0xE6,0xAF,0x48,0xA0,0x3B,0xBF,0xD2,0x5E,0x8C,0xD0,0x36,0x41,0x41 };
+
+// RecoverCompact (native when built with it) has to agree with OpenSSL on every input
+static void CheckRecover(const uint256 &hash, const unsigned char *vchSig)
+{
+    CPubKey pubkey, pubkeyRef;
+    bool fOk = pubkey.RecoverCompact(hash, vchSig);
+    bool fOkRef = pubkeyRef.RecoverCompactOpenSSL(hash, vchSig);
+    BOOST_CHECK_EQUAL(fOk, fOkRef);
+    if (fOk && fOkRef)
+        BOOST_CHECK(pubkey == pubkeyRef);
+}
+
+static void RandomSig(vector<unsigned char> &vchSig)
+{
+    vchSig.resize(65);
+    uint256 r = GetRandHash(), s = GetRandHash();
+    memcpy(&vchSig[1], &r, 32);
+    memcpy(&vchSig[33], &s, 32);
+}
+
+BOOST_AUTO_TEST_SUITE(ecrecover_tests)
+
+BOOST_AUTO_TEST_CASE(ecrecover_valid)
+{
+    for (int i = 0; i < 64; i++) {
+        CKey key;
+        key.MakeNewKey(i & 1);
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.SignCompact(hash, vchSig));
+
+        CPubKey pubkey;
+        BOOST_CHECK(pubkey.RecoverCompact(hash, &vchSig[0]));
+        BOOST_CHECK(pubkey == key.GetPubKey());
+        CheckRecover(hash, &vchSig[0]);
+
+        // Other recovery ids give other keys or fail, the same way
+        for (int nRec = 0; nRec < 8; nRec++) {
+            vchSig[0] = nRec;
+            CheckRecover(hash, &vchSig[0]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ecrecover_invalid)
+{
+    vector<unsigned char> vchSig;
+    for (int i = 0; i < 256; i++) {
+        uint256 hash = GetRandHash();
+        RandomSig(vchSig);
+        for (int nRec = 0; nRec < 8; nRec++) {
+            vchSig[0] = nRec;
+            CheckRecover(hash, &vchSig[0]);
+        }
+    }
+
+    // r and s out of range, zero, or equal to the group order
+    uint256 hash = GetRandHash();
+    for (int i = 0; i < 16; i++) {
+        RandomSig(vchSig);
+        vchSig[0] = i & 3;
+        if (i & 4)
+            memset(&vchSig[1], 0xFF, 16);
+        if (i & 8)
+            memset(&vchSig[33], 0xFF, 16);
+        CheckRecover(hash, &vchSig[0]);
+    }
+    memset(&vchSig[1], 0, 32);
+    CheckRecover(hash, &vchSig[0]);
+    memcpy(&vchSig[1], vchOrder, 32);
+    CheckRecover(hash, &vchSig[0]);
+    memcpy(&vchSig[33], vchOrder, 32);
+    CheckRecover(hash, &vchSig[0]);
+    memset(&vchSig[33], 0, 32);
+    CheckRecover(hash, &vchSig[0]);
+}
+
+#ifdef USE_NATIVE_ECRECOVER
+BOOST_AUTO_TEST_CASE(ecrecover_batch)
+{
+    const int nJobs = 150;
+    vector<uint256> vHash(nJobs);
+    vector<vector<unsigned char> > vSig(nJobs);
+    vector<CECRecoverJob> vJobs(nJobs);
+    for (int i = 0; i < nJobs; i++) {
+        vHash[i] = GetRandHash();
+        if (i % 3) {
+            CKey key;
+            key.MakeNewKey(true);
+            key.SignCompact(vHash[i], vSig[i]);
+        } else {
+            RandomSig(vSig[i]);
+            vSig[i][0] = i & 3;
+        }
+        vJobs[i].hash = (const unsigned char*)&vHash[i];
+        vJobs[i].p64 = &vSig[i][1];
+        vJobs[i].rec = vSig[i][0] & 3;
+        vJobs[i].fCompressed = i & 1;
+    }
+    ECRecoverBatch(&vJobs[0], nJobs);
+
+    for (int i = 0; i < nJobs; i++) {
+        unsigned char pubkey[65];
+        unsigned int nSize;
+        bool fOk = ECRecover(vJobs[i].hash, vJobs[i].p64, vJobs[i].rec, vJobs[i].fCompressed, pubkey, nSize);
+        BOOST_CHECK_EQUAL(vJobs[i].fOk, fOk);
+        if (fOk && vJobs[i].fOk) {
+            BOOST_CHECK_EQUAL(vJobs[i].nSize, nSize);
+            BOOST_CHECK(memcmp(vJobs[i].pubkey, pubkey, nSize) == 0);
+        }
+    }
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,7 +2,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "core.h"
 #include "hash.h"
+#include "hashblock.h"
 #include "util.h"
 
 #include <vector>
@@ -46,4 +48,292 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+template<typename Context>
+static std::string SphDigest(void (*init)(void*), void (*update)(void*, const void*, size_t),
+                             void (*close)(void*, void*), size_t size, const std::vector<unsigned char>& data)
+{
+    Context ctx;
+    unsigned char digest[64];
+    init(&ctx);
+    update(&ctx, data.empty() ? NULL : &data[0], data.size());
+    close(&ctx, digest);
+    return HexStr(digest, digest + size);
+}
+
+BOOST_AUTO_TEST_CASE(sph_known_answers)
+{
+    std::vector<unsigned char> inputs[4];
+    std::string abc = "abc", abcdbcd = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    inputs[1].assign(abc.begin(), abc.end());
+    inputs[2].assign(abcdbcd.begin(), abcdbcd.end());
+    // Several blocks of every function with a partial block left over
+    for (int i = 0; i < 200; i++)
+        inputs[3].push_back(i);
+
+#define T(name, size, n, expected) BOOST_CHECK_EQUAL((SphDigest<name##_context>(name##_init, name, name##_close, size, inputs[n])), expected)
+
+    // The seven functions in the order Hash7 chains them. The published vectors for
+    // the empty string, "abc" and the 448-bit message are checked against other
+    // implementations; the 200-byte HAVAL and Tiger values are regression values.
+    T(sph_sha256, 32, 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    T(sph_sha256, 32, 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    T(sph_sha256, 32, 2, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    T(sph_sha256, 32, 3, "1901da1c9f699b48f6b2636e65cbf73abf99d0441ef67f5c540a42f7051dec6f");
+
+    T(sph_sha512, 64, 0, "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e");
+    T(sph_sha512, 64, 1, "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f");
+    T(sph_sha512, 64, 2, "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c33596fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445");
+    T(sph_sha512, 64, 3, "986058e9895e2c2ab8f9e8cbdf801db12a44842a56a91d5a4e87b1fc98b293722c4664142e42c3c551ff898646268cd92b84ed230b8c94bed7798d4f27cd7465");
+
+    T(sph_keccak512, 64, 0, "0eab42de4c3ceb9235fc91acffe746b29c29a8c366b7c60e4e67c466f36a4304c00fa9caf9d87976ba469bcbe06713b435f091ef2769fb160cdab33d3670680e");
+    T(sph_keccak512, 64, 1, "18587dc2ea106b9a1563e32b3312421ca164c7f1f07bc922a9c83d77cea3a1e5d0c69910739025372dc14ac9642629379540c17e2a65b19d77aa511a9d00bb96");
+    T(sph_keccak512, 64, 2, "6aa6d3669597df6d5a007b00d09c20795b5c4218234e1698a944757a488ecdc09965435d97ca32c3cfed7201ff30e070cd947f1fc12b9d9214c467d342bcba5d");
+    T(sph_keccak512, 64, 3, "f452d81b62b961f8023f8228cbe780379b36c49ddcef29e0dffb01a930c2cc53a694ed6ae3f0d224a2f1be55814a81841b90d56bcdf4a48a633f258a32dc14fc");
+
+    T(sph_whirlpool, 64, 0, "19fa61d75522a4669b44e39c1d2e1726c530232130d407f89afee0964997f7a73e83be698b288febcf88e3e03c4f0757ea8964e59b63d93708b138cc42a66eb3");
+    T(sph_whirlpool, 64, 1, "4e2448a4c6f486bb16b6562c73b4020bf3043e3a731bce721ae1b303d97e6d4c7181eebdb6c57e277d0e34957114cbd6c797fc9d95d8b582d225292076d4eef5");
+    T(sph_whirlpool, 64, 2, "526b2394d85683e24b29acd0fd37f7d5027f61366a1407262dc2a6a345d9e240c017c1833db1e6db6a46bd444b0c69520c856e7c6e9c366d150a7da3aeb160d1");
+    T(sph_whirlpool, 64, 3, "50cc69782191cb4bda8975391ee7307ba29911d617cc162286864ed40e1e426c90861ff3b48ad8ab966891ef4862441f8747ccbf4d38a0959a13bb9bece698d6");
+
+    T(sph_haval256_5, 32, 0, "be417bb4dd5cfb76c7126f4f8eeb1553a449039307b1a3cd451dbfdc0fbbe330");
+    T(sph_haval256_5, 32, 1, "976cd6254c337969e5913b158392a2921af16fca51f5601d486e0a9de01156e7");
+    T(sph_haval256_5, 32, 2, "dd745ad28c9c3e9f1c2f236f01652eedb0bc5ea4b1fe89ecfb86eed71f9f6f5b");
+    T(sph_haval256_5, 32, 3, "062ce277693e27f4b54ddc8ea56d8da3bf4b687142a3a598bcbd44bfd3fa44d5");
+
+    T(sph_tiger, 24, 0, "3293ac630c13f0245f92bbb1766e16167a4e58492dde73f3");
+    T(sph_tiger, 24, 1, "2aab1484e8c158f2bfb8c5ff41b57a525129131c957b5f93");
+    T(sph_tiger, 24, 2, "0f7bf9a19b9c58f2b7610df7e84f0ac3a71c631e7b53f78e");
+    T(sph_tiger, 24, 3, "687e2237754be9fc84489c01769f2a4358b41adf036b82e4");
+
+    T(sph_ripemd160, 20, 0, "9c1185a5c5e9fc54612808977ee8f548b2258d31");
+    T(sph_ripemd160, 20, 1, "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc");
+    T(sph_ripemd160, 20, 2, "12a053384a9c0c88e405a06c27dcf49ada62eb2b");
+    T(sph_ripemd160, 20, 3, "c315823ea8fe07a2dd18de4e545255afe3af0738");
+
+#undef T
+}
+
+static int Hash7MultiplyGMP(uint512 hash[7], unsigned char* data)
+{
+    mpz_t bn, product;
+    mpz_init(bn);
+    mpz_init_set_ui(product, 1);
+    for (int i = 0; i < 7; i++) {
+        uint512 n = (hash[i] == 0 ? uint512(1) : hash[i]);
+        mpz_set_uint512(bn, n);
+        mpz_mul(product, product, bn);
+    }
+    int bytes = mpz_sizeinbase(product, 256);
+    mpz_export(data, NULL, -1, 1, 0, 0, product);
+    mpz_clear(bn);
+    mpz_clear(product);
+    return bytes;
+}
+
+BOOST_AUTO_TEST_CASE(hash7_product)
+{
+    // Digest widths as Hash7 fills them: SHA256, SHA512, Keccak, Whirlpool, HAVAL, Tiger, RIPEMD
+    static const int widths[7] = { 32, 64, 64, 64, 32, 24, 20 };
+    for (int round = 0; round < 1000; round++) {
+        uint512 hash[7];
+        for (int i = 0; i < 7; i++) {
+            hash[i] = 0;
+            int mode = insecure_rand() % 8;
+            for (int j = 0; j < widths[i]; j++) {
+                unsigned char c = insecure_rand();
+                // Exercise zero digests, all-ones digests and short values
+                if (mode == 0 || (mode == 1 && j >= 3))
+                    c = 0;
+                else if (mode == 2)
+                    c = 0xff;
+                hash[i].begin()[j] = c;
+            }
+        }
+        unsigned char data[HASH7_PRODUCT_LIMBS * 8], expected[HASH7_PRODUCT_LIMBS * 8];
+        int bytes = Hash7Multiply(hash, data);
+        int expectedBytes = Hash7MultiplyGMP(hash, expected);
+        BOOST_CHECK_EQUAL(bytes, expectedBytes);
+        BOOST_CHECK(memcmp(data, expected, expectedBytes) == 0);
+    }
+
+    // The widest product the limb arrays have to hold
+    uint512 hash[7];
+    for (int i = 0; i < 7; i++)
+        hash[i] = ~uint512(0);
+    unsigned char data[HASH7_PRODUCT_LIMBS * 8], expected[HASH7_PRODUCT_LIMBS * 8];
+    BOOST_CHECK_EQUAL(Hash7Multiply(hash, data), HASH7_PRODUCT_LIMBS * 8);
+    BOOST_CHECK_EQUAL(Hash7MultiplyGMP(hash, expected), HASH7_PRODUCT_LIMBS * 8);
+    BOOST_CHECK(memcmp(data, expected, sizeof(data)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(hash7_midstate)
+{
+    CBlockHeader header;
+    for (unsigned int i = 0; i < sizeof(header.hashPrevBlock); i++) {
+        header.hashPrevBlock.begin()[i] = insecure_rand();
+        header.hashMerkleRoot.begin()[i] = insecure_rand();
+        header.hashAccountRoot.begin()[i] = insecure_rand();
+    }
+    header.nTime = 1400000000 + insecure_rand();
+    header.nHeight = insecure_rand();
+    header.nNonce = ((uint64_t)insecure_rand() << 32) | insecure_rand();
+
+    CHash7Midstate midstate;
+    header.GetHashMidstate(midstate);
+    for (int i = 0; i < 64; i++) {
+        header.nNonce += insecure_rand();
+        BOOST_CHECK(header.GetHash(midstate) == header.GetHash());
+    }
+
+    // A changed prefix needs a fresh midstate
+    header.nTime++;
+    BOOST_CHECK(header.GetHash(midstate) != header.GetHash());
+    header.GetHashMidstate(midstate);
+    BOOST_CHECK(header.GetHash(midstate) == header.GetHash());
+
+    const int nRounds = 2000;
+    uint256 hashBest = ~uint256(0);
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++) {
+        header.nNonce++;
+        hashBest = std::min(hashBest, header.GetHash());
+    }
+    int64_t nFull = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++) {
+        header.nNonce++;
+        hashBest = std::min(hashBest, header.GetHash(midstate));
+    }
+    int64_t nMidstate = GetTimeMicros() - nStart;
+    BOOST_CHECK(hashBest != 0);
+    BOOST_TEST_MESSAGE(strprintf("Hash7 x%d: full header %.2fms, from midstate %.2fms",
+                                 nRounds, 0.001 * nFull, 0.001 * nMidstate));
+}
+
+BOOST_AUTO_TEST_CASE(hash7_lanes)
+{
+    BOOST_TEST_MESSAGE(strprintf("Hash7 lane kernels: %s", Hash7LanesImplementation()));
+
+    // Prefixes and tails of every length up to a whole header, across all block boundaries
+    unsigned char prefix[200], tails[8][128];
+    const unsigned char* ptails[8];
+    for (int round = 0; round < 200; round++) {
+        size_t nPrefix = insecure_rand() % sizeof(prefix);
+        size_t nTail = round < 129 ? round : insecure_rand() % 129;
+        for (size_t i = 0; i < nPrefix; i++)
+            prefix[i] = insecure_rand();
+        for (int l = 0; l < 8; l++) {
+            for (size_t i = 0; i < nTail; i++)
+                tails[l][i] = insecure_rand();
+            ptails[l] = tails[l];
+        }
+        CHash7Midstate midstate(prefix, nPrefix);
+        uint256 hashes4[4], hashes8[8];
+        Hash7x4(midstate, ptails, nTail, hashes4);
+        Hash7x8(midstate, ptails, nTail, hashes8);
+        for (int l = 0; l < 8; l++) {
+            uint256 hash = midstate.Hash(tails[l], nTail);
+            BOOST_CHECK(hashes8[l] == hash);
+            if (l < 4)
+                BOOST_CHECK(hashes4[l] == hash);
+        }
+    }
+
+    // The miner's consecutive nonces and header sync's batches
+    CBlockHeader headers[8];
+    const CBlockHeader* pheaders[8];
+    for (int l = 0; l < 8; l++) {
+        for (unsigned int i = 0; i < sizeof(headers[l].hashPrevBlock); i++) {
+            headers[l].hashPrevBlock.begin()[i] = insecure_rand();
+            headers[l].hashMerkleRoot.begin()[i] = insecure_rand();
+            headers[l].hashAccountRoot.begin()[i] = insecure_rand();
+        }
+        headers[l].nTime = 1400000000 + insecure_rand();
+        headers[l].nHeight = insecure_rand();
+        headers[l].nNonce = ((uint64_t)insecure_rand() << 32) | insecure_rand();
+        pheaders[l] = &headers[l];
+    }
+    uint256 hashes[8];
+    CBlockHeader::GetHashes(pheaders, hashes);
+    for (int l = 0; l < 8; l++)
+        BOOST_CHECK(hashes[l] == headers[l].GetHash());
+
+    CBlockHeader header = headers[0];
+    CHash7Midstate midstate;
+    header.GetHashMidstate(midstate);
+    header.GetNonceHashes(midstate, hashes);
+    for (int l = 0; l < 8; l++) {
+        BOOST_CHECK(hashes[l] == header.GetHash());
+        header.nNonce++;
+    }
+
+    const int nRounds = 2000;
+    uint256 hashBest = ~uint256(0);
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++) {
+        header.nNonce++;
+        hashBest = std::min(hashBest, header.GetHash(midstate));
+    }
+    int64_t nScalar = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i += 8) {
+        header.GetNonceHashes(midstate, hashes);
+        header.nNonce += 8;
+        for (int l = 0; l < 8; l++)
+            hashBest = std::min(hashBest, hashes[l]);
+    }
+    int64_t nLanes = GetTimeMicros() - nStart;
+    BOOST_CHECK(hashBest != 0);
+    BOOST_TEST_MESSAGE(strprintf("Hash7 from midstate x%d: one at a time %.2fms, eight lanes %.2fms",
+                                 nRounds, 0.001 * nScalar, 0.001 * nLanes));
+}
+
+BOOST_AUTO_TEST_CASE(hash7_headers)
+{
+    std::vector<CBlockHeader> headers;
+    std::vector<std::string> expected;
+
+#define T(header, hash) do { \
+        CDataStream ss(ParseHex(header), SER_NETWORK, PROTOCOL_VERSION); \
+        headers.push_back(CBlockHeader()); \
+        ss >> headers.back(); \
+        expected.push_back(hash); \
+    } while (0)
+
+    // The main and test network genesis headers, then six headers chained on the
+    // main genesis block with the hashes the original GMP-based Hash7 gave them.
+    T("0100000000000000000000000000000000000000000000000000000000000000000079a9972778b99b4dd2754f6f71db2c2a1c1d0953ba02c589e8758169a380984607d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66ac472b9c5900000000000000000000000058fe1b0000000000",
+      "000000fb71ab34b45abb577ff3da985ad22039b3295b0b288cb8a5909cce18aa");
+    T("0100000000000000000000000000000000000000000000000000000000000000000079a9972778b99b4dd2754f6f71db2c2a1c1d0953ba02c589e8758169a380984607d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66ac482b9c59000000000000000000000000d6741f0000000000",
+      "000003457acdf89ff36923e317b8ac79f81cf882b23eff22b617a09799fea3aa");
+    T("0100aa18ce9c90a5b88c280b5b29b33920d25a98daf37f57bb5ab434ab71fb0000004bf5122f344554c53bde2ebb8cd2b7e3d1600ad631c385a5d7cce23c7785459a07d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66ac832b9c59000000000100000000000000157c4a7fb979379e",
+      "37d77abe4b5be2d566e7250645be374cd2953c90e531f74878f5a3c45de8dbfe");
+    T("0100fedbe85dc4a3f57848f731e5903c95d24c37be450625e766d5e25b4bbe7ad737dbc1b4c900ffe48d575b5da5c638040125f65db0fe3e24494b76ea986457d98607d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66acbf2b9c590000000002000000000000002af894fe72f36e3c",
+      "9b24d44316684ded9bb7fd29f3a878b2a7532d43d4b0efdc17f67eb53f3810fe");
+    T("0100fe10383fb57ef617dcefb0d4432d53a7b278a8f329fdb79bed4d681643d4249b084fed08b978af4d7d196a7446a86b58009e636b611db16211b65a9aadff29c507d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66acfb2b9c590000000003000000000000003f74df7d2c6da6da",
+      "bdb8f72337e17abce99f72d1a282e5d00d2966c408282492381c10ed8615c8e1");
+    T("0100e1c81586ed101c3892242808c466290dd0e582a2d1729fe9bc7ae13723f7b8bde52d9c508c502347344d8c07ad91cbd6068afc75ff6292f062a09ca381c89e7107d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66ac372c9c5900000000040000000000000054f029fde5e6dd78",
+      "51f90d89c9c7cb2f2005ee53cc6efbb67ab8d52168d1cc936cb46ba5afcf4222");
+    T("01002242cfafa56bb46c93ccd16821d5b87ab6fb6ecc53ee05202fcbc7c9890df951e77b9a9ae9e30b0dbdb6f510a264ef9de781501d7b6b92ae89eb059c5ab743db07d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66ac732c9c59000000000500000000000000696c747c9f601517",
+      "79b4861dce51eb9c4e878b7980f3492397fc0e2bbbf94e0148a47a64f5a48bf3");
+    T("0200f38ba4f5647aa448014ef9bb2b0efc972349f380798b874e9ceb51ce1d86b47967586e98fad27da0b9968bc039a1ef34c939b9b8e523a8bef89d478608c5ecf607d589e6cc0735cb2d341b4c7dd427a3fd13f08b4c8e35e7f7ec0d7ecd1f66acaf2c9c590000000006000000000000007ee8befb58da4cb5",
+      "46ad6ba8f64a147e3e5ae12289a2845eaabe47fee948f92d042eeee134ab24fa");
+
+#undef T
+
+    // Every path a header hash can take has to agree on them
+    const CBlockHeader* pheaders[8];
+    for (unsigned int i = 0; i < headers.size(); i++) {
+        BOOST_CHECK_EQUAL(headers[i].GetHash().GetHex(), expected[i]);
+        CHash7Midstate midstate;
+        headers[i].GetHashMidstate(midstate);
+        BOOST_CHECK_EQUAL(headers[i].GetHash(midstate).GetHex(), expected[i]);
+        pheaders[i] = &headers[i];
+    }
+    uint256 hashes[8];
+    CBlockHeader::GetHashes(pheaders, hashes);
+    for (int i = 0; i < 8; i++)
+        BOOST_CHECK_EQUAL(hashes[i].GetHex(), expected[i]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
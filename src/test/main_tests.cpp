@@ -2,8 +2,15 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "core.h"
+#include "key.h"
+#include "keystore.h"
 #include "main.h"
+#include "script.h"
+#include "util.h"
+
+#include <cmath>
 
 #include <boost/test/unit_test.hpp>
 
@@ -21,4 +28,194 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 2099999997690000ULL);
 }
 
+// The GMP versions GetTargetWork and GetBlockValue used to be computed with,
+// kept here so the fixed width replacements can be checked against them.
+static void mpz_set_uii(mpz_t &mpz, uint64_t v)
+{
+    mpz_import(mpz, 1, -1, sizeof(uint64_t), -1, 0, &v);
+}
+
+static uint64_t mpz_get_uii(mpz_t &mpz)
+{
+    uint64_t v[16];
+    mpz_export(v, 0, -1, sizeof(uint64_t), -1, 0, mpz);
+    return v[0];
+}
+
+static uint256 GetTargetWorkGMP(double nBits)
+{
+    uint256 target = Params().ProofOfWorkLimit().getuint256();
+    nBits *= (1LL<<52);
+
+    mpz_t mbits,mtarget,t;
+    mpz_init(mbits);
+    mpz_init(mtarget);
+    mpz_init(t);
+    mpz_set_d(mbits,nBits);
+    mpz_set_uint256(mtarget,target);
+    mpz_set_uii(t,(1LL<<52));
+    mpz_mul(mtarget,mtarget,t);
+    mpz_div(mtarget,mtarget,mbits);
+    mpz_get_uint256(mtarget,target);
+    mpz_clear(mbits);
+    mpz_clear(mtarget);
+    mpz_clear(t);
+    return target;
+}
+
+static uint64_t GetBlockValueGMP(uint64_t coinbase, uint64_t nFees)
+{
+    mpz_t mcb,mquot,t;
+    mpz_init(mcb);
+    mpz_init(mquot);
+    mpz_init(t);
+    mpz_set_uii(mcb,coinbase);
+    mpz_set_uii(t,243*COIN+10*CENT);
+    mpz_mul(mcb,mcb,t);
+    mpz_set_uii(t,MAX_MONEY);
+    mpz_div(mquot,mcb,t);
+    uint64_t value = mpz_get_uii(mquot);
+    mpz_clear(mcb);
+    mpz_clear(mquot);
+    mpz_clear(t);
+    return value + nFees;
+}
+
+BOOST_AUTO_TEST_CASE(target_work_gmp_test)
+{
+    BOOST_CHECK(GetTargetWork(1.0) == Params().ProofOfWorkLimit().getuint256());
+
+    for (int i = 1; i < 5000; i++) {
+        double nBits = 1.0 + i * 0.37;
+        BOOST_CHECK(GetTargetWork(nBits) == GetTargetWorkGMP(nBits));
+    }
+    for (int i = 0; i < 2000; i++) {
+        double nBits = 1.0 + (double)insecure_rand() * pow(10.0, i % 40);
+        BOOST_CHECK(GetTargetWork(nBits) == GetTargetWorkGMP(nBits));
+        // Second lookup comes from the cache
+        BOOST_CHECK(GetTargetWork(nBits) == GetTargetWorkGMP(nBits));
+    }
+    // Difficulties past the 512 bit intermediate still give a zero target
+    BOOST_CHECK(GetTargetWork(1e200) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(block_value_gmp_test)
+{
+    BOOST_CHECK(GetBlockValue(0, 0) == 0);
+    BOOST_CHECK((uint64_t)GetBlockValue(0, 12345) == 12345);
+    BOOST_CHECK((uint64_t)GetBlockValue(MAX_MONEY, 0) == GetBlockValueGMP(MAX_MONEY, 0));
+
+    for (int i = 0; i < 10000; i++) {
+        uint64_t coinbase = ((uint64_t)insecure_rand() << 32 | insecure_rand()) % MAX_MONEY;
+        uint64_t nFees = insecure_rand();
+        BOOST_CHECK((uint64_t)GetBlockValue(coinbase, nFees) == GetBlockValueGMP(coinbase, nFees));
+    }
+}
+
+static bool UndoEqual(const CTxUndo &a, const CTxUndo &b)
+{
+    return a.m_key == b.m_key && a.m_balance == b.m_balance && a.m_age == b.m_age &&
+           a.m_limit == b.m_limit && a.m_futurelimit == b.m_futurelimit &&
+           a.m_create == b.m_create && a.m_destroy == b.m_destroy;
+}
+
+BOOST_AUTO_TEST_CASE(block_undo_format_test)
+{
+    CBlockUndo undo;
+    for (int i = 0; i < 300; i++) {
+        CTxUndo txundo(uint160(i % 7 + 1));
+        if (i % 5 == 0) {
+            txundo.m_create = true;
+        } else {
+            txundo.m_balance = i * 1000;
+            txundo.m_age = (i % 3) ? 12000 + i : 0;
+            txundo.m_limit = (i % 4) ? UINT64_MAX : i;
+            txundo.m_futurelimit = (i % 6) ? txundo.m_limit : 2 * i;
+            txundo.m_destroy = (i % 9 == 0);
+        }
+        undo.vtxundo.push_back(txundo);
+    }
+
+    // Compact round trip
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << undo;
+    BOOST_CHECK_EQUAL(ss.size(), undo.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK(ss.size() < ::GetSerializeSize(undo.vtxundo, SER_DISK, CLIENT_VERSION));
+    CDataStream ssCopy(ss.begin(), ss.end(), SER_DISK, CLIENT_VERSION);
+    CBlockUndo undo2;
+    ss >> undo2;
+    BOOST_CHECK(undo2.nFormat == CBlockUndoCompressor::UNDO_FORMAT_COMPACT);
+    BOOST_REQUIRE_EQUAL(undo2.vtxundo.size(), undo.vtxundo.size());
+    for (unsigned int i = 0; i < undo.vtxundo.size(); i++)
+        BOOST_CHECK(UndoEqual(undo.vtxundo[i], undo2.vtxundo[i]));
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << undo2;
+    BOOST_CHECK(std::string(ss2.begin(), ss2.end()) == std::string(ssCopy.begin(), ssCopy.end()));
+
+    // Undo data written before the compact format is still read and re-encoded unchanged
+    CDataStream ssOld(SER_DISK, CLIENT_VERSION);
+    ssOld << undo.vtxundo;
+    std::string strOld(ssOld.begin(), ssOld.end());
+    CBlockUndo undo3;
+    ssOld >> undo3;
+    BOOST_CHECK(undo3.nFormat == CBlockUndoCompressor::UNDO_FORMAT_LEGACY);
+    BOOST_REQUIRE_EQUAL(undo3.vtxundo.size(), undo.vtxundo.size());
+    for (unsigned int i = 0; i < undo.vtxundo.size(); i++)
+        BOOST_CHECK(UndoEqual(undo.vtxundo[i], undo3.vtxundo[i]));
+    CDataStream ss3(SER_DISK, CLIENT_VERSION);
+    ss3 << undo3;
+    BOOST_CHECK(std::string(ss3.begin(), ss3.end()) == strOld);
+}
+
+// Many-input transactions used to be verified by re-hashing the transaction and
+// re-checking every input with the same key once per input. Check that verifying
+// once per transaction gives the same results, and report both timings.
+BOOST_AUTO_TEST_CASE(checkinputs_many_inputs_bench)
+{
+    const unsigned int nKeys = 40, nInputsPerKey = 10;
+    CBasicKeyStore keystore;
+    std::vector<uint160> vKeyIDs;
+    for (unsigned int i = 0; i < nKeys; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        vKeyIDs.push_back(key.GetPubKey().GetID());
+    }
+
+    CMutableTransaction txNew;
+    for (unsigned int i = 0; i < nKeys * nInputsPerKey; i++)
+        txNew.vin.push_back(CTxIn(vKeyIDs[i % nKeys], 1000 + i));
+    txNew.vout.push_back(CTxOut(1000, vKeyIDs[0]));
+    for (unsigned int i = 0; i < nKeys; i++)
+        BOOST_REQUIRE(SignSignature(keystore, vKeyIDs[i], txNew, i));
+    // Inputs sharing a key carry the same signature, the signature hash leaves out scriptSig
+    for (unsigned int i = nKeys; i < txNew.vin.size(); i++)
+        txNew.vin[i].scriptSig = txNew.vin[i % nKeys].scriptSig;
+
+    for (int nCase = 0; nCase < 2; nCase++) {
+        if (nCase == 1) {
+            // Corrupt one repeated input only
+            CScript &scriptSig = txNew.vin[txNew.vin.size() - 1].scriptSig;
+            scriptSig[10] ^= 0x55;
+        }
+        CTransaction tx(txNew);
+
+        int64_t nStart = GetTimeMicros();
+        bool fOld = true;
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            fOld = fOld && VerifyScript(tx.vin[i].scriptSig, tx.vin[i].pubKey, tx, i);
+        int64_t nOld = GetTimeMicros() - nStart;
+
+        nStart = GetTimeMicros();
+        CValidationState state;
+        bool fNew = CheckInputs(tx, state);
+        int64_t nNew = GetTimeMicros() - nStart;
+
+        BOOST_CHECK_EQUAL(fOld, nCase == 0);
+        BOOST_CHECK_EQUAL(fNew, fOld);
+        BOOST_TEST_MESSAGE(strprintf("%u inputs: per-input %.2fms, per-transaction %.2fms",
+                                     (unsigned)tx.vin.size(), 0.001 * nOld, 0.001 * nNew));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "core.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// A transaction from account nFrom paying 1000 to account nTo, distinct per nNonce
+static CTransaction MakeTx(int nFrom, int nTo, int nNonce)
+{
+    CMutableTransaction txNew;
+    txNew.vin.push_back(CTxIn(uint160(nFrom), 1000 + nNonce));
+    txNew.vin.back().scriptSig << vector<unsigned char>(65, nNonce & 0xff);
+    txNew.vout.push_back(CTxOut(1000, uint160(nTo)));
+    txNew.nLockHeight = nNonce;
+    return CTransaction(txNew);
+}
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+BOOST_AUTO_TEST_CASE(mempool_indexes)
+{
+    CTxMemPool pool;
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+
+    vector<CTransaction> vtx;
+    for (int i = 0; i < 20; i++) {
+        vtx.push_back(MakeTx(1 + i % 4, 100 + i, i));
+        const CTransaction &tx = vtx.back();
+        pool.addUnchecked(tx.GetTxID(), CTxMemPoolEntry(tx, tx.GetFee(), 1000 + i, 0, 1));
+    }
+    // Adding the same transaction again changes nothing
+    pool.addUnchecked(vtx[0].GetTxID(), CTxMemPoolEntry(vtx[0], vtx[0].GetFee(), 5000, 0, 1));
+
+    BOOST_CHECK_EQUAL(pool.mapTx.size(), 20);
+    BOOST_CHECK_EQUAL(pool.setFeeRate.size(), 20);
+    BOOST_CHECK_EQUAL(pool.setEntryTime.size(), 20);
+    BOOST_CHECK_EQUAL(pool.mapAccount.size(), 24);
+    BOOST_CHECK_EQUAL(pool.mapAccount[uint160(1)].size(), 5);
+    BOOST_CHECK_EQUAL(pool.mapSpends[uint160(1)], 1000 * 5 + 0 + 4 + 8 + 12 + 16);
+
+    vector<CTransaction> vAccount;
+    BOOST_CHECK(pool.lookup(uint160(2), vAccount));
+    BOOST_CHECK_EQUAL(vAccount.size(), 5);
+
+    size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 20 * sizeof(CTxMemPoolEntry));
+
+    // Removing everything takes the accounting back to zero
+    BOOST_FOREACH(const CTransaction &tx, vtx)
+        pool.remove(tx);
+    BOOST_CHECK_EQUAL(pool.mapTx.size(), 0);
+    BOOST_CHECK_EQUAL(pool.mapAccount.size(), 0);
+    BOOST_CHECK_EQUAL(pool.mapSpends.size(), 0);
+    BOOST_CHECK_EQUAL(pool.setFeeRate.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_trim)
+{
+    CTxMemPool pool;
+    vector<CTransaction> vtx;
+    for (int i = 0; i < 50; i++) {
+        vtx.push_back(MakeTx(1 + i, 1000 + i, i));
+        const CTransaction &tx = vtx.back();
+        // The fee grows with i, so does the fee rate
+        pool.addUnchecked(tx.GetTxID(), CTxMemPoolEntry(tx, tx.GetFee(), 1000 + i, 0, 1));
+    }
+    BOOST_CHECK_EQUAL(pool.GetMinFeePerK(), 0);
+
+    size_t nUsage = pool.DynamicMemoryUsage();
+    vector<CTransaction> vRemoved;
+    pool.TrimToSize(nUsage / 2, &vRemoved);
+    BOOST_CHECK(pool.DynamicMemoryUsage() <= nUsage / 2);
+    BOOST_REQUIRE(!vRemoved.empty());
+
+    // The lowest fee rates went first
+    for (unsigned int i = 0; i < vRemoved.size(); i++)
+        BOOST_CHECK(vRemoved[i].GetTxID() == vtx[i].GetTxID());
+    BOOST_CHECK(pool.exists(vtx.back().GetTxID()));
+
+    // New transactions now have to pay more than the evicted ones
+    int64_t nFeeEvicted = CTxMemPoolEntry(vRemoved.back(), vRemoved.back().GetFee(), 0, 0, 1).GetFeePerK();
+    BOOST_CHECK(pool.GetMinFeePerK() > nFeeEvicted);
+
+    // Expiry by entry time
+    BOOST_CHECK_EQUAL(pool.Expire(1000 + 40), 40 - (int)vRemoved.size());
+    BOOST_CHECK_EQUAL(pool.mapTx.size(), 10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,7 +2,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "core.h"
 #include "serialize.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -160,4 +162,81 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+// The copying encoder CTransaction used before, kept to check the bytes did not change
+static void SerializeTxLegacy(CDataStream &ss, const CTransaction &tx)
+{
+    std::vector<CTxIn> vint = tx.vin;
+    std::vector<CTxOut> voutt = tx.vout;
+    if (tx.fSetLimit) {
+        vint[0].nValue += tx.nLimitValue;
+        voutt[0].nValue += tx.nLimitValue;
+    }
+    ss << tx.nVersion << vint << voutt << tx.feedback << tx.url << tx.token << tx.tvalue << tx.txType << tx.nLockHeight;
+}
+
+BOOST_AUTO_TEST_CASE(transaction_serialize)
+{
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction txNew;
+        if (i == 2) {
+            // Set withdrawal limit
+            txNew.nLimitValue = 5000;
+            txNew.fSetLimit = true;
+            txNew.vin.push_back(CTxIn(uint160(42), 100));
+            txNew.vout.push_back(CTxOut(0, uint160(42)));
+        } else {
+            for (int j = 0; j < 50 * (i + 1); j++) {
+                txNew.vin.push_back(CTxIn(uint160(j + 1), 1000 + j));
+                txNew.vin.back().scriptSig << std::vector<unsigned char>(72, j);
+                txNew.vout.push_back(CTxOut(900 + j, uint160(j + 1000)));
+            }
+        }
+        txNew.nLockHeight = 1234 + i;
+        txNew.txType = i;
+        vtx.push_back(CTransaction(txNew));
+    }
+
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        const CTransaction &tx = vtx[i];
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION), ssLegacy(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+        SerializeTxLegacy(ssLegacy, tx);
+        BOOST_CHECK(std::string(ss.begin(), ss.end()) == std::string(ssLegacy.begin(), ssLegacy.end()));
+        BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+
+        CTransaction tx2;
+        ss >> tx2;
+        BOOST_CHECK(tx2.GetHash() == tx.GetHash());
+        BOOST_CHECK(tx2.vin == tx.vin);
+        BOOST_CHECK(tx2.vout == tx.vout);
+        BOOST_CHECK_EQUAL(tx2.fSetLimit, tx.fSetLimit);
+        BOOST_CHECK_EQUAL(tx2.nLimitValue, tx.nLimitValue);
+    }
+
+    // Benchmark, size computation and serialization of the larger transaction
+    const CTransaction &tx = vtx[1];
+    const int nRounds = 2000;
+    unsigned int nTotal = 0;
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        SerializeTxLegacy(ss, tx);
+        nTotal += ss.size();
+    }
+    int64_t nLegacy = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++) {
+        nTotal += ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+        nTotal += ss.size();
+    }
+    int64_t nNew = GetTimeMicros() - nStart;
+    BOOST_CHECK(nTotal > 0);
+    BOOST_TEST_MESSAGE(strprintf("%u byte transaction x%d: copying %.2fms, streaming (with size) %.2fms",
+                                 (unsigned)::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), nRounds,
+                                 0.001 * nLegacy, 0.001 * nNew));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+// Copyright (c) 2014 The Mini-Blockchain Project
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "uint256.h"
+#include "trie.h"
+#include "util.h"
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static TrieNode* NewLeaf(uint160 key, uint64_t balance, uint64_t age)
+{
+    TrieNode* node = new TrieNode(NODE_LEAF);
+    node->SetKey(key);
+    node->SetBalance(balance);
+    node->SetAge(age);
+    return node;
+}
+
+// Random keys, some of them short so they share long prefixes
+static uint160 RandKey()
+{
+    uint160 key;
+    for (unsigned char* p = key.begin(); p != key.end(); p++)
+        *p = insecure_rand();
+    if (insecure_rand() % 3 == 0)
+        key = key >> (insecure_rand() % 150);
+    return key;
+}
+
+// Root hash of a trie built from scratch out of the accounts
+static uint256 HashAccounts(const map<uint160, pair<uint64_t, uint64_t> >& accounts)
+{
+    TrieNode* root = NULL;
+    for (map<uint160, pair<uint64_t, uint64_t> >::const_iterator it = accounts.begin(); it != accounts.end(); ++it)
+        TrieEngine::Insert(&root, NewLeaf(it->first, it->second.first, it->second.second));
+    uint256 hash = root ? root->Hash() : 0;
+    delete root;
+    return hash;
+}
+
+BOOST_AUTO_TEST_SUITE(trie_tests)
+
+// The overlay has to hash like the trie the same changes would have produced,
+// without touching the committed one
+BOOST_AUTO_TEST_CASE(trie_overlay)
+{
+    for (int i = 0; i < 100; i++) {
+        map<uint160, pair<uint64_t, uint64_t> > accounts;
+        TrieNode* root = NULL;
+        int nAccounts = insecure_rand() % 200 + 1;
+        for (int j = 0; j < nAccounts; j++) {
+            uint160 key = RandKey();
+            if (accounts.count(key))
+                continue;
+            accounts[key] = make_pair(j + 1, j % 7);
+            TrieEngine::Insert(&root, NewLeaf(key, j + 1, j % 7));
+        }
+        uint256 hashCommitted = root->Hash();
+
+        TrieOverlay overlay(root);
+        BOOST_CHECK(overlay.Hash() == hashCommitted);
+        for (int j = 0; j < 50; j++) {
+            map<uint160, pair<uint64_t, uint64_t> >::iterator it = accounts.begin();
+            if (!accounts.empty())
+                std::advance(it, insecure_rand() % accounts.size());
+            switch (insecure_rand() % 3) {
+            case 0: {
+                uint160 key = RandKey();
+                if (accounts.count(key))
+                    break;
+                BOOST_CHECK(overlay.Find(key) == NULL);
+                overlay.Insert(NewLeaf(key, 1000 + j, 3));
+                accounts[key] = make_pair(1000 + j, 3);
+                break;
+            }
+            case 1:
+                if (it == accounts.end())
+                    break;
+                overlay.Remove(overlay.Find(it->first));
+                BOOST_CHECK(overlay.Find(it->first) == NULL);
+                accounts.erase(it);
+                break;
+            default:
+                if (it == accounts.end())
+                    break;
+                overlay.Find(it->first)->SetBalance(5000 + j);
+                it->second.first = 5000 + j;
+            }
+            // Hashing again after every few changes only rehashes their paths
+            if (insecure_rand() % 4 == 0)
+                BOOST_CHECK(overlay.Hash() == HashAccounts(accounts));
+        }
+        BOOST_CHECK(overlay.Hash() == HashAccounts(accounts));
+        BOOST_CHECK(root->Hash() == hashCommitted);
+        delete root;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -262,20 +262,22 @@ uint256_t TrieNode::Hash(){
 	m_modified=false;
 
 	//need to hash key, key_bits, left hash and right hash
-	uint256_t left = m_left->Hash();
-	uint256_t right = m_right->Hash();
+	return m_hash = HashBranch(m_key, m_key_bits, m_left->Hash(), m_right->Hash());
+}
+
+uint256_t HashBranch(uint160_t key, uint32_t bits, uint256_t left, uint256_t right){
 	SHA256_CTX ctx;
 	SHA256_Init(&ctx);
-	SHA256_Update(&ctx, &m_key, sizeof(m_key));	
-	SHA256_Update(&ctx, &m_key_bits, sizeof(m_key_bits));
+	SHA256_Update(&ctx, &key, sizeof(key));	
+	SHA256_Update(&ctx, &bits, sizeof(bits));
 	SHA256_Update(&ctx, &left, sizeof(left));
 	SHA256_Update(&ctx, &right, sizeof(right));
 
-	uint256_t hash1;
+	uint256_t hash1, hash;
 	SHA256_Final((unsigned char*)&hash1, &ctx);
-        SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&m_hash);
+        SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash);
 	
-	return m_hash;
+	return hash;
 }
 
 //Serialize
@@ -6,6 +6,7 @@
 #define TRIE_H
 
 #include <list>
+#include <vector>
 
 using namespace std;
 
@@ -101,6 +102,41 @@ public:
 	static void TraverseRight(TrieNode *rightnode, uint160_t left, uint160_t right, list<TrieNode*> *rights, int bits);
 };
 
+//Pending account changes layered over a committed trie without modifying it. Leaves
+//handed out by Find are copies the caller may change until the next Hash, which only
+//rehashes the paths of accounts found, inserted or removed since the previous call.
+class TrieOverlay {
+public:
+	TrieOverlay(TrieNode *root);
+	~TrieOverlay();
+	TrieNode* Find(uint160_t key);
+	void Insert(TrieNode *node);
+	void Remove(TrieNode *node);
+	uint256_t Hash();
+private:
+	enum { OVERLAY_COMMITTED, OVERLAY_LEAF, OVERLAY_BRANCH };
+	struct Node {
+		uint32_t type;
+		TrieNode *trie; //committed subtree or leaf copy
+		uint160_t prefix; //key bits above the split, branches only
+		uint32_t split; //bit a branch splits on
+		Node *left, *right;
+		uint256_t hash;
+		int32_t hashDepth; //depth the hash was computed at, -1 when dirty
+	};
+
+	Node* NewNode(uint32_t type, TrieNode *trie);
+	void Expand(Node *node, uint32_t depth, uint160_t base);
+	Node* Walk(uint160_t key, uint32_t &depth);
+	void Put(Node *&slot, uint32_t depth, uint160_t key, TrieNode *leaf);
+	uint256_t Hash(Node *node, uint32_t depth);
+
+	Node *m_root;
+	vector<Node*> m_nodes;
+	vector<TrieNode*> m_leaves;
+};
+
+uint256_t HashBranch(uint160_t key, uint32_t bits, uint256_t left, uint256_t right);
 void SerializeHash(uint8_t *dst, uint32_t *pos, uint160_t hash);
 void DeserializeHash(uint160_t *hash, uint8_t *src);
 void SerializeHash(uint8_t *dst, uint32_t *pos, uint256_t hash);
@@ -406,3 +406,171 @@ TrieNode* TrieEngine::Find(uint160_t key, TrieNode *root, uint32_t keybits){
 	}
 	return 0;
 }
+
+//Number of leading bits two keys have in common
+static uint32_t common_bits(uint160_t a, uint160_t b){
+	return 160 - (a ^ b).bits();
+}
+
+static uint160_t key_bit(uint32_t shift){
+	return ((uint160_t)1) << (159 - shift);
+}
+
+TrieOverlay::TrieOverlay(TrieNode *root){
+	m_root = root ? NewNode(OVERLAY_COMMITTED, root) : 0;
+	if(m_root)
+		Expand(m_root, 0, 0);
+}
+
+TrieOverlay::~TrieOverlay(){
+	for(size_t i=0; i < m_nodes.size(); i++)
+		delete m_nodes[i];
+	for(size_t i=0; i < m_leaves.size(); i++)
+		delete m_leaves[i];
+}
+
+TrieOverlay::Node* TrieOverlay::NewNode(uint32_t type, TrieNode *trie){
+	Node *node = new Node();
+	node->type = type;
+	node->trie = trie;
+	node->prefix = 0;
+	node->split = 0;
+	node->left = node->right = 0;
+	node->hashDepth = -1;
+	m_nodes.push_back(node);
+	return node;
+}
+
+//Turn a committed branch into an overlay branch over its two committed children. Committed
+//branches are expanded before they move, so their own hash is only ever used at their depth.
+void TrieOverlay::Expand(Node *node, uint32_t depth, uint160_t base){
+	if(node->type != OVERLAY_COMMITTED || node->trie->Type() != NODE_BRANCH)
+		return;
+	TrieNode *branch = node->trie;
+	node->type = OVERLAY_BRANCH;
+	node->split = depth + branch->Bits();
+	node->prefix = base | branch->Key();
+	node->left = NewNode(OVERLAY_COMMITTED, branch->m_left);
+	node->right = NewNode(OVERLAY_COMMITTED, branch->m_right);
+	node->hash = branch->Hash();
+	node->hashDepth = depth;
+}
+
+//Follow key down the overlay, marking the branches on the way as dirty. Returns the leaf or
+//committed subtree key would be in and its depth, or null if it is in none.
+TrieOverlay::Node* TrieOverlay::Walk(uint160_t key, uint32_t &depth){
+	Node *node = m_root;
+	depth = 0;
+	while(node && node->type == OVERLAY_BRANCH){
+		if(common_bits(key, node->prefix) < node->split)
+			return 0;
+		node->hashDepth = -1;
+		depth = node->split + 1;
+		node = high_bit(key, node->split) ? node->right : node->left;
+	}
+	return node;
+}
+
+//Set the leaf for key, or remove it when leaf is null
+void TrieOverlay::Put(Node *&slot, uint32_t depth, uint160_t key, TrieNode *leaf){
+	if(!slot){
+		if(leaf)
+			slot = NewNode(OVERLAY_LEAF, leaf);
+		return;
+	}
+
+	Expand(slot, depth, sub_key(key, 0, depth));
+	uint160_t other;
+	if(slot->type == OVERLAY_BRANCH){
+		if(common_bits(key, slot->prefix) >= slot->split){
+			slot->hashDepth = -1;
+			bool fRight = high_bit(key, slot->split);
+			Node *&child = fRight ? slot->right : slot->left;
+			Put(child, slot->split + 1, key, leaf);
+			if(!child){
+				//Branch lost a side, the other one takes its place
+				Node *peer = fRight ? slot->left : slot->right;
+				uint160_t base = sub_key(key, 0, slot->split);
+				if(!fRight)
+					base = base | key_bit(slot->split);
+				Expand(peer, slot->split + 1, base);
+				slot = peer;
+			}
+			return;
+		}
+		other = slot->prefix;
+	}else{
+		other = slot->trie->Key();
+		if(other == key){
+			slot = leaf ? NewNode(OVERLAY_LEAF, leaf) : 0;
+			return;
+		}
+	}
+
+	//key is not under slot, so a new branch goes above it
+	if(!leaf)
+		return;
+	Node *branch = NewNode(OVERLAY_BRANCH, 0);
+	branch->split = common_bits(key, other);
+	branch->prefix = sub_key(key, 0, branch->split);
+	Node *node = NewNode(OVERLAY_LEAF, leaf);
+	if(high_bit(key, branch->split)){
+		branch->left = slot;
+		branch->right = node;
+	}else{
+		branch->left = node;
+		branch->right = slot;
+	}
+	slot = branch;
+}
+
+TrieNode* TrieOverlay::Find(uint160_t key){
+	uint32_t depth;
+	Node *node = Walk(key, depth);
+	if(!node)
+		return 0;
+	if(node->type == OVERLAY_LEAF)
+		return node->trie->Key() == key ? node->trie : 0;
+
+	TrieNode *found = TrieEngine::Find(key, node->trie, depth);
+	if(!found)
+		return 0;
+	TrieNode *copy = new TrieNode(NODE_LEAF);
+	copy->SetKey(found->Key());
+	copy->SetAge(found->Age());
+	copy->SetBalance(found->Balance());
+	copy->SetLimit(found->Limit());
+	copy->SetFutureLimit(found->FutureLimit());
+	m_leaves.push_back(copy);
+	Put(m_root, 0, key, copy);
+	return copy;
+}
+
+//Takes ownership of node
+void TrieOverlay::Insert(TrieNode *node){
+	m_leaves.push_back(node);
+	Put(m_root, 0, node->Key(), node);
+}
+
+//node must have come from Find or Insert, it stays valid until the overlay is destroyed
+void TrieOverlay::Remove(TrieNode *node){
+	Put(m_root, 0, node->Key(), 0);
+}
+
+uint256_t TrieOverlay::Hash(){
+	if(!m_root)
+		return 0;
+	return Hash(m_root, 0);
+}
+
+uint256_t TrieOverlay::Hash(Node *node, uint32_t depth){
+	if(node->type != OVERLAY_BRANCH)
+		return node->trie->Hash();
+	if(node->hashDepth == (int32_t)depth)
+		return node->hash;
+	uint32_t bits = node->split - depth;
+	node->hash = HashBranch(sub_key(node->prefix, depth, bits), bits,
+				Hash(node->left, node->split + 1), Hash(node->right, node->split + 1));
+	node->hashDepth = depth;
+	return node->hash;
+}
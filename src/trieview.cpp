@@ -15,6 +15,7 @@ TrieView::TrieView(){
     //TODO: load the crap from file
     m_bestBlock = 0;  
     m_root = 0;
+    m_fAllChanged = true;
 
     boost::filesystem::path pathDebug = GetDataDir() / "trie.dat";
     printf("Opening %s\n", pathDebug.string().c_str());
@@ -40,6 +41,7 @@ void TrieView::Force(TrieNode *root, uint256 block){
 	delete m_root;
     m_root = root;
     m_bestBlock = block;
+    m_fAllChanged = true;
     Flush();
 }
 
@@ -152,8 +154,17 @@ bool TrieView::Activate(CBlockIndex *pindex, uint256 &badBlock){
     sortSet(newSet,newVector);
     reverse(oldVector.begin(), oldVector.end());
 	
+    //Read ahead of the undo data and blocks about to be used
+    int nPrefetch = blockCache.PrefetchWindow();
+    for(int i = 0; i < nPrefetch && i < (int)oldVector.size(); i++)
+	blockCache.Prefetch(oldVector[i].second, true);
+    for(int i = 0; i < nPrefetch && i < (int)newVector.size(); i++)
+	blockCache.Prefetch(newVector[i].second);
+
     vector<pair<uint64_t,CBlockIndex*> >::iterator it2;
     for(it2 = oldVector.begin(); it2 != oldVector.end(); it2++){
+	if(nPrefetch && oldVector.end() - it2 > nPrefetch)
+	    blockCache.Prefetch((it2 + nPrefetch)->second, true);
     	CBlockUndo blockUndo;
     	CDiskBlockPos pos = (*it2).second->GetUndoPos();
     	if (pos.IsNull())
@@ -166,10 +177,13 @@ bool TrieView::Activate(CBlockIndex *pindex, uint256 &badBlock){
 	    undos.push_back(*it3);
 	}
 	Unapply(undos);
+	MarkChanged(undos);
 	m_bestBlock = it2->second->GetBlockHash();
     }    
 
     for(it2 = newVector.begin(); it2 != newVector.end(); it2++){
+	if(nPrefetch && newVector.end() - it2 > nPrefetch)
+	    blockCache.Prefetch((it2 + nPrefetch)->second);
         //if for some reason we have a failure, we need to unwind all previously 
         //completed actions before return
 	if(!Apply((*it2).second)){
@@ -184,13 +198,26 @@ bool TrieView::Activate(CBlockIndex *pindex, uint256 &badBlock){
 
 #define MIN_BALANCE 1
 
-bool TrieView::TempApply(CBlock block, list<CTxUndo> &undos){
+//The committed trie behind the same interface as TrieOverlay
+class TrieRootStore {
+public:
+    TrieRootStore(TrieNode **ppRoot) : m_ppRoot(ppRoot) {}
+    TrieNode* Find(uint160 key) { return TrieEngine::Find(key, *m_ppRoot); }
+    void Insert(TrieNode *node) { TrieEngine::Insert(m_ppRoot, node); }
+    void Remove(TrieNode *node) { TrieEngine::Remove(m_ppRoot, node); }
+private:
+    TrieNode **m_ppRoot;
+};
+
+//Apply the tx's of block to the accounts in store, recording how to undo them
+template<typename TrieStore>
+static bool ApplyBlock(TrieStore &store, const CBlock &block, list<CTxUndo> &undos){
     map<uint160,uint64_t> limits;
     set<uint160> setLimit, setTxIn;
 
     BOOST_FOREACH(const CTransaction &tx, block.vtx){
 		if(tx.IsCoinBase()){
-			TrieNode* node = TrieEngine::Find(0, m_root);
+			TrieNode* node = store.Find(0);
 			uint64_t coinb=0;
 			if(node)
 			coinb = node->Balance();  
@@ -206,7 +233,7 @@ bool TrieView::TempApply(CBlock block, list<CTxUndo> &undos){
 		}
 
 		BOOST_FOREACH(const CTxIn& txin, tx.vin){
-			TrieNode* node = TrieEngine::Find(txin.pubKey, m_root);
+			TrieNode* node = store.Find(txin.pubKey);
 			if(!node){
 			LogPrintf("Failed to find node for %s\n", txin.pubKey.GetHex().c_str());
 			return false;
@@ -273,15 +300,15 @@ bool TrieView::TempApply(CBlock block, list<CTxUndo> &undos){
 				
 			node->SetBalance(node->Balance() - txin.nValue);
 			if(node->Balance() < MIN_BALANCE){
-			TrieEngine::Remove(&m_root,node);
+			store.Remove(node);
 			undo.m_destroy=true;
 			}
 			undos.push_back(undo);
 		}
 		
 		BOOST_FOREACH(const CTxOut& txout, tx.vout){
-			TrieNode* node = TrieEngine::Find(txout.pubKey, m_root);
-			TrieNode* rootnode = TrieEngine::Find(0, m_root);
+			TrieNode* node = store.Find(txout.pubKey);
+			TrieNode* rootnode = store.Find(0);
 			bool isRoot=false;
 			uint64_t addToRoot=0; 
 			
@@ -304,7 +331,7 @@ bool TrieView::TempApply(CBlock block, list<CTxUndo> &undos){
 					if(node->Balance() <= txout.nValue){
 						if(!isRoot){
 							node->SetBalance(0);
-							TrieEngine::Remove(&m_root,node);
+							store.Remove(node);
 							undo.m_destroy=true;
 							addToRoot=txout.nValue+node->Balance();
 							std::cout << " Node " << node->Key().GetHex() << " balance <= " << txout.nValue << " , can't set negative or zero node, delete node from trie" << std::endl;
@@ -331,7 +358,7 @@ bool TrieView::TempApply(CBlock block, list<CTxUndo> &undos){
 					node->SetAge(block.nHeight);
 					node->SetBalance(txout.nValue);
 					std::cout << " Create new node "<< txout.pubKey.GetHex() <<" in trie witch balance= "<< txout.nValue  << std::endl;
-					TrieEngine::Insert(&m_root,node);
+					store.Insert(node);
 					CTxUndo undo(node->Key());
 					undo.m_create = true;
 					undos.push_back(undo);
@@ -357,6 +384,11 @@ bool TrieView::TempApply(CBlock block, list<CTxUndo> &undos){
     return true;
 }
 
+bool TrieView::TempApply(CBlock block, list<CTxUndo> &undos){
+    TrieRootStore store(&m_root);
+    return ApplyBlock(store, block, undos);
+}
+
 bool TrieView::Unapply(list<CTxUndo> &undos){
     list<CTxUndo>::iterator it;
     for(it=undos.begin(); it!= undos.end(); it++){
@@ -393,13 +425,40 @@ bool TrieView::HashForBlock(CBlock block, uint256 &hash){
 	LogPrintf("HashForBlock(): m_bestBlock hashPrevBlock mismatch!");
 	return false;
     }
+    //Apply to an overlay, the committed trie stays as it is
+    TrieOverlay overlay(m_root);
     list<CTxUndo> undos;
+    if(!ApplyBlock(overlay,block,undos))
+	return false;
+    hash = overlay.Hash();
+    return true;
+}
+
+//Apply a block for -replaybench like Apply does, timing TempApply and the root hash
+//separately. The undo data is handed back instead of written, the caller times that.
+bool TrieView::ReplayBlock(const CBlock &block, CBlockIndex *pindex, list<CTxUndo> &undos, int64_t &nTimeApply, int64_t &nTimeHash){
+    LOCK(cs_main);
+
+    if(m_bestBlock != block.hashPrevBlock)
+	return error("ReplayBlock(): m_bestBlock hashPrevBlock mismatch");
+
+    int64_t nStart = GetTimeMicros();
     if(!TempApply(block,undos)){
 	Unapply(undos);
-	return false;
-    }   
-    hash = m_root->Hash();
-    Unapply(undos);
+	return error("ReplayBlock(): could not apply tx's of %s", pindex->GetBlockHash().GetHex().c_str());
+    }
+    nTimeApply = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    uint256 hash = m_root->Hash();
+    nTimeHash = GetTimeMicros() - nStart;
+
+    if(hash != block.hashAccountRoot){
+	Unapply(undos);
+	return error("ReplayBlock(): master hash mismatch: %s %s %s", pindex->GetBlockHash().GetHex().c_str(),
+		hash.GetHex().c_str(), block.hashAccountRoot.GetHex().c_str());
+    }
+    m_bestBlock = pindex->GetBlockHash();
     return true;
 }
 
@@ -457,15 +516,30 @@ bool TrieView::Apply(CBlockIndex *pindex){
 
         pindex->nStatus = (pindex->nStatus & ~BLOCK_VALID_MASK) | BLOCK_VALID_SCRIPTS;
 
-        CDiskBlockIndex blockindex(pindex);
-        if (!pblocktree->WriteBlockIndex(blockindex))
+        if (!blockCache.WriteBlockIndex(pindex))
             return error("Failed to write block index");
     }
 
+    MarkChanged(undos);
     m_bestBlock = pindex->GetBlockHeader().GetHash();   
     return true;
 }
 
+void TrieView::MarkChanged(const list<CTxUndo> &undos){
+    if(m_fAllChanged)
+	return;
+    for(list<CTxUndo>::const_iterator it = undos.begin(); it != undos.end(); it++)
+	m_changed.insert(it->m_key);
+}
+
+void TrieView::GetChangedAccounts(set<uint160> &setChanged, bool &fAll){
+    LOCK(cs_main);
+    setChanged.clear();
+    setChanged.swap(m_changed);
+    fAll = m_fAllChanged;
+    m_fAllChanged = false;
+}
+
 bool TrieView::BalancesAt(CBlockIndex* pindex, vector<uint160> hashes, vector<CActInfo> &balances){
     LOCK(cs_main);
     uint256 oldHash = m_bestBlock;
@@ -555,7 +629,7 @@ bool TrieView::ComplexBalances(int nMineConf, int nTheirsConf, vector<uint160> h
 		CBlock block=blocks[i];
 		for(vector<CTransaction>::iterator it3=block.vtx.begin(); it3!=block.vtx.end(); it3++){
 		    CTransaction tx = *it3;
-		    for(vector<CTxOut>::iterator it4=tx.vout.begin(); it4!=tx.vout.end(); it4++){
+		    for(vector<CTxOut>::const_iterator it4=tx.vout.begin(); it4!=tx.vout.end(); it4++){
 			CTxOut txout = *it4;
 			if(txout.pubKey == *it && (i<(nMineConf-1) || !pwalletMain->IsFromMe(tx))){
 			    deps+=txout.nValue;
@@ -574,7 +648,7 @@ bool TrieView::ComplexBalances(int nMineConf, int nTheirsConf, vector<uint160> h
 		CTransaction tx = *it2;
 		if(!IsFinalTx(tx))
 		    continue;
-		for(vector<CTxIn>::iterator it3=tx.vin.begin(); it3!=tx.vin.end(); it3++){
+		for(vector<CTxIn>::const_iterator it3=tx.vin.begin(); it3!=tx.vin.end(); it3++){
 		    CTxIn txin=*it3;
 		    //printf("%s,%s %ld\n", txin.pubKey.GetHex().c_str(), it->GetHex().c_str(), txin.nValue);
 		    if(txin.pubKey == *it){
@@ -582,7 +656,7 @@ bool TrieView::ComplexBalances(int nMineConf, int nTheirsConf, vector<uint160> h
 			age = chainActive.Height() + 1;
 		    }
 		}
-		for(vector<CTxOut>::iterator it3=tx.vout.begin(); it3!=tx.vout.end(); it3++){
+		for(vector<CTxOut>::const_iterator it3=tx.vout.begin(); it3!=tx.vout.end(); it3++){
 		    CTxOut txout=*it3;
 		    if(txout.pubKey == *it){
 			if((pwalletMain->IsFromMe(tx) && nMineConf==0) || nTheirsConf==0)
@@ -676,6 +750,11 @@ uint32_t TrieView::GetSlice(uint256 block, uint160 left, uint160 right, uint8_t
 
 bool TrieView::Flush(){
     LOCK(cs_main);
+    //The index status, undo positions and txindex entries of the blocks applied to the
+    //trie are still queued in the block cache. They go to disk first, a trie.dat ahead
+    //of them would refer to blocks the index knows nothing about after a crash.
+    if(!blockCache.Sync())
+	return error("TrieView::Flush() : failed to sync the block index");
     LogPrintf("Writing file %s\n", m_bestBlock.GetHex().c_str());
     //TODO: this sucks. need to move to mmap asap
     boost::filesystem::path pathDebug = GetDataDir() / "trie.dat";
@@ -78,12 +78,19 @@ public:
     uint64_t CoinAge(uint160 pubKey);
     bool HashForBlock(CBlock block, uint256 &hash);
     uint32_t GetSlice(uint256 block, uint160 left, uint160 right, uint8_t *buf, uint32_t sz, uint32_t *nodes);
+    bool ReplayBlock(const CBlock &block, CBlockIndex *pindex, list<CTxUndo> &undos, int64_t &nTimeApply, int64_t &nTimeHash);
+    //Accounts applied or unapplied since the last call, so the mempool only has to recheck
+    //transactions touching them. fAll is set when the whole trie was replaced.
+    void GetChangedAccounts(set<uint160> &setChanged, bool &fAll);
 
 private:
     bool TempApply(CBlock block, list<CTxUndo> &undos);
     bool Unapply(list<CTxUndo> &undos);
+    void MarkChanged(const list<CTxUndo> &undos);
 
     uint256 m_bestBlock;
+    set<uint160> m_changed;
+    bool m_fAllChanged;
     bool Apply(CBlockIndex *pindex);
     TrieNode *m_root;
 };
@@ -12,7 +12,7 @@
 
 using namespace std;
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe), fTxFilter(false), nTxFilterErased(0) {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
@@ -20,6 +20,14 @@ bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
+bool CBlockTreeDB::WriteBlockIndex(const std::vector<CDiskBlockIndex> &vect)
+{
+    CLevelDBBatch batch;
+    for (std::vector<CDiskBlockIndex>::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair('b', it->GetBlockHash()), *it);
+    return WriteBatch(batch, true);
+}
+
 bool CBlockTreeDB::WriteBestInvalidWork(const CBigNum& bnBestInvalidWork)
 {
     // Obsolete; only written for backward compatibility.
@@ -63,6 +71,11 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_txfilter);
+        if (fTxFilter && !txfilter.contains(txid))
+            return false;
+    }
     return Read(make_pair('t', txid), pos);
 }
 
@@ -70,13 +83,117 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     CLevelDBBatch batch;
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair('t', it->first), it->second);
+
+    // The filter is updated before the write, and a rebuild can't run in between
+    boost::unique_lock<boost::shared_mutex> lock(cs_txfilter);
+    if (fTxFilter) {
+        if (txfilter.size() + vect.size() > txfilter.capacity())
+            RebuildTxIndexFilter(vect.size());
+        for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+            txfilter.insert(it->first);
+    }
     return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::EraseTxIndex(uint256 key) {
-    return Erase(make_pair('t',key));
+    return EraseTxIndex(std::vector<uint256>(1, key));
+}
+
+bool CBlockTreeDB::EraseTxIndex(const std::vector<uint256> &vect) {
+    CLevelDBBatch batch;
+    for (std::vector<uint256>::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(make_pair('t', *it));
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_txfilter);
+    if (!WriteBatch(batch))
+        return false;
+    // Erased txids stay in the filter as false positives until the next rebuild
+    nTxFilterErased += vect.size();
+    if (fTxFilter && nTxFilterErased > max(txfilter.size() / 2, MIN_TXINDEX_FILTER / 4))
+        RebuildTxIndexFilter(0);
+    return true;
 }
 
+bool CBlockTreeDB::WriteUpdate(const CBlockTreeUpdate &update) {
+    CLevelDBBatch batch;
+    for (std::map<uint256, CDiskBlockIndex>::const_iterator it=update.mapBlocks.begin(); it!=update.mapBlocks.end(); it++)
+        batch.Write(make_pair('b', it->first), it->second);
+    unsigned int nTxWritten = 0, nTxErased = 0;
+    for (std::map<uint256, CDiskTxPos>::const_iterator it=update.mapTxs.begin(); it!=update.mapTxs.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair('t', it->first));
+            nTxErased++;
+        } else {
+            batch.Write(make_pair('t', it->first), it->second);
+            nTxWritten++;
+        }
+    }
+    for (std::map<int, CBlockFileInfo>::const_iterator it=update.mapFiles.begin(); it!=update.mapFiles.end(); it++)
+        batch.Write(make_pair('f', it->first), it->second);
+    if (update.nLastFile >= 0)
+        batch.Write('l', update.nLastFile);
+    if (update.hashSyncPoint != 0)
+        batch.Write('S', update.hashSyncPoint);
+
+    // Same filter upkeep as WriteTxIndex and EraseTxIndex
+    boost::unique_lock<boost::shared_mutex> lock(cs_txfilter);
+    if (fTxFilter && nTxWritten) {
+        if (txfilter.size() + nTxWritten > txfilter.capacity())
+            RebuildTxIndexFilter(nTxWritten);
+        for (std::map<uint256, CDiskTxPos>::const_iterator it=update.mapTxs.begin(); it!=update.mapTxs.end(); it++)
+            if (!it->second.IsNull())
+                txfilter.insert(it->first);
+    }
+    if (!WriteBatch(batch, true))
+        return false;
+    nTxFilterErased += nTxErased;
+    if (fTxFilter && nTxFilterErased > max(txfilter.size() / 2, MIN_TXINDEX_FILTER / 4))
+        RebuildTxIndexFilter(0);
+    return true;
+}
+
+bool CBlockTreeDB::LoadTxIndexFilter() {
+    boost::unique_lock<boost::shared_mutex> lock(cs_txfilter);
+    int64_t nStart = GetTimeMillis();
+    if (!RebuildTxIndexFilter(0))
+        return false;
+    LogPrintf("LoadTxIndexFilter(): %u txids %15dms\n", txfilter.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CBlockTreeDB::RebuildTxIndexFilter(unsigned int nExtra) {
+    fTxFilter = false;
+    std::vector<uint256> vTxid;
+    leveldb::Iterator *pcursor = NewIterator();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('t', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 't')
+                break;
+            uint256 txid;
+            ssKey >> txid;
+            vTxid.push_back(txid);
+        }
+    } catch (std::exception &e) {
+        delete pcursor;
+        return error("%s : Deserialize or I/O error - %s", __PRETTY_FUNCTION__, e.what());
+    }
+    delete pcursor;
+
+    // Leave room to grow, so rebuilds stay rare
+    txfilter.reset(max((unsigned int)(vTxid.size() + nExtra) * 2, MIN_TXINDEX_FILTER));
+    BOOST_FOREACH(const uint256 &txid, vTxid)
+        txfilter.insert(txid);
+    nTxFilterErased = 0;
+    fTxFilter = true;
+    return true;
+}
 
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
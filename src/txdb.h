@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXDB_LEVELDB_H
 #define BITCOIN_TXDB_LEVELDB_H
 
+#include "bloom.h"
 #include "leveldbwrapper.h"
 #include "main.h"
 
@@ -14,6 +15,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread/shared_mutex.hpp>
+
 class CBigNum;
 class CCoins;
 class uint256;
@@ -24,6 +27,39 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 // min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+// smallest number of txids the txindex filter is sized for
+static const unsigned int MIN_TXINDEX_FILTER = 1 << 16;
+
+/** Index writes held back until the block and undo data they describe is synced,
+ *  written together by CBlockTreeDB::WriteUpdate (see CBlockCache::Sync) */
+struct CBlockTreeUpdate
+{
+    std::map<uint256, CDiskBlockIndex> mapBlocks;
+    std::map<uint256, CDiskTxPos> mapTxs; // a null position erases the entry
+    std::map<int, CBlockFileInfo> mapFiles;
+    int nLastFile; // -1 when unchanged
+    uint256 hashSyncPoint; // 0 when unchanged
+
+    CBlockTreeUpdate() : nLastFile(-1), hashSyncPoint(0) {}
+
+    bool IsEmpty() const {
+        return mapBlocks.empty() && mapTxs.empty() && mapFiles.empty() && nLastFile < 0 && hashSyncPoint == 0;
+    }
+
+    // Apply the newer writes in other over these
+    void Merge(const CBlockTreeUpdate &other) {
+        for (std::map<uint256, CDiskBlockIndex>::const_iterator it=other.mapBlocks.begin(); it!=other.mapBlocks.end(); it++)
+            mapBlocks[it->first] = it->second;
+        for (std::map<uint256, CDiskTxPos>::const_iterator it=other.mapTxs.begin(); it!=other.mapTxs.end(); it++)
+            mapTxs[it->first] = it->second;
+        for (std::map<int, CBlockFileInfo>::const_iterator it=other.mapFiles.begin(); it!=other.mapFiles.end(); it++)
+            mapFiles[it->first] = it->second;
+        if (other.nLastFile >= 0)
+            nLastFile = other.nLastFile;
+        if (other.hashSyncPoint != 0)
+            hashSyncPoint = other.hashSyncPoint;
+    }
+};
 
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
@@ -33,8 +69,19 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    // Filter over every txid in the txindex, so that ReadTxIndex can answer
+    // definite misses without touching LevelDB. Only used once loaded.
+    CBlockedBloomFilter txfilter;
+    bool fTxFilter;
+    unsigned int nTxFilterErased;
+    boost::shared_mutex cs_txfilter;
+
+    // Refill the filter from the txindex, sized for nExtra more entries. Requires cs_txfilter held exclusively.
+    bool RebuildTxIndexFilter(unsigned int nExtra);
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool WriteBlockIndex(const std::vector<CDiskBlockIndex> &vect);
     bool WriteBestInvalidWork(const CBigNum& bnBestInvalidWork);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo &fileinfo);
@@ -47,6 +94,9 @@ public:
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool EraseTxIndex(uint256 key);
+    bool EraseTxIndex(const std::vector<uint256> &vect);
+    bool LoadTxIndexFilter();
+    bool WriteUpdate(const CBlockTreeUpdate &update);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
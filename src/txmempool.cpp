@@ -8,6 +8,8 @@
 #include "core.h"
 #include "txmempool.h"
 
+#include <cmath>
+
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry()
@@ -37,12 +39,60 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+// Estimated heap usage of an allocation, malloc rounds up and keeps a header
+static inline size_t MallocUsage(size_t nAlloc)
+{
+    if (nAlloc == 0)
+        return 0;
+    return ((nAlloc + 31) >> 4) << 4;
+}
+
+// A std::map or std::set node holds the value after color, parent and child pointers
+template<typename T>
+static inline size_t TreeNodeUsage()
+{
+    return MallocUsage(sizeof(T) + 4 * sizeof(void*));
+}
+
+template<typename T>
+static inline size_t VectorUsage(const std::vector<T> &v)
+{
+    return MallocUsage(v.capacity() * sizeof(T));
+}
+
+static size_t TxDynamicUsage(const CTransaction &tx)
+{
+    size_t nUsage = VectorUsage(tx.vin) + VectorUsage(tx.vout) + VectorUsage(tx.feedback) +
+                    VectorUsage(tx.url) + VectorUsage(tx.token) + VectorUsage(tx.tvalue);
+    BOOST_FOREACH(const CTxIn &txin, tx.vin)
+        nUsage += VectorUsage(txin.scriptSig);
+    return nUsage;
+}
+
+size_t CTxMemPoolEntry::DynamicMemoryUsage() const
+{
+    set<uint160> setAccounts;
+    BOOST_FOREACH(const CTxIn &txin, tx.vin)
+        setAccounts.insert(txin.pubKey);
+    BOOST_FOREACH(const CTxOut &txout, tx.vout)
+        setAccounts.insert(txout.pubKey);
+
+    return TxDynamicUsage(tx) +
+           TreeNodeUsage<pair<const uint256, CTxMemPoolEntry> >() +
+           3 * TreeNodeUsage<pair<int64_t, uint256> >() +
+           setAccounts.size() * TreeNodeUsage<uint256>();
+}
+
 CTxMemPool::CTxMemPool()
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
     // of transactions in the pool
     fSanityCheck = false;
+    nTransactionsUpdated = 0;
+    nEntryUsage = 0;
+    nRollingMinFeePerK = 0;
+    nLastRollingFeeUpdate = GetTime();
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -66,12 +116,20 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
     LOCK(cs);
     {
 	LogPrintf("addUnchecked %s\n", hash.GetHex().c_str());
-        mapTx[hash] = entry;
-        CTransaction tx = mapTx[hash].GetTx();
+        if (mapTx.count(hash))
+            return true;
+        const CTxMemPoolEntry &entryNew = mapTx.insert(make_pair(hash, entry)).first->second;
+        const CTransaction &tx = entryNew.GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
-            mapAccount[tx.vin[i].pubKey][tx.GetTxID()] = tx;
+            mapAccount[tx.vin[i].pubKey].insert(hash);
 	for (unsigned int i = 0; i < tx.vout.size(); i++)
-            mapAccount[tx.vout[i].pubKey][tx.GetTxID()] = tx;
+            mapAccount[tx.vout[i].pubKey].insert(hash);
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            mapSpends[txin.pubKey] += txin.nValue;
+        setFeeRate.insert(make_pair(entryNew.GetFeePerK(), hash));
+        setEntryTime.insert(make_pair(entryNew.GetTime(), hash));
+        setLockHeight.insert(make_pair(tx.nLockHeight, hash));
+        nEntryUsage += entryNew.DynamicMemoryUsage();
         nTransactionsUpdated++;	
 	if(tx.fSetLimit){
 	    if(mapLimits.find(tx.vin[0].pubKey) == mapLimits.end())
@@ -92,11 +150,26 @@ void CTxMemPool::remove(const CTransaction &tx)
     // also multiple transactions may use an account for input/output
     LOCK(cs);
     {
+        uint256 hash = tx.GetTxID();
+        map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.find(hash);
+        if (mi == mapTx.end())
+            return;
+        const CTxMemPoolEntry &entry = mi->second;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            map<uint160, uint64_t>::iterator it = mapSpends.find(txin.pubKey);
+            if (it != mapSpends.end() && (it->second -= txin.nValue) == 0)
+                mapSpends.erase(it);
+        }
+        setFeeRate.erase(make_pair(entry.GetFeePerK(), hash));
+        setEntryTime.erase(make_pair(entry.GetTime(), hash));
+        setLockHeight.erase(make_pair(tx.nLockHeight, hash));
+        nEntryUsage -= entry.DynamicMemoryUsage();
+
         BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            mapAccount[txin.pubKey].erase(tx.GetTxID());
+            EraseAccountTx(txin.pubKey, hash);
         BOOST_FOREACH(const CTxOut& txout, tx.vout)
-            mapAccount[txout.pubKey].erase(tx.GetTxID());
-        mapTx.erase(tx.GetTxID());
+            EraseAccountTx(txout.pubKey, hash);
+        mapTx.erase(mi);
         nTransactionsUpdated++;
 
 	if(tx.fSetLimit && mapLimits.find(tx.vin[0].pubKey) != mapLimits.end()){
@@ -109,74 +182,177 @@ void CTxMemPool::remove(const CTransaction &tx)
     }
 }
 
+void CTxMemPool::EraseAccountTx(const uint160 &account, const uint256 &hash)
+{
+    map<uint160, set<uint256> >::iterator it = mapAccount.find(account);
+    if (it == mapAccount.end())
+        return;
+    it->second.erase(hash);
+    if (it->second.empty())
+        mapAccount.erase(it);
+}
+
+void CTxMemPool::TrimToSize(size_t nSizeLimit, std::vector<CTransaction>* pvRemoved)
+{
+    LOCK(cs);
+
+    int64_t nFeeRemoved = 0;
+    unsigned int nRemoved = 0;
+    while (!setFeeRate.empty() && DynamicMemoryUsage() > nSizeLimit) {
+        set<pair<int64_t, uint256> >::iterator it = setFeeRate.begin();
+        // New transactions have to pay more than the evicted ones, by the relay fee
+        nFeeRemoved = std::max(nFeeRemoved, it->first + CTransaction::nMinRelayTxFee);
+        CTransaction tx = mapTx[it->second].GetTx();
+        remove(tx);
+        if (pvRemoved)
+            pvRemoved->push_back(tx);
+        nRemoved++;
+    }
+
+    if (nRemoved) {
+        if (nFeeRemoved > GetMinFeePerK()) {
+            nRollingMinFeePerK = nFeeRemoved;
+            nLastRollingFeeUpdate = GetTime();
+        }
+        LogPrint("mempool", "TrimToSize: removed %u transactions, minimum fee %d per kB\n", nRemoved, nRollingMinFeePerK);
+    }
+}
+
+int CTxMemPool::Expire(int64_t nTime)
+{
+    LOCK(cs);
+
+    vector<CTransaction> vRemove;
+    for (set<pair<int64_t, uint256> >::iterator it = setEntryTime.begin(); it != setEntryTime.end() && it->first < nTime; ++it)
+        vRemove.push_back(mapTx[it->second].GetTx());
+    BOOST_FOREACH(const CTransaction &tx, vRemove)
+        remove(tx);
+    return vRemove.size();
+}
+
+int64_t CTxMemPool::GetMinFeePerK()
+{
+    LOCK(cs);
+    if (nRollingMinFeePerK == 0)
+        return 0;
+
+    int64_t nNow = GetTime();
+    if (nNow > nLastRollingFeeUpdate + 10) {
+        nRollingMinFeePerK = (int64_t)(nRollingMinFeePerK / pow(2.0, (nNow - nLastRollingFeeUpdate) / (double)ROLLING_FEE_HALFLIFE));
+        nLastRollingFeeUpdate = nNow;
+        if (nRollingMinFeePerK < CTransaction::nMinRelayTxFee / 2)
+            nRollingMinFeePerK = 0;
+    }
+    return nRollingMinFeePerK;
+}
+
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nEntryUsage +
+           mapAccount.size() * TreeNodeUsage<pair<const uint160, set<uint256> > >() +
+           mapSpends.size() * TreeNodeUsage<pair<const uint160, uint64_t> >() +
+           mapLimits.size() * TreeNodeUsage<pair<const uint160, int> >();
+}
+
 int CTxMemPool::numLimits(uint160 key){
     if(mapLimits.find(key) != mapLimits.end())
 	return mapLimits[key];
     return 0;
 }
 
-void CTxMemPool::validate(std::vector<CTransaction>& removed){
+void CTxMemPool::validate(std::vector<CTransaction>& removed, const set<uint160> *psetAccounts){
     LOCK(cs);
 
-    map<uint160,uint64_t> mapBalances;
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin();
-             mi !=mapTx.end(); ++mi)
-    {
-	//printf("Analyzing tx\n");
-        const CTransaction& tx = mi->second.GetTx();
-        if (tx.IsCoinBase())
-	    continue;
-	if(!IsFinalTx(tx, chainActive.Height()+5)){ //Fudge the height a bunch here to prevent height skew from fubarring things
-	    printf("Transaction not final %s %ld %ld\n", tx.GetTxID().GetHex().c_str(), tx.nLockHeight, chainActive.Height());
-	    removed.push_back(tx);
+    set<uint256> setRemove;
+
+    //Finality is a window on nLockHeight, so only the ends of setLockHeight can have left it.
+    //Fudge the height a bunch here to prevent height skew from fubarring things
+    int nHeight = chainActive.Height()+5;
+    for (set<pair<uint64_t, uint256> >::iterator it = setLockHeight.begin(); it != setLockHeight.end(); ++it) {
+        if (IsFinalTx(mapTx[it->second].GetTx(), nHeight))
+            break;
+        setRemove.insert(it->second);
+    }
+    for (set<pair<uint64_t, uint256> >::reverse_iterator it = setLockHeight.rbegin(); it != setLockHeight.rend(); ++it) {
+        if (IsFinalTx(mapTx[it->second].GetTx(), nHeight))
+            break;
+        setRemove.insert(it->second);
+    }
+
+    vector<uint160> vAccounts;
+    if (psetAccounts) {
+        vAccounts.assign(psetAccounts->begin(), psetAccounts->end());
+    } else {
+        vAccounts.reserve(mapAccount.size());
+        for (map<uint160, set<uint256> >::iterator mi = mapAccount.begin(); mi != mapAccount.end(); ++mi)
+            vAccounts.push_back(mi->first);
+    }
+
+    //Recheck the transactions touching each account against its current balance and limit
+    BOOST_FOREACH(const uint160 &account, vAccounts) {
+        map<uint160, set<uint256> >::iterator mi = mapAccount.find(account);
+        if (mi == mapAccount.end())
             continue;
-	}
 
-        bool fMissingInputs = false;
-        BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        {
-	    //printf("Analyzing txin\n");
-	    if(mapBalances.find(txin.pubKey)!=mapBalances.end()){
-		uint64_t balance = mapBalances[txin.pubKey];
-		if(balance < txin.nValue){
-		    fMissingInputs=true;
-		    break;
-		}
-		mapBalances[txin.pubKey] -= txin.nValue;
-	    }else{
-		uint64_t balance=0;
-		if(!pviewTip->Balance(txin.pubKey,balance)){
-		    fMissingInputs=true;
-		    break;
-		}
-		uint64_t limit=0;
-		pviewTip->Limit(txin.pubKey,limit,chainActive.Height());
-		if(limit < balance)
-		    balance = limit;
-		if(balance < txin.nValue){
-		    fMissingInputs=true;
-		    break;
-		}
-		mapBalances[txin.pubKey] = balance - txin.nValue;
-	    }
+        uint64_t nAvailable = 0;
+        bool fExists = pviewTip->Balance(account, nAvailable);
+        if (fExists) {
+            uint64_t limit = 0;
+            pviewTip->Limit(account, limit, chainActive.Height());
+            if (limit < nAvailable)
+                nAvailable = limit;
         }
+        map<uint160, uint64_t>::iterator itSpends = mapSpends.find(account);
+        bool fFits = fExists && (itSpends == mapSpends.end() || itSpends->second <= nAvailable);
 
-	bool fMissingOutputs=false;
-	BOOST_FOREACH(const CTxOut& txout, tx.vout){
-	    uint64_t balance=0;
-	    if(!pviewTip->Balance(txout.pubKey,balance)){
-		if(txout.nValue < tx.GetFee()){
-		    fMissingOutputs=true;
-		}
-	    }
-	}
+        for (set<uint256>::iterator it = mi->second.begin(); it != mi->second.end(); ++it) {
+            const CTransaction &tx = mapTx[*it].GetTx();
+            if (setRemove.count(*it))
+                continue;
+            if (TxExists(*it)) {
+                setRemove.insert(*it);
+                continue;
+            }
 
-        if (fMissingInputs || fMissingOutputs || TxExists(tx.GetTxID())){ 
-	    printf("Transaction missing something %s %d %d %d\n", tx.GetTxID().GetHex().c_str(), fMissingInputs, fMissingOutputs, TxExists(tx.GetTxID()));
-	    removed.push_back(tx);
-	}
+            //Over spent accounts keep the transactions that fit in txid order
+            uint64_t nSpend = 0;
+            bool fSpends = false;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (txin.pubKey == account) {
+                    nSpend += txin.nValue;
+                    fSpends = true;
+                }
+            }
+            if (fSpends && !fFits) {
+                if (!fExists || nSpend > nAvailable) {
+                    LogPrint("mempool", "validate: %s overspends %s\n", it->GetHex(), account.GetHex());
+                    setRemove.insert(*it);
+                    continue;
+                }
+                nAvailable -= nSpend;
+            }
+
+            //Paying to an account that does not exist takes at least the fee
+            if (!fExists) {
+                BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+                    if (txout.pubKey == account && txout.nValue < tx.GetFee()) {
+                        LogPrint("mempool", "validate: %s output to %s below fee\n", it->GetHex(), account.GetHex());
+                        setRemove.insert(*it);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    BOOST_FOREACH(const uint256 &hash, setRemove) {
+        map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.find(hash);
+        if (mi == mapTx.end())
+            continue;
+        removed.push_back(mi->second.GetTx());
     }
-    BOOST_FOREACH(CTransaction tx, removed){
+    BOOST_FOREACH(const CTransaction &tx, removed){
 	remove(tx);
     }
 }
@@ -207,6 +383,12 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapAccount.clear();
+    mapSpends.clear();
+    setFeeRate.clear();
+    setEntryTime.clear();
+    setLockHeight.clear();
+    mapLimits.clear();
+    nEntryUsage = 0;
     ++nTransactionsUpdated;
 }
 
@@ -233,11 +415,12 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 bool CTxMemPool::lookup(uint160 hash, vector<CTransaction> &result) const
 {
     LOCK(cs);
-    map<uint160, map<uint256, CTransaction> >::const_iterator i = mapAccount.find(hash);
+    map<uint160, set<uint256> >::const_iterator i = mapAccount.find(hash);
     if (i == mapAccount.end()) return false;
-    map<uint256, CTransaction>::const_iterator it;
-    for(it = i->second.begin(); it!= i->second.end(); it++)
-	result.push_back(it->second);
+    for(set<uint256>::const_iterator it = i->second.begin(); it != i->second.end(); it++){
+        map<uint256, CTxMemPoolEntry>::const_iterator mi = mapTx.find(*it);
+        if (mi != mapTx.end())
+            result.push_back(mi->second.GetTx());
+    }
     return true;
 }
-
@@ -15,6 +15,12 @@
 
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Default for -maxmempool, maximum megabytes of memory the pool may use */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, hours a transaction may stay in the pool */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Half life of the minimum fee raised by evictions, in seconds */
+static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
 
 /*
  * CTxMemPool stores these:
@@ -41,6 +47,9 @@ public:
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    int64_t GetFeePerK() const { return nTxSize ? nFee * 1000 / (int64_t)nTxSize : nFee; }
+    // Heap memory of the entry and its nodes in the pool's indexes
+    size_t DynamicMemoryUsage() const;
 };
 
 /*
@@ -58,12 +67,23 @@ class CTxMemPool
 private:
     bool fSanityCheck; // Normally false, true if -checkmempool or -regtest
     unsigned int nTransactionsUpdated;
+    size_t nEntryUsage; // sum of the entries' DynamicMemoryUsage()
+    int64_t nRollingMinFeePerK; // raised by TrimToSize, decays with ROLLING_FEE_HALFLIFE
+    int64_t nLastRollingFeeUpdate;
+
+    void EraseAccountTx(const uint160 &account, const uint256 &hash);
 
 public:
     mutable CCriticalSection cs;
+    // The transactions by txid, with secondary indexes kept in step by addUnchecked and
+    // remove. The indexes only hold txids, the transaction itself is stored once in mapTx.
     map<uint256, CTxMemPoolEntry> mapTx;
-    map<uint160, map<uint256, CTransaction> > mapAccount;
+    map<uint160, set<uint256> > mapAccount; // transactions touching each account
+    set<pair<int64_t, uint256> > setFeeRate; // by fee per kB, lowest evicted first
+    set<pair<int64_t, uint256> > setEntryTime; // by time entering the pool, for expiry
+    set<pair<uint64_t, uint256> > setLockHeight; // by nLockHeight, for finality
     map<uint160, int> mapLimits;
+    map<uint160, uint64_t> mapSpends; // total spent from each account by pool transactions
 
     CTxMemPool();
 
@@ -77,9 +97,23 @@ public:
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry);
     void remove(const CTransaction &tx);
-    void validate(std::vector<CTransaction>& removed);
+    /*
+     * Remove transactions that are no longer valid on top of the active chain.
+     * Only transactions touching the accounts in psetAccounts have their balances,
+     * limits and inclusion rechecked, with NULL every account in the pool is.
+     * Finality is checked for the whole pool, through setLockHeight.
+     */
+    void validate(std::vector<CTransaction>& removed, const set<uint160> *psetAccounts = NULL);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
     void clear();
+    // Evict the lowest fee rate transactions until the pool uses at most nSizeLimit bytes,
+    // raising the minimum fee new transactions have to pay above the evicted ones
+    void TrimToSize(size_t nSizeLimit, std::vector<CTransaction>* pvRemoved = NULL);
+    // Remove transactions that entered the pool before nTime, returns how many
+    int Expire(int64_t nTime);
+    // Minimum fee per kB for entering the pool, zero unless it had to evict
+    int64_t GetMinFeePerK();
+    size_t DynamicMemoryUsage() const;
     void queryHashes(std::vector<uint256>& vtxid);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
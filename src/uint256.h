@@ -194,6 +194,38 @@ public:
     }
 
 
+    base_uint& operator*=(uint32_t b32)
+    {
+        uint64_t carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64_t n = carry + (uint64_t)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    // Schoolbook multiply, the result is truncated to BITS bits.
+    base_uint& operator*=(const base_uint& b)
+    {
+        base_uint a;
+        for (int i = 0; i < WIDTH; i++)
+            a.pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64_t carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64_t n = carry + a.pn[i + j] + (uint64_t)pn[j] * b.pn[i];
+                a.pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return *this;
+    }
+
     base_uint& operator++()
     {
         // prefix operator
@@ -661,6 +693,7 @@ inline const uint256 operator|(const base_uint256& a, const base_uint256& b) { r
 inline const uint256 operator+(const base_uint256& a, const base_uint256& b) { return uint256(a) += b; }
 inline const uint256 operator-(const base_uint256& a, const base_uint256& b) { return uint256(a) -= b; }
 inline const uint256 operator/(const base_uint256& a, const base_uint256& b) { return uint256(a) /= b; }
+inline const uint256 operator*(const base_uint256& a, const base_uint256& b) { return uint256(a) *= b; }
 
 inline bool operator<(const base_uint256& a, const uint256& b)          { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const base_uint256& a, const uint256& b)         { return (base_uint256)a <= (base_uint256)b; }
@@ -784,6 +817,8 @@ inline const uint512 operator&(const base_uint512& a, const base_uint512& b) { r
 inline const uint512 operator|(const base_uint512& a, const base_uint512& b) { return uint512(a) |= b; }
 inline const uint512 operator+(const base_uint512& a, const base_uint512& b) { return uint512(a) += b; }
 inline const uint512 operator-(const base_uint512& a, const base_uint512& b) { return uint512(a) -= b; }
+inline const uint512 operator*(const base_uint512& a, const base_uint512& b) { return uint512(a) *= b; }
+inline const uint512 operator/(const base_uint512& a, const base_uint512& b) { return uint512(a) /= b; }
 
 inline bool operator<(const base_uint512& a, const uint512& b) { return (base_uint512)a < (base_uint512)b; }
 inline bool operator<=(const base_uint512& a, const uint512& b) { return (base_uint512)a <= (base_uint512)b; }
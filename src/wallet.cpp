@@ -939,10 +939,12 @@ bool CWallet::CreateTransaction(const map<CKeyID, int64_t> &mapSend,
             nFeeRet = nTransactionFee;
             while (true)
             {
-                wtxNew.vin.clear();
-                wtxNew.vout.clear();
+                // Start from wtxNew to keep the type, feedback, url and token set by the caller
+                CMutableTransaction txNew(wtxNew);
+                txNew.vin.clear();
+                txNew.vout.clear();
                 wtxNew.fFromMe = true;
-		wtxNew.nLockHeight = chainActive.Height();
+		txNew.nLockHeight = chainActive.Height();
 
                 int64_t nTotalValue = nValue + nFeeRet;
                 double dPriority = 0;
@@ -955,7 +957,7 @@ bool CWallet::CreateTransaction(const map<CKeyID, int64_t> &mapSend,
                         strFailReason = _("Transaction amount too small");
                         return false;
                     }
-                    wtxNew.vout.push_back(txout);
+                    txNew.vout.push_back(txout);
                 }
                 // Choose coins to use
 		//printf("TV: %ld\n", nTotalValue);
@@ -978,18 +980,21 @@ bool CWallet::CreateTransaction(const map<CKeyID, int64_t> &mapSend,
                 // Fill vin
                 BOOST_FOREACH(const PAIRTYPE(uint64_t,uint160)& coin, setCoins){
 		    //printf("Vin: %ld\n", coin.first);
-                    wtxNew.vin.push_back(CTxIn(coin.second,coin.first));
+                    txNew.vin.push_back(CTxIn(coin.second,coin.first));
 		}
 
                 // Sign
                 int nIn = 0;
                 BOOST_FOREACH(const PAIRTYPE(uint64_t,uint160)& coin, setCoins)
-                    if (!SignSignature(*this, coin.second, wtxNew, nIn++))
+                    if (!SignSignature(*this, coin.second, txNew, nIn++))
                     {
                         strFailReason = _("Signing transaction failed");
                         return false;
                     }
 
+                // Embed the constructed transaction data in wtxNew
+                *static_cast<CTransaction*>(&wtxNew) = CTransaction(txNew);
+
 #if 0
 		for(int i=0; i < wtxNew.vin[0].scriptSig.size(); i++)
 			cout << hex << wtxNew.vin[0].scriptSig[i];
@@ -1123,17 +1128,19 @@ std::string CWallet::SetLimit(const CTxDestination &address, uint64_t nLimit, CW
     if(!balances.size() || balances[0].balance < (uint64_t)nTransactionFee)
 	return _("Insufficient funds");
 
-    wtx.nLimitValue = nLimit;
-    wtx.fSetLimit = true;
-    wtx.vin.push_back(CTxIn(key,nTransactionFee));
-    wtx.vout.push_back(CTxOut(0,key));
-    wtx.fFromMe = true;
-    wtx.nLockHeight = chainActive.Height();
+    CMutableTransaction txNew(wtx);
+    txNew.nLimitValue = nLimit;
+    txNew.fSetLimit = true;
+    txNew.vin.push_back(CTxIn(key,nTransactionFee));
+    txNew.vout.push_back(CTxOut(0,key));
+    txNew.nLockHeight = chainActive.Height();
 
-    if (!SignSignature(*this, key, wtx, 0))
+    if (!SignSignature(*this, key, txNew, 0))
     {
     	return _("Signing transaction failed");
     }
+    *static_cast<CTransaction*>(&wtx) = CTransaction(txNew);
+    wtx.fFromMe = true;
 
     string strError;
     if (!CommitTransaction(wtx,strError))